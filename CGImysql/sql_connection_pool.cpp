@@ -3,10 +3,12 @@
 #include <string>
 #include <string.h>
 #include <stdlib.h>
-#include <list>
+#include <vector>
 #include <pthread.h>
 #include <iostream>
 #include "sql_connection_pool.h"
+#include "../trace/recorder.h"
+#include "../trace/probes.h"
 
 using namespace std;
 
@@ -35,6 +37,7 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	m_close_log = close_log;
 
 	// 创建MaxConn条数据库连接
+	connList.reserve(MaxConn);
 	for (int i = 0; i < MaxConn; i++)
 	{
 		MYSQL *con = NULL;
@@ -72,14 +75,16 @@ MYSQL *connection_pool::GetConnection()
 	reserve.wait();
 	// 访问临界资源加锁
 	lock.lock();
-	// 拿出一个连接
-	con = connList.front();
-	connList.pop_front();
+	// 拿出最近归还的连接
+	con = connList.back();
+	connList.pop_back();
 	// 这里的两个变量，并没有用到，非常鸡肋...
 	--m_FreeConn;
 	++m_CurConn;
+	int free_conn = m_FreeConn;
 	// 离开临界区解锁
 	lock.unlock();
+	flight_recorder::record(FR_DB_ACQUIRE, free_conn);
 	return con;
 }
 
@@ -95,8 +100,10 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
 	connList.push_back(con);
 	++m_FreeConn;
 	--m_CurConn;
+	int free_conn = m_FreeConn;
 	// 解锁
 	lock.unlock();
+	flight_recorder::record(FR_DB_RELEASE, free_conn);
 	// 释放连接原子加1
 	reserve.post();
 	return true;
@@ -109,7 +116,7 @@ void connection_pool::DestroyPool()
 	if (connList.size() > 0)
 	{
 		// 通过迭代器遍历，关闭数据库连接
-		list<MYSQL *>::iterator it;
+		vector<MYSQL *>::iterator it;
 		for (it = connList.begin(); it != connList.end(); ++it)
 		{
 			MYSQL *con = *it;
@@ -129,6 +136,11 @@ int connection_pool::GetFreeConn()
 	return this->m_FreeConn;
 }
 
+int connection_pool::GetUsedConn()
+{
+	return this->m_CurConn;
+}
+
 connection_pool::~connection_pool()
 {
 	DestroyPool();
@@ -140,9 +152,11 @@ connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool)
 	*SQL = connPool->GetConnection();
 	conRAII = *SQL;
 	poolRAII = connPool;
+	PROBE1(db__acquire, conRAII);
 }
 
 connectionRAII::~connectionRAII()
 {
+	PROBE1(db__release, conRAII);
 	poolRAII->ReleaseConnection(conRAII);
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 #define _CONNECTION_POOL_
 
 #include <stdio.h>
-#include <list>
+#include <vector>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
@@ -19,6 +19,7 @@ public:
 	MYSQL *GetConnection();				 // 获取数据库连接
 	bool ReleaseConnection(MYSQL *conn); // 释放连接
 	int GetFreeConn();					 // 获取连接
+	int GetUsedConn();					 // 已被取走的连接数
 	void DestroyPool();					 // 销毁所有连接
 
 	// 单例模式
@@ -34,7 +35,7 @@ private:
 	int m_CurConn;			// 当前已使用的连接数
 	int m_FreeConn;			// 当前空闲的连接数
 	locker lock;			// 锁
-	list<MYSQL *> connList; // 连接池
+	vector<MYSQL *> connList; // 连接池，按MaxConn预留容量，取还连接不申请内存
 	sem reserve;			// 表示当前可用的数据库连接数量的信号量
 
 public:
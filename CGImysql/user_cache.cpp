@@ -0,0 +1,374 @@
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "user_cache.h"
+
+using namespace std;
+
+// 自增id并不保证按提交顺序可见，较小的id可能晚于较大的id提交
+// 每次刷新回退一小段id重新拉取，合并是幂等的，重复行不会有副作用
+static const int REFRESH_OVERLAP = 64;
+// updated_at在语句执行时取值，提交可能更晚；每次从水位线往前回看几秒，同样靠合并幂等
+static const long long UPDATED_LOOKBACK_US = 5000000;
+
+// UNIX_TIMESTAMP(updated_at)返回带6位小数的秒数，换成整数微秒，比较和翻页不受浮点误差影响
+static long long parse_us(const char *s)
+{
+	return llround(atof(s) * 1000000);
+}
+
+// 并行加载时每个线程负责的id区间
+struct load_task
+{
+	user_cache *cache;
+	long long lo;
+	long long hi;
+	int rows;
+};
+
+user_cache::user_cache()
+{
+	m_watermark = 0;
+	m_updated_us = 0;
+	m_last_sync = 0;
+	m_connPool = NULL;
+	m_refresh_interval = 0;
+	m_batch_size = 1000;
+	m_stop = false;
+	m_refresh_running = false;
+	m_close_log = 0;
+}
+
+user_cache::~user_cache()
+{
+	stop();
+}
+
+user_cache *user_cache::GetInstance()
+{
+	static user_cache cache;
+	return &cache;
+}
+
+void user_cache::init(connection_pool *connPool, int close_log, int load_threads, int refresh_interval, int batch_size)
+{
+	m_connPool = connPool;
+	m_close_log = close_log;
+	m_refresh_interval = refresh_interval;
+	m_batch_size = batch_size > 0 ? batch_size : 1000;
+
+	// 先取得id范围，再按区间切分给多个线程并行加载
+	// 同时取得最大updated_at，加载期间修改的行由第一次刷新的回看补上
+	long long min_id = 0, max_id = 0, updated_us = 0;
+	{
+		MYSQL *mysql = NULL;
+		connectionRAII mysqlcon(&mysql, connPool);
+		if (mysql == NULL || mysql_query(mysql, "SELECT IFNULL(MIN(id),0),IFNULL(MAX(id),0),IFNULL(UNIX_TIMESTAMP(MAX(updated_at)),0) FROM user"))
+		{
+			LOG_ERROR("SELECT error:%s", mysql ? mysql_error(mysql) : "no connection");
+		}
+		else
+		{
+			MYSQL_RES *result = mysql_store_result(mysql);
+			MYSQL_ROW row = result ? mysql_fetch_row(result) : NULL;
+			if (row && row[0] && row[1] && row[2])
+			{
+				min_id = atoll(row[0]);
+				max_id = atoll(row[1]);
+				updated_us = parse_us(row[2]);
+			}
+			if (result)
+				mysql_free_result(result);
+		}
+	}
+
+	// 每个加载线程占用一个数据库连接，线程数不超过连接池大小
+	int threads = load_threads;
+	if (threads > connPool->GetFreeConn())
+		threads = connPool->GetFreeConn();
+	long long span = max_id - min_id + 1;
+	if (threads > span)
+		threads = (int)span;
+	if (threads < 1)
+		threads = 1;
+	long long step = (span + threads - 1) / threads;
+
+	load_task *tasks = new load_task[threads];
+	pthread_t *tids = new pthread_t[threads];
+	for (int i = 0; i < threads; ++i)
+	{
+		tasks[i].cache = this;
+		tasks[i].lo = min_id - 1 + i * step;
+		tasks[i].hi = (i == threads - 1) ? max_id : tasks[i].lo + step;
+		tasks[i].rows = 0;
+		// 线程创建失败时退化为在当前线程加载
+		if (pthread_create(tids + i, NULL, load_worker, tasks + i) != 0)
+		{
+			tids[i] = 0;
+			load_worker(tasks + i);
+		}
+	}
+	int total = 0;
+	for (int i = 0; i < threads; ++i)
+	{
+		if (tids[i])
+			pthread_join(tids[i], NULL);
+		if (tasks[i].rows > 0)
+			total += tasks[i].rows;
+	}
+	delete[] tasks;
+	delete[] tids;
+
+	m_stat_lock.lock();
+	if (m_watermark < max_id)
+		m_watermark = max_id;
+	if (m_updated_us < updated_us)
+		m_updated_us = updated_us;
+	m_last_sync = time(NULL);
+	m_stat_lock.unlock();
+	LOG_INFO("user cache loaded %d users with %d threads, watermark %lld", total, threads, max_id);
+
+	if (m_refresh_interval > 0 && !m_refresh_running)
+	{
+		m_stop = false;
+		if (pthread_create(&m_refresh_tid, NULL, refresh_worker, this) == 0)
+			m_refresh_running = true;
+	}
+}
+
+void *user_cache::load_worker(void *arg)
+{
+	load_task *task = (load_task *)arg;
+	task->rows = task->cache->load_range(task->lo, task->hi);
+	return task;
+}
+
+int user_cache::load_range(long long lo, long long hi)
+{
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	if (mysql == NULL)
+		return -1;
+
+	char sql[128];
+	snprintf(sql, sizeof(sql), "SELECT id,username,passwd FROM user WHERE id > %lld AND id <= %lld", lo, hi);
+	if (mysql_query(mysql, sql))
+	{
+		LOG_ERROR("SELECT error:%s", mysql_error(mysql));
+		return -1;
+	}
+	MYSQL_RES *result = mysql_store_result(mysql);
+	if (result == NULL)
+		return -1;
+	int rows = (int)mysql_num_rows(result);
+	merge(result);
+	mysql_free_result(result);
+	return rows;
+}
+
+int user_cache::merge(MYSQL_RES *result, long long *last_us, long long *last_id)
+{
+	int fresh = 0;
+	long long max_id = 0, max_us = 0;
+	m_lock.wrlock();
+	while (MYSQL_ROW row = mysql_fetch_row(result))
+	{
+		if (!row[0] || !row[1] || !row[2])
+			continue;
+		long long id = atoll(row[0]);
+		if (id > max_id)
+			max_id = id;
+		if (last_us && row[3])
+		{
+			*last_us = parse_us(row[3]);
+			*last_id = id;
+			if (*last_us > max_us)
+				max_us = *last_us;
+		}
+		pair<map<string, string>::iterator, bool> ret = m_users.insert(pair<string, string>(row[1], row[2]));
+		if (ret.second)
+			++fresh;
+		else if (ret.first->second != row[2])
+		{
+			ret.first->second = row[2];
+			++fresh;
+		}
+	}
+	m_lock.unlock();
+
+	m_stat_lock.lock();
+	if (max_id > m_watermark)
+		m_watermark = max_id;
+	if (max_us > m_updated_us)
+		m_updated_us = max_us;
+	m_stat_lock.unlock();
+	return fresh;
+}
+
+int user_cache::refresh_once()
+{
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	if (mysql == NULL)
+		return -1;
+
+	long long from = watermark() - REFRESH_OVERLAP;
+	if (from < 0)
+		from = 0;
+	int fresh = 0;
+	// 分批拉取，直到某一批不满，说明已经追平数据库
+	while (!m_stop)
+	{
+		char sql[128];
+		snprintf(sql, sizeof(sql), "SELECT id,username,passwd FROM user WHERE id > %lld ORDER BY id LIMIT %d", from, m_batch_size);
+		if (mysql_query(mysql, sql))
+		{
+			LOG_ERROR("SELECT error:%s", mysql_error(mysql));
+			return -1;
+		}
+		MYSQL_RES *result = mysql_store_result(mysql);
+		if (result == NULL)
+			return -1;
+		int rows = (int)mysql_num_rows(result);
+		fresh += merge(result);
+		mysql_free_result(result);
+		if (rows < m_batch_size)
+			break;
+		from = watermark();
+	}
+	int updated = refresh_updated(mysql);
+	if (updated < 0)
+		return -1;
+	fresh += updated;
+
+	m_stat_lock.lock();
+	m_last_sync = time(NULL);
+	m_stat_lock.unlock();
+	return fresh;
+}
+
+int user_cache::refresh_updated(MYSQL *mysql)
+{
+	m_stat_lock.lock();
+	long long from_us = m_updated_us - UPDATED_LOOKBACK_US;
+	m_stat_lock.unlock();
+	if (from_us < 0)
+		from_us = 0;
+	long long from_id = 0;
+	int merged = 0;
+	// 按(updated_at, id)翻页，同一时刻修改的行超过一批也不会重复或遗漏
+	while (!m_stop)
+	{
+		char sql[384];
+		snprintf(sql, sizeof(sql),
+				 "SELECT id,username,passwd,UNIX_TIMESTAMP(updated_at) FROM user"
+				 " WHERE updated_at >= FROM_UNIXTIME(%lld.%06lld) AND (updated_at > FROM_UNIXTIME(%lld.%06lld) OR id > %lld)"
+				 " ORDER BY updated_at,id LIMIT %d",
+				 from_us / 1000000, from_us % 1000000, from_us / 1000000, from_us % 1000000, from_id, m_batch_size);
+		if (mysql_query(mysql, sql))
+		{
+			LOG_ERROR("SELECT error:%s", mysql_error(mysql));
+			return -1;
+		}
+		MYSQL_RES *result = mysql_store_result(mysql);
+		if (result == NULL)
+			return -1;
+		int rows = (int)mysql_num_rows(result);
+		// 回看范围内的行每次都会重新拉到，计入修改数的只算真正改变了口令的
+		merged += merge(result, &from_us, &from_id);
+		mysql_free_result(result);
+		if (rows < m_batch_size)
+			break;
+	}
+	return merged;
+}
+
+void *user_cache::refresh_worker(void *arg)
+{
+	user_cache *cache = (user_cache *)arg;
+	int m_close_log = cache->m_close_log;
+	while (!cache->m_stop)
+	{
+		// 等待刷新间隔，stop()会提前唤醒
+		cache->m_wake.timewait(cache->m_refresh_interval * 1000);
+		if (cache->m_stop)
+			break;
+		int fresh = cache->refresh_once();
+		if (fresh > 0)
+		{
+			LOG_INFO("user cache merged %d users, watermark %lld", fresh, cache->watermark());
+		}
+		else if (fresh < 0)
+		{
+			LOG_WARN("user cache refresh failed, lag %ds", cache->lag());
+		}
+	}
+	return cache;
+}
+
+void user_cache::stop()
+{
+	if (!m_refresh_running)
+		return;
+	m_stop = true;
+	m_wake.post();
+	pthread_join(m_refresh_tid, NULL);
+	m_refresh_running = false;
+}
+
+bool user_cache::find(const string &name, string &passwd)
+{
+	bool found = false;
+	m_lock.rdlock();
+	map<string, string>::iterator it = m_users.find(name);
+	if (it != m_users.end())
+	{
+		passwd = it->second;
+		found = true;
+	}
+	m_lock.unlock();
+	return found;
+}
+
+bool user_cache::contains(const string &name)
+{
+	m_lock.rdlock();
+	bool found = m_users.find(name) != m_users.end();
+	m_lock.unlock();
+	return found;
+}
+
+void user_cache::insert(const string &name, const string &passwd)
+{
+	m_lock.wrlock();
+	m_users[name] = passwd;
+	m_lock.unlock();
+}
+
+int user_cache::size()
+{
+	m_lock.rdlock();
+	int n = (int)m_users.size();
+	m_lock.unlock();
+	return n;
+}
+
+long long user_cache::watermark()
+{
+	m_stat_lock.lock();
+	long long w = m_watermark;
+	m_stat_lock.unlock();
+	return w;
+}
+
+int user_cache::lag()
+{
+	m_stat_lock.lock();
+	time_t last = m_last_sync;
+	m_stat_lock.unlock();
+	if (last == 0)
+		return -1;
+	return (int)(time(NULL) - last);
+}
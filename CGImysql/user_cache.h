@@ -0,0 +1,76 @@
+#ifndef _USER_CACHE_
+#define _USER_CACHE_
+
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+// 用户名和密码的内存缓存
+// 启动时按id区间并行分块加载user表，之后由后台线程增量同步：
+// 按id水位线拉取新注册的用户，按updated_at水位线拉取改过口令的用户(包括其他节点的修改和口令哈希升级)
+class user_cache
+{
+public:
+	// 单例模式
+	static user_cache *GetInstance();
+
+	// load_threads为启动时并行加载的线程数，refresh_interval为增量刷新间隔(秒)，0表示不刷新
+	void init(connection_pool *connPool, int close_log, int load_threads = 4, int refresh_interval = 5, int batch_size = 1000);
+	// 查找用户，找到时将密码写入passwd
+	bool find(const string &name, string &passwd);
+	bool contains(const string &name);
+	// 本节点注册成功后直接写入缓存
+	void insert(const string &name, const string &passwd);
+	// 停止后台刷新线程
+	void stop();
+
+	int size();
+	// 已同步到的最大id
+	long long watermark();
+	// 距上一次成功追平数据库的秒数，刷新线程卡住或数据库不可用时持续增大
+	int lag();
+
+private:
+	user_cache();
+	~user_cache();
+
+	// 加载(lo, hi]区间内的用户，返回加载到的行数，出错返回-1
+	int load_range(long long lo, long long hi);
+	// 拉取水位线之后的新用户和改过的用户，返回合并的行数，出错返回-1
+	int refresh_once();
+	// 拉取updated_at水位线之后修改过的用户，返回合并的行数，出错返回-1
+	int refresh_updated(MYSQL *mysql);
+	// 将一个结果集合并到缓存并推进id水位线，返回新增或口令变化的用户数
+	// 结果集带第4列UNIX_TIMESTAMP(updated_at)时还推进updated_at水位线，并把最后一行的(updated_at, id)写入last_us、last_id
+	int merge(MYSQL_RES *result, long long *last_us = NULL, long long *last_id = NULL);
+
+	static void *load_worker(void *arg);
+	static void *refresh_worker(void *arg);
+
+private:
+	map<string, string> m_users; // 用户名和密码
+	rwlocker m_lock;			 // 保护m_users，读多写少
+	locker m_stat_lock;			 // 保护水位线和同步时间
+	long long m_watermark;		 // 已加载的最大id
+	long long m_updated_us;		 // 已同步到的最大updated_at，微秒
+	time_t m_last_sync;			 // 上一次追平数据库的时间
+
+	connection_pool *m_connPool;
+	int m_refresh_interval;
+	int m_batch_size;
+	std::atomic<bool> m_stop;	 // stop()在主线程设置，刷新线程读取
+	sem m_wake;					 // stop()唤醒刷新线程
+	pthread_t m_refresh_tid;
+	bool m_refresh_running;
+
+public:
+	int m_close_log; // 日志开关
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*************************************************************
+ * 日志吞吐测试：1~16个线程并发写日志，统计每秒写入的行数
+ * 用法: ./log_bench [0同步|1异步|2二进制] [每轮总行数] [日志文件]
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "../log/log.h"
+
+static int m_close_log = 0;
+static int g_lines_per_thread = 0;
+static pthread_barrier_t g_barrier;
+
+static double now_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *bench_worker(void *arg)
+{
+    long id = (long)arg;
+    pthread_barrier_wait(&g_barrier);
+    for (int i = 0; i < g_lines_per_thread; ++i)
+    {
+        LOG_INFO("bench thread %ld line %d client(%s) %s", id, i, "127.0.0.1", "adjust timer once");
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int async = argc > 1 ? atoi(argv[1]) : 1;
+    int total = argc > 2 ? atoi(argv[2]) : 500000;
+    const char *file = argc > 3 ? argv[3] : "./BenchLog";
+
+    if (!Log::get_instance()->init(file, 0, 2000, 800000000, async ? 64 * 1024 : 0, 1000, 64, async == 2))
+    {
+        fprintf(stderr, "open log %s failed\n", file);
+        return 1;
+    }
+
+    static const char *modes[] = {"sync", "async", "binary"};
+    printf("mode: %s, %d lines per round\n", modes[async == 2 ? 2 : (async ? 1 : 0)], total);
+    printf("%8s %14s %12s\n", "threads", "lines/sec", "waits");
+    const int thread_counts[] = {1, 2, 4, 8, 16};
+    for (size_t k = 0; k < sizeof(thread_counts) / sizeof(thread_counts[0]); ++k)
+    {
+        int threads = thread_counts[k];
+        g_lines_per_thread = total / threads;
+        long long waits_before = Log::get_instance()->waits();
+
+        pthread_t tids[16];
+        pthread_barrier_init(&g_barrier, NULL, threads + 1);
+        for (long i = 0; i < threads; ++i)
+            pthread_create(&tids[i], NULL, bench_worker, (void *)i);
+        pthread_barrier_wait(&g_barrier);
+        double start = now_sec();
+        for (int i = 0; i < threads; ++i)
+            pthread_join(tids[i], NULL);
+        double cost = now_sec() - start;
+        pthread_barrier_destroy(&g_barrier);
+
+        long long lines = (long long)g_lines_per_thread * threads;
+        printf("%8d %14.0f %12lld\n", threads, lines / cost, Log::get_instance()->waits() - waits_before);
+    }
+    return 0;
+}
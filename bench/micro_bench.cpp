@@ -0,0 +1,542 @@
+/*************************************************************
+ * 核心数据结构的微基准测试，基于Google Benchmark
+ * 用法: make bench，结果同时输出到终端和micro_bench.json
+ *       ./micro_bench --benchmark_filter=Timer 只运行部分测试
+ **************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <string>
+#include <benchmark/benchmark.h>
+#include "../http/http_conn.h"
+#include "../timer/lst_timer.h"
+#include "../log/block_queue.h"
+#include "../threadpool/threadpool.h"
+
+static int m_close_log = 0;
+
+// 统计全局分配器的调用次数：替换malloc等函数，转发给glibc的__libc_*实现
+// g_count_allocs打开期间所有线程的分配都计入g_allocs，new/delete最终也经过这里
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+extern "C" void *__libc_memalign(size_t, size_t);
+static std::atomic<bool> g_count_allocs(false);
+static std::atomic<long> g_allocs(0);
+static inline void count_alloc()
+{
+    if (g_count_allocs.load(std::memory_order_relaxed))
+        g_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+extern "C" void *malloc(size_t n)
+{
+    count_alloc();
+    return __libc_malloc(n);
+}
+extern "C" void *calloc(size_t n, size_t size)
+{
+    count_alloc();
+    return __libc_calloc(n, size);
+}
+extern "C" void *realloc(void *p, size_t n)
+{
+    count_alloc();
+    return __libc_realloc(p, n);
+}
+extern "C" void *memalign(size_t align, size_t n)
+{
+    count_alloc();
+    return __libc_memalign(align, n);
+}
+extern "C" void *aligned_alloc(size_t align, size_t n)
+{
+    count_alloc();
+    return __libc_memalign(align, n);
+}
+extern "C" int posix_memalign(void **p, size_t align, size_t n)
+{
+    if (align < sizeof(void *) || (align & (align - 1)))
+        return EINVAL;
+    count_alloc();
+    *p = __libc_memalign(align, n);
+    return *p ? 0 : ENOMEM;
+}
+
+// 计数区间：构造时开始计数，report把区间内每次迭代的平均分配次数写入allocs_per_iter
+// 这些测试覆盖的都是稳态下不应申请内存的路径，计数不为0时该项标记为出错，main返回非0
+static std::atomic<bool> g_alloc_failed(false);
+struct alloc_counter
+{
+    long start;
+    alloc_counter() : start(g_allocs.load())
+    {
+        g_count_allocs.store(true);
+    }
+    void report(benchmark::State &state)
+    {
+        g_count_allocs.store(false);
+        long n = g_allocs.load() - start;
+        state.counters["allocs_per_iter"] = state.iterations() ? (double)n / state.iterations() : 0;
+        if (n > 0)
+        {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "%ld allocations in %lld iterations, hot path must not allocate",
+                     n, (long long)state.iterations());
+            g_alloc_failed.store(true);
+            state.SkipWithError(msg);
+        }
+    }
+};
+
+// 典型浏览器请求，约400字节8个头部
+static const char *browser_get =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9\r\n"
+    "Cookie: sid=0123456789abcdef0123456789abcdef\r\n"
+    "\r\n";
+static const char *minimal_get =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+static const char *form_post =
+    "POST /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 26\r\n"
+    "\r\n"
+    "user=bench&password=bench1";
+static const char *canned[] = {minimal_get, browser_get, form_post};
+
+// 访问http_conn私有成员，只在本文件中使用
+class http_conn_bench
+{
+public:
+    static http_conn *create()
+    {
+        http_conn *c = new http_conn;
+        c->m_close_log = 1;
+        c->m_epoll_et = 0;
+        c->m_sockfd = -1;
+        // 不存在的根目录，do_request只做一次失败的stat，不测文件系统
+        c->doc_root = (char *)"/nonexistent-bench-root";
+        c->m_file_address = NULL;
+        c->init();
+        return c;
+    }
+    // 每个请求开始时服务器也会调用init，一并计入
+    // 服务器中工作线程处理完每个任务后回收请求内存池，这里在下一个请求开始前回收
+    static void load(http_conn *c, const char *req, int len)
+    {
+        request_arena::local()->reset();
+        c->init();
+        memcpy(c->m_read_buf, req, len);
+        c->m_read_idx = len;
+    }
+    static int split_lines(http_conn *c)
+    {
+        int lines = 0;
+        while (c->parse_line() == http_conn::LINE_OK)
+        {
+            c->m_start_line = c->m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+    static http_conn::HTTP_CODE process_read(http_conn *c) { return c->process_read(); }
+    static bool process_write(http_conn *c, http_conn::HTTP_CODE code, int file_size, bool linger)
+    {
+        c->init();
+        c->m_linger = linger;
+        c->m_file_stat.st_size = file_size;
+        return c->process_write(code);
+    }
+    static int write_len(http_conn *c) { return c->m_write_idx; }
+    // 静态文件GET在工作线程中的完整处理：解析、映射文件、生成响应、记录指标、解除映射
+    static bool static_get(http_conn *c, const char *req, int len)
+    {
+        load(c, req, len);
+        http_conn::HTTP_CODE code = c->process_read();
+        if (code != http_conn::FILE_REQUEST || !c->process_write(code))
+            return false;
+        c->request_done();
+        c->unmap();
+        return true;
+    }
+    static void set_root(http_conn *c, char *root) { c->doc_root = root; }
+};
+
+static void BM_ParseLine(benchmark::State &state)
+{
+    http_conn *c = http_conn_bench::create();
+    const char *req = canned[state.range(0)];
+    int len = strlen(req);
+    for (auto _ : state)
+    {
+        http_conn_bench::load(c, req, len);
+        benchmark::DoNotOptimize(http_conn_bench::split_lines(c));
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+    delete c;
+}
+BENCHMARK(BM_ParseLine)->DenseRange(0, 2)->ArgName("req");
+
+static void BM_ProcessRead(benchmark::State &state)
+{
+    http_conn *c = http_conn_bench::create();
+    const char *req = canned[state.range(0)];
+    int len = strlen(req);
+    for (auto _ : state)
+    {
+        http_conn_bench::load(c, req, len);
+        benchmark::DoNotOptimize(http_conn_bench::process_read(c));
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+    delete c;
+}
+BENCHMARK(BM_ProcessRead)->DenseRange(0, 2)->ArgName("req");
+
+static void BM_ProcessWrite(benchmark::State &state)
+{
+    http_conn *c = http_conn_bench::create();
+    http_conn::HTTP_CODE code = state.range(0) ? http_conn::FILE_REQUEST : http_conn::BAD_REQUEST;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(http_conn_bench::process_write(c, code, 4096, true));
+    state.counters["header_bytes"] = http_conn_bench::write_len(c);
+    delete c;
+}
+BENCHMARK(BM_ProcessWrite)->Arg(0)->Arg(1)->ArgName("file");
+
+// 静态文件GET的稳态处理路径，allocs_per_iter应为0；需要在仓库根目录下运行，使用./root/judge.html
+static void BM_StaticGet(benchmark::State &state)
+{
+    static char root[256];
+    if (!getcwd(root, sizeof(root) - 8))
+    {
+        state.SkipWithError("getcwd failed");
+        return;
+    }
+    strcat(root, "/root");
+    http_conn *c = http_conn_bench::create();
+    http_conn_bench::set_root(c, root);
+    const char *req = canned[state.range(0)];
+    int len = strlen(req);
+    // 第一次处理会创建线程私有的日志缓冲区、指标和请求内存池的第一块，不计入
+    if (!http_conn_bench::static_get(c, req, len))
+    {
+        state.SkipWithError("./root/judge.html not found, run from the repository root");
+        delete c;
+        return;
+    }
+    alloc_counter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(http_conn_bench::static_get(c, req, len));
+    counter.report(state);
+    delete c;
+}
+BENCHMARK(BM_StaticGet)->Arg(0)->Arg(1)->ArgName("req");
+
+// 定时器回调什么也不做，tick测试只测链表操作
+static void noop_cb(client_data *) {}
+
+// 客户端读走已经到达的全部响应，返回字节数
+static int drain_response(int client, char *buf, int buf_len)
+{
+    int got = 0;
+    int n;
+    while ((n = recv(client, buf, buf_len, MSG_DONTWAIT)) > 0)
+        got += n;
+    return got;
+}
+
+// 服务器处理一次读事件：epoll取事件、延后定时器、read_once、process、write并重新注册读事件，
+// 与reactor/proactor模式中一个keep-alive请求在服务器内经过的函数相同，只是都在当前线程执行
+static bool socket_serve(http_conn *c, int epfd, sort_timer_lst &lst, util_timer *timer)
+{
+    struct epoll_event ev[4];
+    if (epoll_wait(epfd, ev, 4, 1000) != 1 || !(ev[0].events & EPOLLIN))
+        return false;
+    c->mark_ready();
+    timer->expire = time(NULL) + 15;
+    lst.adjust_timer(timer);
+    if (!c->read_once<LevelTriggered>())
+        return false;
+    LOG_INFO("deal with the client(%s)", inet_ntoa(c->get_address()->sin_addr));
+    c->mark_queued();
+    c->process();
+    // 工作线程处理完一个任务后回收请求内存池
+    request_arena::local()->reset();
+    if (epoll_wait(epfd, ev, 4, 1000) != 1 || !(ev[0].events & EPOLLOUT))
+        return false;
+    return c->write<LevelTriggered>();
+}
+
+// 同一个keep-alive连接上的静态文件GET，经过真实的socket读写和epoll重新注册，allocs_per_iter应为0
+// 用socketpair代替TCP连接，不经过网络协议栈；需要在仓库根目录下运行
+static void BM_SocketGet(benchmark::State &state)
+{
+    static char root[256];
+    if (!getcwd(root, sizeof(root) - 8))
+    {
+        state.SkipWithError("getcwd failed");
+        return;
+    }
+    strcat(root, "/root");
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    int epfd = epoll_create(5);
+    http_conn::m_epollfd = epfd;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    http_conn *c = new http_conn;
+    c->init<LevelTriggered>(sv[0], addr, root, 1);
+
+    sort_timer_lst lst;
+    client_data data;
+    memset(&data, 0, sizeof(data));
+    data.sockfd = sv[0];
+    util_timer *timer = lst.alloc_timer();
+    timer->expire = time(NULL) + 15;
+    timer->cb_func = noop_cb;
+    timer->user_data = &data;
+    lst.add_timer(timer);
+
+    const char *req = canned[state.range(0)];
+    int len = strlen(req);
+    static char buf[65536];
+    // 第一个请求让线程私有的缓冲区都创建好，不计入；write返回时响应已经全部写入socket
+    bool ok = send(sv[1], req, len, MSG_NOSIGNAL) == len && socket_serve(c, epfd, lst, timer);
+    int expect = ok ? drain_response(sv[1], buf, sizeof(buf)) : 0;
+    if (expect <= 0)
+        state.SkipWithError("./root/judge.html not served, run from the repository root");
+    else
+    {
+        alloc_counter counter;
+        for (auto _ : state)
+        {
+            if (send(sv[1], req, len, MSG_NOSIGNAL) != len || !socket_serve(c, epfd, lst, timer) ||
+                drain_response(sv[1], buf, sizeof(buf)) != expect)
+            {
+                state.SkipWithError("request failed");
+                break;
+            }
+        }
+        counter.report(state);
+        state.SetBytesProcessed(state.iterations() * (len + expect));
+    }
+    lst.del_timer(timer);
+    c->close_conn();
+    close(sv[1]);
+    close(epfd);
+    delete c;
+}
+BENCHMARK(BM_SocketGet)->Arg(0)->Arg(1)->ArgName("req");
+
+struct timer_fixture
+{
+    sort_timer_lst lst;
+    client_data data;
+    vector<util_timer *> timers;
+
+    // n个定时器，到期时间从base开始依次加1
+    timer_fixture(int n, time_t base)
+    {
+        memset(&data, 0, sizeof(data));
+        data.sockfd = -1;
+        for (int i = 0; i < n; ++i)
+            timers.push_back(make(base + i));
+        // 对象池按组申请，先取放一次，让测试中的alloc_timer总能从空闲链表取到
+        lst.del_timer(make(base + n));
+    }
+    ~timer_fixture()
+    {
+        for (size_t i = 0; i < timers.size(); ++i)
+            lst.del_timer(timers[i]);
+    }
+    util_timer *make(time_t expire)
+    {
+        util_timer *t = lst.alloc_timer();
+        t->expire = expire;
+        t->cb_func = noop_cb;
+        t->user_data = &data;
+        lst.add_timer(t);
+        return t;
+    }
+};
+
+// 新连接的到期时间最晚，服务器中总是加到链表尾部
+static void BM_TimerAddTail(benchmark::State &state)
+{
+    time_t base = time(NULL) + 3600;
+    timer_fixture f(state.range(0), base);
+    time_t expire = base + state.range(0);
+    alloc_counter counter;
+    for (auto _ : state)
+    {
+        util_timer *t = f.make(expire);
+        f.lst.del_timer(t);
+    }
+    counter.report(state);
+}
+BENCHMARK(BM_TimerAddTail)->RangeMultiplier(8)->Range(8, 32768);
+
+// 到期时间落在链表中间，需要遍历一半
+static void BM_TimerAddMiddle(benchmark::State &state)
+{
+    time_t base = time(NULL) + 3600;
+    timer_fixture f(state.range(0), base);
+    time_t expire = base + state.range(0) / 2;
+    for (auto _ : state)
+    {
+        util_timer *t = f.make(expire);
+        f.lst.del_timer(t);
+    }
+}
+BENCHMARK(BM_TimerAddMiddle)->RangeMultiplier(8)->Range(8, 32768);
+
+// 连接有数据时把链表头部的定时器延后到最晚，对应dealwithread中的adjust_timer
+static void BM_TimerAdjust(benchmark::State &state)
+{
+    time_t base = time(NULL) + 3600;
+    timer_fixture f(state.range(0), base);
+    time_t expire = base + state.range(0);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        util_timer *t = f.timers[i];
+        t->expire = expire++;
+        f.lst.adjust_timer(t);
+        if (++i == f.timers.size())
+            i = 0;
+    }
+}
+BENCHMARK(BM_TimerAdjust)->RangeMultiplier(8)->Range(8, 32768);
+
+// 每次tick有一个定时器到期，其余n个未到期
+static void BM_TimerTick(benchmark::State &state)
+{
+    timer_fixture f(state.range(0), time(NULL) + 3600);
+    for (auto _ : state)
+    {
+        // 到期的定时器由tick删除
+        f.make(0);
+        f.lst.tick();
+    }
+}
+BENCHMARK(BM_TimerTick)->RangeMultiplier(8)->Range(8, 32768);
+
+static block_queue<string> *g_queue = new block_queue<string>(1024);
+
+// 多个线程同时push和pop，每个线程先push再pop，不会永久阻塞
+static void BM_BlockQueue(benchmark::State &state)
+{
+    string item(96, 'x');
+    string out;
+    for (auto _ : state)
+    {
+        g_queue->push(item);
+        g_queue->pop(out);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BlockQueue)->ThreadRange(1, 8)->UseRealTime();
+
+// 线程池任务，write中计数，对应reactor模式下的写任务，不需要数据库连接
+struct pool_task
+{
+    int m_state;
+    std::atomic<int> improv;
+    std::atomic<int> timer_flag;
+    MYSQL *mysql;
+    std::atomic<long> *done;
+    template <typename Trig>
+    bool read_once() { return true; }
+    void process() {}
+    template <typename Trig>
+    bool write()
+    {
+        done->fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+// 一批任务从append到全部被工作线程执行完的吞吐
+static void BM_ThreadpoolAppendRun(benchmark::State &state)
+{
+    const int batch = 256;
+    static threadpool<pool_task> *pool = new threadpool<pool_task>(ReactorPolicy(), LevelTriggered(), NULL, 4, 10000);
+    std::atomic<long> done(0);
+    vector<pool_task> tasks(batch);
+    for (int i = 0; i < batch; ++i)
+        tasks[i].done = &done;
+    // 第一批任务等工作线程全部启动完，线程启动时的分配不计入
+    long expected = 0;
+    for (int round = 0; round < 4; ++round)
+    {
+        for (int i = 0; i < batch; ++i)
+            pool->append(&tasks[i], 1);
+        expected += batch;
+        while (done.load(std::memory_order_relaxed) < expected)
+            sched_yield();
+    }
+    alloc_counter counter;
+    for (auto _ : state)
+    {
+        for (int i = 0; i < batch; ++i)
+            pool->append(&tasks[i], 1);
+        expected += batch;
+        while (done.load(std::memory_order_relaxed) < expected)
+            sched_yield();
+    }
+    counter.report(state);
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_ThreadpoolAppendRun)->UseRealTime();
+
+// 异步日志写入，多个线程并发
+static void BM_LogWrite(benchmark::State &state)
+{
+    int i = 0;
+    for (auto _ : state)
+        LOG_INFO("bench thread %d line %d client(%s) %s", state.thread_index(), ++i, "127.0.0.1", "adjust timer once");
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogWrite)->ThreadRange(1, 8)->UseRealTime();
+
+int main(int argc, char **argv)
+{
+    // 异步日志，参数与log_bench相同，文件名以BenchLog结尾
+    if (!Log::get_instance()->init("./BenchLog", 0, 2000, 800000000, 64 * 1024, 1000, 64))
+    {
+        fprintf(stderr, "open log ./BenchLog failed\n");
+        return 1;
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    if (g_alloc_failed.load())
+    {
+        fprintf(stderr, "allocations found on a hot path, see allocs_per_iter errors above\n");
+        return 1;
+    }
+    return 0;
+}
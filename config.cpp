@@ -31,12 +31,51 @@ Config::Config()
 
     // 并发模型,默认是proactor
     actor_model = 0;
+
+    // 日志刷盘间隔,默认1000ms
+    log_flush_ms = 1000;
+
+    // 日志刷盘阈值,默认64KB
+    log_flush_kb = 64;
+
+    // 日志最低级别,默认DEBUG
+    log_level = 0;
+
+    // 日志文件大小,默认不限制
+    log_max_mb = 0;
+
+    // 旧日志保留个数,默认全部保留
+    log_keep = 0;
+
+    // 压缩旧日志,默认不压缩
+    log_gzip = 0;
+
+    // 日志限流,默认不限制
+    log_rate = 0;
+
+    // 日志采样,默认全部写入
+    log_sample = "1,1,1,1";
+
+    // 访问日志,默认关闭
+    access_log = 0;
+
+    // 慢请求自动转储飞行记录器,默认关闭
+    flight_slow_ms = 0;
+
+    // 流量捕获,默认关闭
+    capture_mb = 0;
+
+    // 准入控制,默认排队超过20ms持续100ms进入过载
+    admission_ms = 20;
+
+    // 退出时最多等待10秒
+    drain_ms = 10000;
 }
 
 void Config::parse_arg(int argc, char *argv[])
 {
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:f:k:v:z:r:g:q:n:x:d:u:e:w:";
     // getopt用于解析参数，第三个参数是选项字符串，详情自己搜吧
     while ((opt = getopt(argc, argv, str)) != -1)
     {
@@ -82,6 +121,71 @@ void Config::parse_arg(int argc, char *argv[])
             actor_model = atoi(optarg);
             break;
         }
+        case 'f':
+        {
+            log_flush_ms = atoi(optarg);
+            break;
+        }
+        case 'k':
+        {
+            log_flush_kb = atoi(optarg);
+            break;
+        }
+        case 'v':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            log_max_mb = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            log_keep = atoi(optarg);
+            break;
+        }
+        case 'g':
+        {
+            log_gzip = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            log_rate = atoi(optarg);
+            break;
+        }
+        case 'n':
+        {
+            log_sample = optarg;
+            break;
+        }
+        case 'x':
+        {
+            access_log = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            flight_slow_ms = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            capture_mb = atoi(optarg);
+            break;
+        }
+        case 'e':
+        {
+            admission_ms = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            drain_ms = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,45 @@ public:
 
     // 并发模型选择，0，Proactor模型，1，Reactor模型
     int actor_model;
+
+    // 日志定时刷盘间隔，单位毫秒
+    int log_flush_ms;
+
+    // 日志累积多少KB刷盘一次
+    int log_flush_kb;
+
+    // 日志最低级别，0 DEBUG，1 INFO，2 WARN，3 ERROR
+    int log_level;
+
+    // 单个日志文件大小上限，单位MB，0不限制
+    int log_max_mb;
+
+    // 保留的旧日志文件个数，0不删除
+    int log_keep;
+
+    // 是否gzip压缩旧日志文件
+    int log_gzip;
+
+    // 每个日志调用点每秒最多写多少条，0不限制
+    int log_rate;
+
+    // 各级别日志1/N采样，依次为DEBUG,INFO,WARN,ERROR
+    string log_sample;
+
+    // 访问日志格式 0关闭 1CLF 2JSON
+    int access_log;
+
+    // 请求耗时超过多少毫秒时转储飞行记录器，0不自动转储
+    int flight_slow_ms;
+
+    // 流量捕获文件大小上限(MB)，0不捕获
+    int capture_mb;
+
+    // 准入控制的排队时间目标(毫秒)，0关闭
+    int admission_ms;
+
+    // 收到SIGTERM后等待在途请求完成的最长时间(毫秒)
+    int drain_ms;
 };
 
 #endif
\ No newline at end of file
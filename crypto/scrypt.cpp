@@ -0,0 +1,461 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/random.h>
+#include <vector>
+#include "scrypt.h"
+
+using namespace std;
+
+/*************************************************************
+ * SHA-256 / HMAC-SHA256 / PBKDF2
+ **************************************************************/
+
+struct sha256_ctx
+{
+    uint32_t state[8];
+    uint64_t count; // 已处理的字节数
+    uint8_t buf[64];
+};
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(uint32_t state[8], const uint8_t block[64])
+{
+    uint32_t W[64];
+    for (int i = 0; i < 16; ++i)
+        W[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = ROTR(W[i - 15], 7) ^ ROTR(W[i - 15], 18) ^ (W[i - 15] >> 3);
+        uint32_t s1 = ROTR(W[i - 2], 17) ^ ROTR(W[i - 2], 19) ^ (W[i - 2] >> 10);
+        W[i] = W[i - 16] + s0 + W[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + S1 + ch + K256[i] + W[i];
+        uint32_t S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = S0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256_init(sha256_ctx *ctx)
+{
+    static const uint32_t H0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, H0, sizeof(H0));
+    ctx->count = 0;
+}
+
+static void sha256_update(sha256_ctx *ctx, const uint8_t *data, size_t len)
+{
+    size_t used = ctx->count % 64;
+    ctx->count += len;
+    if (used)
+    {
+        size_t fill = 64 - used;
+        if (len < fill)
+        {
+            memcpy(ctx->buf + used, data, len);
+            return;
+        }
+        memcpy(ctx->buf + used, data, fill);
+        sha256_transform(ctx->state, ctx->buf);
+        data += fill;
+        len -= fill;
+    }
+    while (len >= 64)
+    {
+        sha256_transform(ctx->state, data);
+        data += 64;
+        len -= 64;
+    }
+    memcpy(ctx->buf, data, len);
+}
+
+static void sha256_final(sha256_ctx *ctx, uint8_t out[32])
+{
+    uint64_t bits = ctx->count * 8;
+    size_t used = ctx->count % 64;
+    ctx->buf[used++] = 0x80;
+    if (used > 56)
+    {
+        memset(ctx->buf + used, 0, 64 - used);
+        sha256_transform(ctx->state, ctx->buf);
+        used = 0;
+    }
+    memset(ctx->buf + used, 0, 56 - used);
+    for (int i = 0; i < 8; ++i)
+        ctx->buf[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_transform(ctx->state, ctx->buf);
+    for (int i = 0; i < 8; ++i)
+    {
+        out[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        out[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        out[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        out[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void sha256(const uint8_t *data, size_t len, uint8_t out[32])
+{
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
+
+// HMAC的内外两层状态，PBKDF2迭代时复用，避免每轮重新处理密钥
+struct hmac_sha256_ctx
+{
+    sha256_ctx inner;
+    sha256_ctx outer;
+};
+
+static void hmac_sha256_init(hmac_sha256_ctx *ctx, const uint8_t *key, size_t keylen)
+{
+    uint8_t khash[32];
+    uint8_t pad[64];
+    if (keylen > 64)
+    {
+        sha256(key, keylen, khash);
+        key = khash;
+        keylen = 32;
+    }
+    memset(pad, 0x36, 64);
+    for (size_t i = 0; i < keylen; ++i)
+        pad[i] ^= key[i];
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, pad, 64);
+
+    memset(pad, 0x5c, 64);
+    for (size_t i = 0; i < keylen; ++i)
+        pad[i] ^= key[i];
+    sha256_init(&ctx->outer);
+    sha256_update(&ctx->outer, pad, 64);
+}
+
+static void hmac_sha256_final(hmac_sha256_ctx *ctx, uint8_t out[32])
+{
+    uint8_t ihash[32];
+    sha256_final(&ctx->inner, ihash);
+    sha256_update(&ctx->outer, ihash, 32);
+    sha256_final(&ctx->outer, out);
+}
+
+void pbkdf2_sha256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt, size_t saltlen,
+                   uint64_t c, uint8_t *buf, size_t dklen)
+{
+    hmac_sha256_ctx base, ctx;
+    hmac_sha256_init(&base, passwd, passwdlen);
+    // 先处理salt，每个块只需追加4字节的块序号
+    hmac_sha256_ctx salted = base;
+    sha256_update(&salted.inner, salt, saltlen);
+
+    for (uint32_t i = 0; (size_t)i * 32 < dklen; ++i)
+    {
+        uint8_t ivec[4] = {(uint8_t)((i + 1) >> 24), (uint8_t)((i + 1) >> 16),
+                           (uint8_t)((i + 1) >> 8), (uint8_t)(i + 1)};
+        uint8_t U[32], T[32];
+        ctx = salted;
+        sha256_update(&ctx.inner, ivec, 4);
+        hmac_sha256_final(&ctx, U);
+        memcpy(T, U, 32);
+        for (uint64_t j = 1; j < c; ++j)
+        {
+            ctx = base;
+            sha256_update(&ctx.inner, U, 32);
+            hmac_sha256_final(&ctx, U);
+            for (int k = 0; k < 32; ++k)
+                T[k] ^= U[k];
+        }
+        size_t clen = dklen - (size_t)i * 32;
+        if (clen > 32)
+            clen = 32;
+        memcpy(buf + (size_t)i * 32, T, clen);
+    }
+}
+
+/*************************************************************
+ * scrypt: Salsa20/8 + BlockMix + ROMix
+ **************************************************************/
+
+#define R32(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+static void salsa20_8(uint32_t B[16])
+{
+    uint32_t x[16];
+    memcpy(x, B, sizeof(x));
+    for (int i = 0; i < 8; i += 2)
+    {
+        // 列变换
+        x[4] ^= R32(x[0] + x[12], 7);
+        x[8] ^= R32(x[4] + x[0], 9);
+        x[12] ^= R32(x[8] + x[4], 13);
+        x[0] ^= R32(x[12] + x[8], 18);
+        x[9] ^= R32(x[5] + x[1], 7);
+        x[13] ^= R32(x[9] + x[5], 9);
+        x[1] ^= R32(x[13] + x[9], 13);
+        x[5] ^= R32(x[1] + x[13], 18);
+        x[14] ^= R32(x[10] + x[6], 7);
+        x[2] ^= R32(x[14] + x[10], 9);
+        x[6] ^= R32(x[2] + x[14], 13);
+        x[10] ^= R32(x[6] + x[2], 18);
+        x[3] ^= R32(x[15] + x[11], 7);
+        x[7] ^= R32(x[3] + x[15], 9);
+        x[11] ^= R32(x[7] + x[3], 13);
+        x[15] ^= R32(x[11] + x[7], 18);
+        // 行变换
+        x[1] ^= R32(x[0] + x[3], 7);
+        x[2] ^= R32(x[1] + x[0], 9);
+        x[3] ^= R32(x[2] + x[1], 13);
+        x[0] ^= R32(x[3] + x[2], 18);
+        x[6] ^= R32(x[5] + x[4], 7);
+        x[7] ^= R32(x[6] + x[5], 9);
+        x[4] ^= R32(x[7] + x[6], 13);
+        x[5] ^= R32(x[4] + x[7], 18);
+        x[11] ^= R32(x[10] + x[9], 7);
+        x[8] ^= R32(x[11] + x[10], 9);
+        x[9] ^= R32(x[8] + x[11], 13);
+        x[10] ^= R32(x[9] + x[8], 18);
+        x[12] ^= R32(x[15] + x[14], 7);
+        x[13] ^= R32(x[12] + x[15], 9);
+        x[14] ^= R32(x[13] + x[12], 13);
+        x[15] ^= R32(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; ++i)
+        B[i] += x[i];
+}
+
+// B为2r个64字节块，Y为同样大小的临时空间
+static void blockmix_salsa8(uint32_t *B, uint32_t *Y, uint32_t r)
+{
+    uint32_t X[16];
+    memcpy(X, &B[(2 * r - 1) * 16], 64);
+    for (uint32_t i = 0; i < 2 * r; ++i)
+    {
+        for (int k = 0; k < 16; ++k)
+            X[k] ^= B[i * 16 + k];
+        salsa20_8(X);
+        memcpy(&Y[i * 16], X, 64);
+    }
+    // 偶数块在前，奇数块在后
+    for (uint32_t i = 0; i < r; ++i)
+        memcpy(&B[i * 16], &Y[(i * 2) * 16], 64);
+    for (uint32_t i = 0; i < r; ++i)
+        memcpy(&B[(i + r) * 16], &Y[(i * 2 + 1) * 16], 64);
+}
+
+static inline uint32_t le32dec(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void le32enc(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+    p[2] = (uint8_t)(x >> 16);
+    p[3] = (uint8_t)(x >> 24);
+}
+
+static void smix(uint8_t *B, uint32_t r, uint64_t N, uint32_t *V, uint32_t *XY)
+{
+    uint32_t *X = XY;
+    uint32_t *Y = XY + 32 * r;
+    size_t words = 32 * r;
+
+    for (size_t k = 0; k < words; ++k)
+        X[k] = le32dec(&B[4 * k]);
+    for (uint64_t i = 0; i < N; ++i)
+    {
+        memcpy(&V[i * words], X, words * 4);
+        blockmix_salsa8(X, Y, r);
+    }
+    for (uint64_t i = 0; i < N; ++i)
+    {
+        // Integerify: 取最后一个块的第一个字
+        uint64_t j = X[(2 * r - 1) * 16] & (N - 1);
+        for (size_t k = 0; k < words; ++k)
+            X[k] ^= V[j * words + k];
+        blockmix_salsa8(X, Y, r);
+    }
+    for (size_t k = 0; k < words; ++k)
+        le32enc(&B[4 * k], X[k]);
+}
+
+bool scrypt(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt, size_t saltlen,
+            uint64_t N, uint32_t r, uint32_t p, uint8_t *buf, size_t dklen)
+{
+    // N必须是大于1的2的幂
+    if (N < 2 || (N & (N - 1)) != 0 || r == 0 || p == 0)
+        return false;
+    if ((uint64_t)r * p >= (1 << 30) || N > (uint64_t)(1 << 24) / r)
+        return false;
+
+    // 每个哈希线程复用自己的工作内存，登录时不再反复申请十几MB
+    static thread_local vector<uint32_t> work;
+    size_t blen = 128 * (size_t)r * p;
+    size_t vwords = 32 * (size_t)r * N;
+    size_t xywords = 64 * (size_t)r;
+    if (work.size() < vwords + xywords)
+        work.resize(vwords + xywords);
+    vector<uint8_t> B(blen);
+
+    pbkdf2_sha256(passwd, passwdlen, salt, saltlen, 1, B.data(), blen);
+    for (uint32_t i = 0; i < p; ++i)
+        smix(&B[(size_t)i * 128 * r], r, N, work.data(), work.data() + vwords);
+    pbkdf2_sha256(passwd, passwdlen, B.data(), blen, 1, buf, dklen);
+    return true;
+}
+
+/*************************************************************
+ * 口令编码与校验
+ **************************************************************/
+
+bool random_bytes(void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+    while (len > 0)
+    {
+        ssize_t n = getrandom(p, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void to_hex(const uint8_t *in, size_t len, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; ++i)
+    {
+        out[i * 2] = digits[in[i] >> 4];
+        out[i * 2 + 1] = digits[in[i] & 0xf];
+    }
+    out[len * 2] = '\0';
+}
+
+static bool from_hex(const char *in, size_t len, uint8_t *out)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        int v = 0;
+        for (int k = 0; k < 2; ++k)
+        {
+            char c = in[i * 2 + k];
+            v <<= 4;
+            if (c >= '0' && c <= '9')
+                v |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                v |= c - 'a' + 10;
+            else
+                return false;
+        }
+        out[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+// 与内容无关的定长比较，避免通过响应时间猜测口令
+static bool const_time_equal(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; ++i)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+bool password_hash(const char *password, char *out, size_t outlen)
+{
+    uint8_t salt[SCRYPT_SALT_LEN];
+    uint8_t hash[SCRYPT_HASH_LEN];
+    char salt_hex[SCRYPT_SALT_LEN * 2 + 1];
+    char hash_hex[SCRYPT_HASH_LEN * 2 + 1];
+
+    if (!random_bytes(salt, sizeof(salt)))
+        return false;
+    if (!scrypt((const uint8_t *)password, strlen(password), salt, sizeof(salt),
+                (uint64_t)1 << SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, hash, sizeof(hash)))
+        return false;
+    to_hex(salt, sizeof(salt), salt_hex);
+    to_hex(hash, sizeof(hash), hash_hex);
+    int n = snprintf(out, outlen, "$s1$%d$%d$%d$%s$%s", SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, salt_hex, hash_hex);
+    return n > 0 && (size_t)n < outlen;
+}
+
+bool password_verify(const char *password, const char *stored)
+{
+    if (strncmp(stored, "$s1$", 4) != 0)
+    {
+        // 旧数据为明文存储
+        size_t plen = strlen(password), slen = strlen(stored);
+        return plen == slen && const_time_equal((const uint8_t *)password, (const uint8_t *)stored, plen);
+    }
+
+    int logN, r, p, off = 0;
+    if (sscanf(stored, "$s1$%d$%d$%d$%n", &logN, &r, &p, &off) != 3 || off == 0)
+        return false;
+    if (logN < 1 || logN > 24 || r < 1 || p < 1)
+        return false;
+    const char *salt_hex = stored + off;
+    const char *sep = strchr(salt_hex, '$');
+    if (!sep || (sep - salt_hex) != SCRYPT_SALT_LEN * 2 || strlen(sep + 1) != SCRYPT_HASH_LEN * 2)
+        return false;
+
+    uint8_t salt[SCRYPT_SALT_LEN], expect[SCRYPT_HASH_LEN], hash[SCRYPT_HASH_LEN];
+    if (!from_hex(salt_hex, SCRYPT_SALT_LEN, salt) || !from_hex(sep + 1, SCRYPT_HASH_LEN, expect))
+        return false;
+    if (!scrypt((const uint8_t *)password, strlen(password), salt, sizeof(salt),
+                (uint64_t)1 << logN, r, p, hash, sizeof(hash)))
+        return false;
+    return const_time_equal(hash, expect, sizeof(hash));
+}
+
+bool password_needs_rehash(const char *stored)
+{
+    int logN, r, p;
+    if (sscanf(stored, "$s1$%d$%d$%d$", &logN, &r, &p) != 3)
+        return true;
+    return logN < SCRYPT_LOG_N || r < SCRYPT_R || p < SCRYPT_P;
+}
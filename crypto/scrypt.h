@@ -0,0 +1,34 @@
+#ifndef SCRYPT_H
+#define SCRYPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// scrypt默认参数: N = 2^14, r = 8, p = 1, 每次计算约占用16MB内存
+const int SCRYPT_LOG_N = 14;
+const int SCRYPT_R = 8;
+const int SCRYPT_P = 1;
+const int SCRYPT_SALT_LEN = 16;
+const int SCRYPT_HASH_LEN = 32;
+// 编码后的口令串: $s1$logN$r$p$salt(hex)$hash(hex)
+const int PASSWORD_HASH_LEN = 128;
+
+// SHA-256摘要
+void sha256(const uint8_t *data, size_t len, uint8_t out[32]);
+// PBKDF2-HMAC-SHA256
+void pbkdf2_sha256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt, size_t saltlen,
+                   uint64_t c, uint8_t *buf, size_t dklen);
+// scrypt密钥派生(RFC 7914)，参数非法或内存不足时返回false
+bool scrypt(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt, size_t saltlen,
+            uint64_t N, uint32_t r, uint32_t p, uint8_t *buf, size_t dklen);
+
+// 从内核读取随机字节
+bool random_bytes(void *buf, size_t len);
+// 用随机盐生成编码后的口令串，out至少PASSWORD_HASH_LEN字节
+bool password_hash(const char *password, char *out, size_t outlen);
+// 校验口令，stored不是scrypt编码时按旧的明文存储比较
+bool password_verify(const char *password, const char *stored);
+// 明文存储或参数低于当前默认值时需要重新哈希
+bool password_needs_rehash(const char *stored);
+
+#endif
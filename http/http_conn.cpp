@@ -13,40 +13,16 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is temporarily busy, please try again later.\n";
 
 locker m_lock;
-// 用户名和密码
-map<string, string> users;
 
-// 将数据库中的用户名和密码载入到服务器的map中来
+// 将数据库中的用户名和密码载入到服务器的缓存中来
+// 启动时并行分块加载，之后由后台线程增量同步其他节点注册的用户
 void http_conn::initmysql_result(connection_pool *connPool)
 {
-    // 先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    // 在user表中检索username，passwd数据，浏览器端输入
-    if (mysql_query(mysql, "SELECT username,passwd FROM user")) // 查询数据库中是否有username和passwd，成功返回0，失败返回非零值
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    // 从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql); // 将数据库中查询(mysql_query)得到的结果(集合)存放在MySQL_RES结构中
-
-    // 返回结果集中的列数
-    int num_fields = mysql_num_fields(result); // 返回结果集中的列的数目
-
-    // 返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    // 从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result)) // 返回结果集(MYSQL_RES)的当前行的结果
-    {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
-    }
+    user_cache::GetInstance()->init(connPool, connPool->m_close_log);
 }
 
 // 对文件描述符设置非阻塞
@@ -58,16 +34,13 @@ int setnonblocking(int fd)
     return old_option;
 }
 
-// 将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
+// 将内核事件表注册读事件，选择开启EPOLLONESHOT
+// et为EPOLLET或0，由调用方按触发模式在编译期给出
+void addfd(int epollfd, int fd, bool one_shot, unsigned int et)
 {
     epoll_event event;
     event.data.fd = fd;
-
-    if (1 == TRIGMode)
-        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP; // EPOLLRDHUP：对端异常断开，底层处理
-    else
-        event.events = EPOLLIN | EPOLLRDHUP;
+    event.events = EPOLLIN | EPOLLRDHUP | et; // EPOLLRDHUP：对端异常断开，底层处理
 
     if (one_shot)
         event.events |= EPOLLONESHOT; // EPOLLONESHOT：操作系统最多触发其中一个可读，可写或异常事件，且只能触发一次
@@ -83,54 +56,99 @@ void removefd(int epollfd, int fd)
 }
 
 // 将事件重置为EPOLLONESHOT，确保下一次可读时，EPOLLIN事件能被触发
-void modfd(int epollfd, int fd, int ev, int TRIGMode)
+// ev中已包含触发模式对应的EPOLLET
+void modfd(int epollfd, int fd, unsigned int ev)
 {
     epoll_event event;
     event.data.fd = fd;
-
-    if (1 == TRIGMode)
-        event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-    else
-        event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
-
+    event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
+hashpool<http_conn> *http_conn::m_hashpool = NULL;
+char http_conn::s_overload[256];
+int http_conn::s_overload_len = 0;
+std::atomic<bool> http_conn::m_draining(false);
 
-// 关闭一个连接，客户总量减一，参数默认为true
+void http_conn::render_overload(int retry_after)
+{
+    s_overload_len = snprintf(s_overload, sizeof(s_overload),
+                              "HTTP/1.1 503 %s\r\nContent-Length:%d\r\nRetry-After:%d\r\nConnection:close\r\n\r\n%s",
+                              error_503_title, (int)strlen(error_503_form), retry_after, error_503_form);
+}
+
+void http_conn::shed()
+{
+    int sent = send(m_sockfd, s_overload, s_overload_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    // 先发FIN，503排在FIN之前；reactor模式下请求还没有读，关闭时接收缓冲区里有未读数据内核会发RST，
+    // 客户端可能来不及收到503，这里把已经到达的请求读掉；只读一小段，不让过载时的主线程耗在慢客户端上
+    shutdown(m_sockfd, SHUT_WR);
+    char buf[4096];
+    for (int i = 0; i < 16 && recv(m_sockfd, buf, sizeof(buf), MSG_DONTWAIT) > 0; ++i)
+        ;
+    metrics::count_shed();
+    metrics::count_request(503);
+    traffic_capture::resp(m_sockfd, 503);
+
+    // 被拒绝的请求同样写访问日志，没有解析，方法和路径记为"-"
+    access_log *log = access_log::get_instance();
+    if (!log->enabled())
+        return;
+    access_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.done_ns = monotonic_ns();
+    rec.addr = m_cold->m_address.sin_addr.s_addr;
+    rec.port = m_cold->m_address.sin_port;
+    rec.status = 503;
+    rec.bytes = sent > 0 ? sent : 0;
+    rec.method = "-";
+    strcpy(rec.path, "-");
+    log->append(rec);
+}
+
+bool http_conn::idle()
+{
+    // 读事件处理后到响应发完之间m_t_ready非0，其他线程可能正在处理
+    if (m_t_ready.load(std::memory_order_acquire))
+        return false;
+    // 有未读的数据说明请求已经到了，读事件还没处理；对端已关闭(返回0)时也可以关闭
+    char c;
+    return recv(m_sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;
+}
+
+// 关闭一个连接，参数默认为true
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
+        traffic_capture::close(m_sockfd);
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
-        m_user_count--;
+        // 连接数不在这里减：连接的定时器随后仍由cb_func删除，在那里统一减一次
     }
 }
 
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
-                     int close_log, string user, string passwd, string sqlname)
+template <typename Trig>
+void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int close_log)
 {
     m_sockfd = sockfd;
-    m_address = addr;
+    m_cold->m_address = addr;
+    m_t_accept = monotonic_ns();
+    m_epoll_et = Trig::epoll_flag;
+    m_async.store(false, std::memory_order_relaxed);
     // 将sockfd交给m_epollfd监听，此处说明一个新用户连接
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    addfd(m_epollfd, sockfd, true, Trig::epoll_flag);
     // 用户量加一
     m_user_count++;
 
     // 当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
-    strcpy(sql_user, user.c_str());
-    strcpy(sql_passwd, passwd.c_str());
-    strcpy(sql_name, sqlname.c_str());
-
     init();
 }
 
@@ -148,6 +166,9 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_cookie = 0;
+    m_authed = false;
+    m_cold->m_sid[0] = '\0';
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
@@ -156,10 +177,16 @@ void http_conn::init()
     m_state = 0;
     timer_flag = 0;
     improv = 0;
+    // 响应发完后由发送的线程清零，release保证主线程读到0时这个请求的处理已经结束
+    m_t_ready.store(0, std::memory_order_release);
+    m_read_ns = 0;
+    m_t_queued = m_t_dequeued = m_t_parsed = m_t_handled = 0;
+    m_cold->m_body.clear();
+    m_body_address = NULL;
+    m_status = 0;
 
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
 }
 
 // 从状态机，用于分析出一行内容
@@ -208,7 +235,17 @@ http_conn::LINE_STATUS http_conn::parse_line()
 
 // 循环读取客户数据，直到无数据可读或对方关闭连接
 // 非阻塞ET工作模式下，需要一次性将数据读完
+template <typename Trig>
 bool http_conn::read_once()
+{
+    uint64_t start = monotonic_ns();
+    bool ret = read_socket<Trig>();
+    m_read_ns += monotonic_ns() - start;
+    return ret;
+}
+
+template <typename Trig>
+bool http_conn::read_socket()
 {
     // 此处的处理并不健壮
     if (m_read_idx >= READ_BUFFER_SIZE)
@@ -217,8 +254,8 @@ bool http_conn::read_once()
     }
     int bytes_read = 0;
 
-    // LT读取数据
-    if (0 == m_TRIGMode)
+    // LT读取数据，Trig::mode是编译期常量，另一个分支不会生成代码
+    if (0 == Trig::mode)
     {
         // 从套接字接收数据，存储在m_read_buf缓冲区
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
@@ -228,6 +265,8 @@ bool http_conn::read_once()
         {
             return false;
         }
+        metrics::count_bytes_in(bytes_read);
+        traffic_capture::data(m_sockfd, m_read_buf + m_read_idx - bytes_read, bytes_read);
 
         return true;
     }
@@ -252,6 +291,8 @@ bool http_conn::read_once()
             }
             // 修改m_read_idx的读取字节数
             m_read_idx += bytes_read;
+            metrics::count_bytes_in(bytes_read);
+            traffic_capture::data(m_sockfd, m_read_buf + m_read_idx - bytes_read, bytes_read);
         }
         return true;
     }
@@ -367,6 +408,13 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    // 解析请求头部Cookie字段，会话id在do_request中校验
+    else if (strncasecmp(text, "Cookie:", 7) == 0)
+    {
+        text += 7;
+        text += strspn(text, " \t");
+        m_cookie = text;
+    }
     else
     {
         LOG_INFO("oop! unknow header: %s", text);
@@ -446,124 +494,239 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
+// 从Cookie头部取出sid并在会话表中校验，不访问数据库和用户缓存
+bool http_conn::session_valid()
+{
+    const char *c = m_cookie;
+    while (c && *c)
+    {
+        c += strspn(c, " \t;");
+        if (strncmp(c, "sid=", 4) == 0)
+        {
+            c += 4;
+            int len = strcspn(c, "; \t");
+            return session_store::get_instance()->validate(c, len);
+        }
+        c = strchr(c, ';');
+    }
+    return false;
+}
+
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    // 将初始化的m_real_file赋值为网站根目录，doc_root为网站根目录
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    // printf("m_url:%s\n", m_url);
+    m_t_parsed = monotonic_ns();
+    // 运行指标，正文在内存中生成
+    if (strcmp(m_url, "/metrics") == 0)
+    {
+        metrics::get_instance()->render(m_cold->m_body);
+        return BUFFER_REQUEST;
+    }
+    // CPU采样，/profile?seconds=N
+    if (strncmp(m_url, "/profile", 8) == 0 && (m_url[8] == '\0' || m_url[8] == '?'))
+        return do_profile();
     // 找到m_url中/的位置
     const char *p = strrchr(m_url, '/');
+    m_authed = session_valid();
 
     // 处理cgi
     // 实现登录和注册校验
     if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
     {
-
         // 根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+        m_cold->m_cgi_flag = *(p + 1);
 
         // 将用户名和密码提取出来
-        // user=123&passwd=123
-        char name[100], password[100];
+        // user=123&password=123
         int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
+        for (i = 5; m_string[i] != '&' && m_string[i] != '\0' && i - 5 < CGI_FIELD_LEN - 1; ++i)
+            m_cold->m_cgi_name[i - 5] = m_string[i];
+        m_cold->m_cgi_name[i - 5] = '\0';
 
         int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        if (*(p + 1) == '3')
+        if (m_string[i] == '&')
         {
-            // 如果是注册，先检测数据库中是否有重名的
-            // 没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
+            for (i = i + 10; m_string[i] != '\0' && j < CGI_FIELD_LEN - 1; ++i, ++j)
+                m_cold->m_cgi_passwd[j] = m_string[i];
         }
-        // 如果是登录，直接判断
-        // 若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
+        m_cold->m_cgi_passwd[j] = '\0';
+
+        // 口令哈希耗时较长，交给独立的哈希线程池，由哈希线程完成响应
+        if (m_hashpool)
         {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
+            m_async.store(true, std::memory_order_release);
+            if (m_hashpool->append(this))
+                return ASYNC_REQUEST;
+            m_async.store(false, std::memory_order_relaxed);
+            // 哈希队列已满，直接拒绝，避免排队拖垮登录延迟
+            LOG_WARN("%s", "hash queue full, reject login");
+            return SERVICE_UNAVAILABLE;
         }
+        do_cgi(mysql);
     }
+    return do_file();
+}
 
-    if (*(p + 1) == '0')
+http_conn::HTTP_CODE http_conn::do_profile()
+{
+    // 采样结果暴露了内部实现，只对本机开放
+    // 接口仍在对外的监听端口上，按对端地址限制：127.0.0.0/8都是本机回环地址
+    if ((ntohl(m_cold->m_address.sin_addr.s_addr) >> 24) != 127)
+        return FORBIDDEN_REQUEST;
+    int seconds = 5;
+    const char *arg = strstr(m_url, "seconds=");
+    if (arg)
+        seconds = atoi(arg + 8);
+    // 采样期间连接不再有事件，由采样线程到时后完成响应
+    m_async.store(true, std::memory_order_release);
+    if (!cpu_profiler::get_instance()->start(seconds, profile_done, this))
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        m_async.store(false, std::memory_order_relaxed);
+        return SERVICE_UNAVAILABLE;
     }
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    return ASYNC_REQUEST;
+}
+
+void http_conn::profile_done(void *arg, const string &folded)
+{
+    http_conn *conn = (http_conn *)arg;
+    conn->m_cold->m_body = folded;
+    conn->complete(BUFFER_REQUEST);
+}
 
-        free(m_url_real);
+// 哈希线程中完成登录或注册校验，再生成响应
+void http_conn::process_hash()
+{
+    // 工作线程的mysql连接在process返回时已经归还，注册时从连接池另取一个
+    if ('3' == m_cold->m_cgi_flag)
+    {
+        MYSQL *conn = NULL;
+        connectionRAII mysqlcon(&conn, connection_pool::GetInstance());
+        do_cgi(conn);
     }
-    else if (*(p + 1) == '5')
+    else
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        do_cgi(NULL);
+    }
+    complete(do_file());
+}
 
-        free(m_url_real);
+// 登录和注册校验，根据结果改写m_url
+void http_conn::do_cgi(MYSQL *conn)
+{
+    user_cache *cache = user_cache::GetInstance();
+    if ('3' == m_cold->m_cgi_flag)
+    {
+        // 如果是注册，先检测是否有重名的
+        // 没有重名的，哈希口令后增加数据
+        char hashed[PASSWORD_HASH_LEN];
+        if (!cache->contains(m_cold->m_cgi_name) && conn && password_hash(m_cold->m_cgi_passwd, hashed, sizeof(hashed)))
+        {
+            // 用户名来自表单，转义后再拼进SQL；口令哈希由服务器生成，只含可打印的安全字符
+            char name[2 * CGI_FIELD_LEN + 1];
+            mysql_real_escape_string(conn, name, m_cold->m_cgi_name, strlen(m_cold->m_cgi_name));
+            char sql_insert[512];
+            snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, passwd) VALUES('%s', '%s')", name, hashed);
+
+            m_lock.lock();
+            int res = mysql_query(conn, sql_insert);
+            if (!res)
+                cache->insert(m_cold->m_cgi_name, hashed);
+            m_lock.unlock();
+
+            if (!res)
+                strcpy(m_url, "/log.html");
+            else
+                strcpy(m_url, "/registerError.html");
+        }
+        else
+            strcpy(m_url, "/registerError.html");
     }
-    else if (*(p + 1) == '6')
+    // 如果是登录，校验口令哈希
+    else if ('2' == m_cold->m_cgi_flag)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        string stored;
+        if (cache->find(m_cold->m_cgi_name, stored) && password_verify(m_cold->m_cgi_passwd, stored.c_str()))
+        {
+            strcpy(m_url, "/welcome.html");
+            // 下发会话cookie，之后访问登录后的页面不需要再提交口令
+            if (session_store::get_instance()->create(m_cold->m_cgi_name, m_cold->m_sid))
+                m_authed = true;
+            // 明文存储的旧用户登录成功后顺便升级为哈希存储
+            if (password_needs_rehash(stored.c_str()))
+                rehash_passwd(conn);
+        }
+        else
+            strcpy(m_url, "/logError.html");
     }
-    else if (*(p + 1) == '7')
+}
+
+void http_conn::rehash_passwd(MYSQL *conn)
+{
+    char hashed[PASSWORD_HASH_LEN];
+    if (!password_hash(m_cold->m_cgi_passwd, hashed, sizeof(hashed)))
+        return;
+    if (conn == NULL)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        connectionRAII mysqlcon(&conn, connection_pool::GetInstance());
+        if (conn)
+            update_passwd(conn, hashed);
+        return;
+    }
+    update_passwd(conn, hashed);
+}
 
-        free(m_url_real);
+void http_conn::update_passwd(MYSQL *conn, const char *hashed)
+{
+    char name[2 * CGI_FIELD_LEN + 1];
+    mysql_real_escape_string(conn, name, m_cold->m_cgi_name, strlen(m_cold->m_cgi_name));
+    char sql_update[512];
+    snprintf(sql_update, sizeof(sql_update), "UPDATE user SET passwd='%s' WHERE username='%s'", hashed, name);
+    m_lock.lock();
+    if (!mysql_query(conn, sql_update))
+        user_cache::GetInstance()->insert(m_cold->m_cgi_name, hashed);
+    m_lock.unlock();
+}
+
+// 将请求的资源映射到文件
+http_conn::HTTP_CODE http_conn::do_file()
+{
+    const char *url = m_url;
+    const char *p = strrchr(url, '/');
+
+    // 已登录的用户访问首页直接进入欢迎页，未登录时访问欢迎页返回登录页
+    if (m_authed && strcmp(url, "/judge.html") == 0)
+        url = "/welcome.html";
+    else if (!m_authed && strcmp(url, "/welcome.html") == 0)
+        url = "/log.html";
+    p = strrchr(url, '/');
+
+    // 首页上的按钮以数字开头的路径跳转到对应页面
+    switch (*(p + 1))
+    {
+    case '0':
+        url = "/register.html";
+        break;
+    case '1':
+        url = "/log.html";
+        break;
+    case '5':
+        url = "/picture.html";
+        break;
+    case '6':
+        url = "/video.html";
+        break;
+    case '7':
+        url = "/fans.html";
+        break;
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
-    if (stat(m_real_file, &m_file_stat) < 0)
+    // 文件路径只在本函数中使用，从请求内存池分配；doc_root为网站根目录，过长的路径被截断
+    char *real_file = request_arena::local()->alloc_str(FILENAME_LEN);
+    if (!real_file)
+        return INTERNAL_ERROR;
+    snprintf(real_file, FILENAME_LEN, "%s%s", doc_root, url);
+
+    if (stat(real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
 
     if (!(m_file_stat.st_mode & S_IROTH))
@@ -572,7 +735,7 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
 
-    int fd = open(m_real_file, O_RDONLY);
+    int fd = open(real_file, O_RDONLY);
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
@@ -586,6 +749,63 @@ void http_conn::unmap()
         m_file_address = 0;
     }
 }
+// 两个时间点之间的微秒数，缺少任一时间点时记为0
+static uint32_t span_us(uint64_t from, uint64_t to)
+{
+    if (from == 0 || to < from)
+        return 0;
+    return (to - from) / 1000;
+}
+
+void http_conn::request_done()
+{
+    stage_times t;
+    t.accept = m_t_accept;
+    t.ready = m_t_ready.load(std::memory_order_relaxed);
+    t.read_ns = m_read_ns;
+    t.queued = m_t_queued;
+    t.dequeued = m_t_dequeued;
+    t.parsed = m_t_parsed;
+    t.handled = m_t_handled;
+    t.done = monotonic_ns();
+    metrics::count_request(m_status);
+    metrics::record_stages(t);
+    traffic_capture::resp(m_sockfd, m_status);
+    uint64_t total_us = t.ready && t.done > t.ready ? (t.done - t.ready) / 1000 : 0;
+    flight_recorder::record(FR_SEND_DONE, total_us, m_sockfd);
+    flight_recorder::get_instance()->check_slow(total_us);
+    // 建连耗时只算连接上的第一个请求
+    m_t_accept = 0;
+
+    access_log *log = access_log::get_instance();
+    if (!log->enabled())
+        return;
+    static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
+    access_record rec;
+    rec.done_ns = t.done;
+    rec.addr = m_cold->m_address.sin_addr.s_addr;
+    rec.port = m_cold->m_address.sin_port;
+    rec.status = m_status;
+    rec.bytes = bytes_have_send;
+    // 没有经过do_request的请求(如解析出错)，解析一直算到生成响应，与运行指标一致
+    uint64_t parsed = m_t_parsed ? m_t_parsed : m_t_handled;
+    rec.queue_us = span_us(m_t_queued, m_t_dequeued);
+    rec.parse_us = span_us(m_t_dequeued, parsed);
+    rec.handler_us = span_us(parsed, m_t_handled);
+    rec.send_us = span_us(m_t_handled, rec.done_ns);
+    rec.method = method_names[m_method];
+    // 登录注册请求的m_url已被改写为实际返回的页面
+    if (m_url)
+    {
+        strncpy(rec.path, m_url, ACCESS_PATH_LEN - 1);
+        rec.path[ACCESS_PATH_LEN - 1] = '\0';
+    }
+    else
+        strcpy(rec.path, "-");
+    log->append(rec);
+}
+
+template <typename Trig>
 bool http_conn::write()
 {
     int temp = 0;
@@ -593,8 +813,8 @@ bool http_conn::write()
     // 表示响应报文为空，一般不会出现这种情况
     if (bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         init();
+        modfd(m_epollfd, m_sockfd, EPOLLIN | Trig::epoll_flag);
         return true;
     }
 
@@ -607,19 +827,20 @@ bool http_conn::write()
         {
             if (errno == EAGAIN)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                modfd(m_epollfd, m_sockfd, EPOLLOUT | Trig::epoll_flag);
                 return true;
             }
             unmap();
             return false;
         }
 
+        metrics::count_bytes_out(temp);
         bytes_have_send += temp;
         bytes_to_send -= temp;
         if (bytes_have_send >= m_iv[0].iov_len)
         {
             m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_base = (char *)m_body_address + (bytes_have_send - m_write_idx);
             m_iv[1].iov_len = bytes_to_send;
         }
         else
@@ -631,11 +852,14 @@ bool http_conn::write()
         if (bytes_to_send <= 0)
         {
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            request_done();
 
-            if (m_linger)
+            // 排空阶段已经发出keep-alive的响应发完后也关闭
+            if (m_linger && !m_draining.load(std::memory_order_relaxed))
             {
+                // 先重置连接状态再注册读事件，注册之后其他线程可能立即开始处理下一个请求
                 init();
+                modfd(m_epollfd, m_sockfd, EPOLLIN | Trig::epoll_flag);
                 return true;
             }
             else
@@ -675,13 +899,14 @@ bool http_conn::add_response(const char *format, ...)
 // 添加状态行：http/1.1 状态码 状态消息
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 // add_headers函数添加消息报头，内部调用add_content_length和add_linger函数
 bool http_conn::add_headers(int content_len)
 {
     return add_content_length(content_len) && add_linger() &&
-           add_blank_line();
+           add_session_cookie() && add_blank_line();
 }
 // 记录响应报文长度，用于浏览器端判断服务器是否发送完数据
 bool http_conn::add_content_length(int content_len)
@@ -696,8 +921,17 @@ bool http_conn::add_content_type()
 // 用于告诉浏览器端保持长连接
 bool http_conn::add_linger()
 {
+    if (m_draining.load(std::memory_order_relaxed))
+        m_linger = false;
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+// 登录成功时下发会话cookie
+bool http_conn::add_session_cookie()
+{
+    if (m_cold->m_sid[0] == '\0')
+        return true;
+    return add_response("Set-Cookie:sid=%s; Path=/; HttpOnly; Max-Age=%d\r\n", m_cold->m_sid, session_store::get_instance()->ttl());
+}
 // 添加空行
 bool http_conn::add_blank_line()
 {
@@ -723,6 +957,15 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    // 服务器过载，503，与准入控制拒绝时的响应相同：带Retry-After，发完关闭连接
+    case SERVICE_UNAVAILABLE:
+    {
+        m_status = 503;
+        m_linger = false;
+        memcpy(m_write_buf, s_overload, s_overload_len);
+        m_write_idx = s_overload_len;
+        break;
+    }
     // 报文语法有误，404
     case BAD_REQUEST:
     {
@@ -753,6 +996,7 @@ bool http_conn::process_write(HTTP_CODE ret)
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
             // 第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
+            m_body_address = m_file_address;
             m_iv[1].iov_base = m_file_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
@@ -768,6 +1012,22 @@ bool http_conn::process_write(HTTP_CODE ret)
             if (!add_content(ok_string))
                 return false;
         }
+        break;
+    }
+    // 内存中生成的正文，200
+    case BUFFER_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        if (!add_response("Content-Type:%s\r\n", "text/plain; version=0.0.4") || !add_headers(m_cold->m_body.size()))
+            return false;
+        m_body_address = m_cold->m_body.data();
+        m_iv[0].iov_base = m_write_buf;
+        m_iv[0].iov_len = m_write_idx;
+        m_iv[1].iov_base = (char *)m_body_address;
+        m_iv[1].iov_len = m_cold->m_body.size();
+        m_iv_count = 2;
+        bytes_to_send = m_write_idx + m_cold->m_body.size();
+        return true;
     }
     default:
         return false;
@@ -782,19 +1042,45 @@ bool http_conn::process_write(HTTP_CODE ret)
 // 子线程通过process函数对任务进行处理，分别完成报文解析和报文响应两个任务
 void http_conn::process()
 {
+    m_t_dequeued = monotonic_ns();
+    PROBE1(request__start, m_sockfd);
     // 进行报文解析
     HTTP_CODE read_ret = process_read();
     // NO_REQUEST表示报文不完整，需要继续解析
     if (read_ret == NO_REQUEST)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); // 注册并监听事件
+        modfd(m_epollfd, m_sockfd, EPOLLIN | m_epoll_et); // 注册并监听事件
+        PROBE2(request__end, m_sockfd, read_ret);
         return;
     }
+    // 请求已交给哈希线程，由其调用complete完成响应
+    // 此时socket处于EPOLLONESHOT未重新注册的状态，不会再有其他线程处理该连接
+    if (read_ret == ASYNC_REQUEST)
+    {
+        PROBE2(request__end, m_sockfd, read_ret);
+        return;
+    }
+    complete(read_ret);
+    PROBE2(request__end, m_sockfd, read_ret);
+}
+
+// 生成响应报文并注册写事件
+void http_conn::complete(HTTP_CODE ret)
+{
     // 进行报文响应
-    bool write_ret = process_write(read_ret);
+    bool write_ret = process_write(ret);
+    m_t_handled = monotonic_ns();
     if (!write_ret)
     {
         close_conn();
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    modfd(m_epollfd, m_sockfd, EPOLLOUT | m_epoll_et);
 }
+
+// 显式实例化，事件循环和线程池按配置选用其中一组
+template void http_conn::init<LevelTriggered>(int, const sockaddr_in &, char *, int);
+template void http_conn::init<EdgeTriggered>(int, const sockaddr_in &, char *, int);
+template bool http_conn::read_once<LevelTriggered>();
+template bool http_conn::read_once<EdgeTriggered>();
+template bool http_conn::write<LevelTriggered>();
+template bool http_conn::write<EdgeTriggered>();
@@ -20,21 +20,55 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/user_cache.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
+#include "../trace/recorder.h"
+#include "../trace/probes.h"
+#include "../trace/profiler.h"
+#include "../trace/capture.h"
+#include "../crypto/scrypt.h"
+#include "../session/session.h"
+#include "../threadpool/hashpool.h"
+#include "../memory/arena.h"
+#include "io_policy.h"
 
-class http_conn
+// 连接上不在每个请求路径上都访问的数据，放在http_conn对象之外
+// 工作线程在这里写表单字段、会话id等，不会弄脏热数据所在的缓存行
+struct http_conn_cold
 {
+    static const int CGI_FIELD_LEN = 100;
+
+    sockaddr_in m_address;              // socket地址
+    char m_cgi_flag;                    // '2'为登录，'3'为注册
+    char m_cgi_name[CGI_FIELD_LEN];     // 表单中的用户名
+    char m_cgi_passwd[CGI_FIELD_LEN];   // 表单中的口令
+    char m_sid[SESSION_ID_LEN + 1];     // 登录成功后下发的会话id，为空表示不下发
+    string m_body;                      // 内存中生成的响应正文
+};
+
+// users[]是按fd索引的连续数组，主线程和工作线程同时访问相邻的对象
+// 对象按缓存行对齐，大小是缓存行的整数倍，相邻连接不会落在同一缓存行上
+class alignas(64) http_conn
+{
+    // 微基准测试直接调用解析和生成响应的私有函数，见bench/micro_bench.cpp
+    friend class http_conn_bench;
+
 public:
-    // 设置读取文件的名称m_real_file大小
+    // 设置读取文件的路径大小，路径在do_file中从请求内存池分配
     static const int FILENAME_LEN = 200;
     // 设置读缓冲区m_read_buf大小
     static const int READ_BUFFER_SIZE = 2048;
     // 设置写缓冲区m_write_buf大小
     static const int WRITE_BUFFER_SIZE = 1024;
+    // 设置登录注册表单字段m_cgi_name、m_cgi_passwd大小
+    static const int CGI_FIELD_LEN = http_conn_cold::CGI_FIELD_LEN;
     enum METHOD
     { // http请求方法
         GET = 0,
@@ -61,8 +95,11 @@ public:
         NO_RESOURCE,       // 请求资源不存在；跳转process_write完成响应报文
         FORBIDDEN_REQUEST, // 请求资源禁止访问，没有读取权限；跳转process_write完成响应报文
         FILE_REQUEST,      // 请求资源可以正常访问；跳转process_write完成响应报文
+        BUFFER_REQUEST,    // 响应正文已生成在m_body中，如/metrics；跳转process_write完成响应报文
         INTERNAL_ERROR,    // 服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
-        CLOSED_CONNECTION  // 客户端已经关闭连接
+        CLOSED_CONNECTION, // 客户端已经关闭连接
+        SERVICE_UNAVAILABLE, // 服务器过载拒绝处理；跳转process_write返回503
+        ASYNC_REQUEST      // 请求已交给其他线程处理，由该线程调用complete完成响应
     };
     enum LINE_STATUS
     {                // 从状态机
@@ -72,31 +109,55 @@ public:
     };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_cold(new http_conn_cold) {}
+    ~http_conn() { delete m_cold; }
 
 public:
     // 初始化套接字地址，函数内部会调用私有方法init
-    void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
+    // Trig为连接的触发模式(io_policy.h)，以下模板在http_conn.cpp中对两种触发模式显式实例化
+    template <typename Trig>
+    void init(int sockfd, const sockaddr_in &addr, char *, int);
     // 关闭http连接
     void close_conn(bool real_close = true);
     // 子线程通过process函数对任务进行处理，分别完成报文解析和报文响应两个任务
     void process();
     // 读取浏览器端发来的全部数据
+    template <typename Trig>
     bool read_once();
     // 响应报文写入函数
+    template <typename Trig>
     bool write();
     sockaddr_in *get_address()
     {
-        return &m_address;
+        return &m_cold->m_address;
     }
     // 同步线程初始化数据库读取表
     void initmysql_result(connection_pool *connPool);
-    int timer_flag;
-    int improv;
+    // 哈希线程调用，完成登录注册校验并生成响应
+    void process_hash();
+    // 采样线程调用，folded作为正文完成/profile的响应
+    static void profile_done(void *arg, const string &folded);
+    // 过载时由主线程调用：不解析请求，直接发送预先生成的503并读掉已到达的请求，调用方随后关闭连接
+    void shed();
+    // 生成过载时的完整503响应(带Retry-After和Connection:close)，启动时调用一次
+    static void render_overload(int retry_after);
+    static const char *overload_response() { return s_overload; }
+    // 退出排空阶段由主线程调用：没有请求在处理、接收缓冲区里也没有数据时可以直接关闭
+    bool idle();
+    // 主线程收到读事件时调用，请求跨多次读事件时记录第一次
+    void mark_ready()
+    {
+        if (!m_t_ready.load(std::memory_order_relaxed))
+            m_t_ready.store(monotonic_ns(), std::memory_order_relaxed);
+    }
+    // 主线程把读事件放入请求队列前调用，记录入队时间
+    void mark_queued() { m_t_queued = monotonic_ns(); }
 
 private:
     void init();
+    // read_once的实际读取，read_once在外面统计耗时
+    template <typename Trig>
+    bool read_socket();
     // 从m_read_buf读取，并处理请求报文
     HTTP_CODE process_read();
     // 向m_write_buf写入响应报文数据
@@ -109,6 +170,17 @@ private:
     HTTP_CODE parse_content(char *text);
     // 生成响应报文
     HTTP_CODE do_request();
+    // 登录和注册校验，conn为注册时写库使用的连接
+    void do_cgi(MYSQL *conn);
+    // 将明文存储的旧口令升级为哈希
+    void rehash_passwd(MYSQL *conn);
+    void update_passwd(MYSQL *conn, const char *hashed);
+    // CPU采样，只接受本机发来的请求
+    HTTP_CODE do_profile();
+    // 将请求的资源映射到文件
+    HTTP_CODE do_file();
+    // 生成响应报文并注册写事件
+    void complete(HTTP_CODE ret);
     // m_start_line是已经解析的字符
     // get_line用于将指针向后偏移，指向未处理的字符
     char *get_line() { return m_read_buf + m_start_line; };
@@ -123,61 +195,87 @@ private:
     bool add_content_type();
     bool add_content_length(int content_length);
     bool add_linger();
+    bool add_session_cookie();
+    // 请求中携带的会话cookie是否有效
+    bool session_valid();
     bool add_blank_line();
+    // 响应发送完毕，记录运行指标和访问日志
+    void request_done();
 
 public:
     static int m_epollfd;    // epoll句柄
-    static int m_user_count; // 用户数量
-    MYSQL *mysql;
+    static std::atomic<int> m_user_count; // 用户数量，init中加，连接的定时器回调cb_func中减；/metrics从其他线程读取
+    static hashpool<http_conn> *m_hashpool; // 口令哈希线程池
+    static char s_overload[256];            // 预先生成的503响应
+    static int s_overload_len;
+    static std::atomic<bool> m_draining;    // 正在退出，之后的响应都带Connection:close，发完即关闭
+
+    // reactor模式下工作线程置位、主线程循环等待的交接标志，单独占一个缓存行
+    // 工作线程先写timer_flag再以release写improv，主线程以acquire读到improv后即可看到timer_flag
+    // 工作线程处理请求时写的其他字段不在这一行，不会让主线程反复缺失
+    alignas(64) std::atomic<int> improv;
+    std::atomic<int> timer_flag;
+    // 请求交给哈希线程或采样线程前置位，主线程处理随后的写事件时清零
+    // 置位期间定时器到期只顺延不关闭：关闭后fd可能被新连接复用，异步线程完成时会操作到新连接
+    std::atomic<bool> m_async;
+
+    // 以下为热数据，每个请求都会访问，从新的缓存行开始
+    alignas(64) MYSQL *mysql;
     int m_state; // 读为0, 写为1
 
 private:
     // socket文件描述符
     int m_sockfd;
-    // socket地址
-    sockaddr_in m_address;
-    // 存储读取的请求报文数据
-    char m_read_buf[READ_BUFFER_SIZE];
+    unsigned int m_epoll_et; // EPOLLET或0，不在读写路径上的地方(process、complete)重新注册事件时附加
+    int m_close_log;
     // 缓冲区中m_read_buf中数据的最后一个字节的下一个位置
     int m_read_idx;
     // m_read_buf读取的位置m_checked_idx
     int m_checked_idx;
     // m_read_buf中已经解析的字符个数/当前正在解析的行的起始位置
     int m_start_line;
-    // 存储发出的响应报文数据
-    char m_write_buf[WRITE_BUFFER_SIZE];
     // 指示buffer中的长度
     int m_write_idx;
     // 主状态机的状态
     CHECK_STATE m_check_state;
     // 请求方法
     METHOD m_method;
-    // 以下为解析请求报文中对应的6个变量
-    // 存储读取文件的名称
-    char m_real_file[FILENAME_LEN]; // 文件
+    // 以下为解析请求报文中对应的变量
     char *m_url;                    // url
     char *m_version;                // http版本
     char *m_host;                   // 主机地址
     int m_content_length;           // 报文长度
     bool m_linger;                  // 是否保持连接
+    bool m_authed;                  // 是否已登录
+    char *m_cookie;                 // Cookie头部
+    int cgi;                        // 是否启用的POST，如果检测到请求体则为1
+    char *m_string;                 // 存储请求头数据
 
-    char *m_file_address; // 读取服务器上的文件地址
-    struct stat m_file_stat;
-    struct iovec m_iv[2]; // io向量机制iovec
+    char *m_file_address;       // 读取服务器上的文件地址
+    const char *m_body_address; // 正文地址，指向m_file_address或m_cold->m_body
+    struct iovec m_iv[2];       // io向量机制iovec
     int m_iv_count;
-    int cgi;             // 是否启用的POST，如果检测到请求体则为1
-    char *m_string;      // 存储请求头数据
     int bytes_to_send;   // 剩余发送字节数
     int bytes_have_send; // 已发送字节数
+    int m_status;
     char *doc_root;
+    http_conn_cold *m_cold; // 冷数据，构造时分配
 
-    map<string, string> m_users;
-    int m_TRIGMode;
-    int m_close_log;
+    // 运行指标和访问日志用到的各阶段时间点(单调时间ns)和状态码
+    uint64_t m_t_accept;   // 建立连接，只用于连接上的第一个请求
+    std::atomic<uint64_t> m_t_ready; // 读事件就绪；排空时主线程读取，工作线程在init中清零
+    uint64_t m_read_ns;    // read_once累计耗时
+    uint64_t m_t_queued;   // 放入线程池队列
+    uint64_t m_t_dequeued; // 工作线程开始处理
+    uint64_t m_t_parsed;   // 请求解析完成
+    uint64_t m_t_handled;  // 响应生成完成
 
-    char sql_user[100];
-    char sql_passwd[100];
-    char sql_name[100];
+    struct stat m_file_stat;
+
+    // 存储读取的请求报文数据
+    char m_read_buf[READ_BUFFER_SIZE];
+    // 存储发出的响应报文数据
+    char m_write_buf[WRITE_BUFFER_SIZE];
 };
 
 #endif
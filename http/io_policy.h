@@ -0,0 +1,31 @@
+#ifndef IO_POLICY_H
+#define IO_POLICY_H
+
+#include <sys/epoll.h>
+
+// 并发模型和触发模式的编译期策略
+// 启动时按配置选定一组实例化(见WebServer::eventLoop)，事件循环、线程池和连接读写中不再逐次判断
+
+// 触发模式：epoll_flag为注册事件时附加的标志，mode决定读数据时是否循环读到EAGAIN
+struct LevelTriggered
+{
+    static const int mode = 0;
+    static const unsigned int epoll_flag = 0;
+};
+struct EdgeTriggered
+{
+    static const int mode = 1;
+    static const unsigned int epoll_flag = EPOLLET;
+};
+
+// 并发模型：proactor由主线程读写，工作线程只处理请求；reactor由工作线程读写
+struct ProactorPolicy
+{
+    static const int model = 0;
+};
+struct ReactorPolicy
+{
+    static const int model = 1;
+};
+
+#endif
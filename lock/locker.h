@@ -2,8 +2,10 @@
 #define LOCKER_H
 
 #include <exception>
+#include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 // 封装信号量
 class sem
@@ -30,10 +32,29 @@ public:
     {
         sem_destroy(&m_sem);
     }
-    // 等待信号量
+    // 等待信号量，被信号打断时继续等待
     bool wait()
     {
-        return sem_wait(&m_sem) == 0;
+        while (sem_wait(&m_sem) != 0)
+        {
+            if (errno != EINTR)
+                return false;
+        }
+        return true;
+    }
+    // 带超时的等待，超时返回false
+    bool timewait(int ms)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms / 1000;
+        t.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (t.tv_nsec >= 1000000000)
+        {
+            t.tv_sec += 1;
+            t.tv_nsec -= 1000000000;
+        }
+        return sem_timedwait(&m_sem, &t) == 0;
     }
     // 增加信号量
     bool post()
@@ -81,6 +102,39 @@ public:
 private:
     pthread_mutex_t m_mutex;
 };
+// 封装读写锁
+class rwlocker
+{
+public:
+    rwlocker()
+    {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0)
+        {
+            throw std::exception();
+        }
+    }
+    ~rwlocker()
+    {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+    // 获取读锁，多个读者可以同时持有
+    bool rdlock()
+    {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+    // 获取写锁，与其他读者和写者互斥
+    bool wrlock()
+    {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+    bool unlock()
+    {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
 // 封装条件变量
 class cond
 {
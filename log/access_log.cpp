@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "access_log.h"
+#include "../timer/clock.h"
+
+using namespace std;
+
+// 没有被唤醒时后台线程多久处理一次队列
+static const int DRAIN_INTERVAL_MS = 10;
+// 多久msync一次已写入的部分
+static const uint64_t SYNC_INTERVAL_NS = 1000000000ull;
+// 单条记录格式化后的最大长度
+static const int MAX_LINE = 1024;
+
+static thread_local access_ring *t_ring = NULL;
+
+access_log::access_log()
+{
+    m_format = ACCESS_OFF;
+    m_dir[0] = '\0';
+    m_name[0] = '\0';
+    m_segment_size = 0;
+    m_rings = NULL;
+    m_running = false;
+    m_stop = false;
+    m_fd = -1;
+    m_map = NULL;
+    m_used = 0;
+    m_synced = 0;
+    m_today = 0;
+    m_seq = 0;
+    m_real_base = 0;
+    m_mono_base = 0;
+    m_last_sec = 0;
+    m_now_sec = 0;
+}
+
+access_log::~access_log()
+{
+    if (m_running)
+    {
+        m_stop = true;
+        m_wake.post();
+        pthread_join(m_tid, NULL);
+    }
+}
+
+bool access_log::init(const char *file_name, int format, int segment_mb)
+{
+    if (format != ACCESS_CLF && format != ACCESS_JSON)
+        return false;
+    const char *p = strrchr(file_name, '/');
+    if (p == NULL)
+    {
+        m_dir[0] = '\0';
+        snprintf(m_name, sizeof(m_name), "%s", file_name);
+    }
+    else
+    {
+        snprintf(m_name, sizeof(m_name), "%s", p + 1);
+        snprintf(m_dir, sizeof(m_dir), "%.*s", (int)(p - file_name + 1), file_name);
+    }
+    m_segment_size = (size_t)(segment_mb > 0 ? segment_mb : 64) * 1024 * 1024;
+
+    m_real_base = realtime_ns();
+    m_mono_base = monotonic_ns();
+    m_now_sec = m_real_base / 1000000000ull;
+    localtime_r(&m_now_sec, &m_now);
+    if (!open_segment(m_now))
+        return false;
+
+    if (pthread_create(&m_tid, NULL, writer_thread, NULL) != 0)
+    {
+        close_segment();
+        return false;
+    }
+    m_running = true;
+    // 最后打开开关，业务线程看到enabled时后台线程已经就绪
+    m_format = format;
+    return true;
+}
+
+access_ring *access_log::thread_ring()
+{
+    if (t_ring)
+        return t_ring;
+    access_ring *r = new access_ring;
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+    r->dropped.store(0, std::memory_order_relaxed);
+    m_rings_mutex.lock();
+    r->next = m_rings;
+    m_rings = r;
+    m_rings_mutex.unlock();
+    t_ring = r;
+    return r;
+}
+
+void access_log::append(const access_record &rec)
+{
+    access_ring *r = thread_ring();
+    uint32_t h = r->head.load(std::memory_order_relaxed);
+    uint32_t t = r->tail.load(std::memory_order_acquire);
+    if (h - t >= (uint32_t)ACCESS_RING_SIZE)
+    {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    r->slots[h & (ACCESS_RING_SIZE - 1)] = rec;
+    r->head.store(h + 1, std::memory_order_release);
+    // 队列过半时提前唤醒后台线程
+    if (h - t == ACCESS_RING_SIZE / 2)
+        m_wake.post();
+}
+
+uint64_t access_log::dropped()
+{
+    uint64_t n = 0;
+    m_rings_mutex.lock();
+    for (access_ring *r = m_rings; r; r = r->next)
+        n += r->dropped.load(std::memory_order_relaxed);
+    m_rings_mutex.unlock();
+    return n;
+}
+
+void access_log::run()
+{
+    uint64_t last_sync = monotonic_ns();
+    while (!m_stop)
+    {
+        m_wake.timewait(DRAIN_INTERVAL_MS);
+        drain();
+        // 批量msync，MS_ASYNC只是提交回写，不等待磁盘
+        uint64_t now = monotonic_ns();
+        if (m_map && m_used > m_synced && now - last_sync >= SYNC_INTERVAL_NS)
+        {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t from = m_synced / page * page;
+            msync(m_map + from, m_used - from, MS_ASYNC);
+            m_synced = m_used;
+            last_sync = now;
+        }
+    }
+    drain();
+    close_segment();
+}
+
+int access_log::drain()
+{
+    // 两个时钟的差会被校时改变，每批重新取一次基准
+    m_real_base = realtime_ns();
+    m_mono_base = monotonic_ns();
+    time_t sec = m_real_base / 1000000000ull;
+    if (sec != m_now_sec)
+    {
+        localtime_r(&sec, &m_now);
+        m_now_sec = sec;
+    }
+
+    m_rings_mutex.lock();
+    access_ring *head = m_rings;
+    m_rings_mutex.unlock();
+
+    int count = 0;
+    for (access_ring *r = head; r; r = r->next)
+    {
+        uint32_t t = r->tail.load(std::memory_order_relaxed);
+        uint32_t h = r->head.load(std::memory_order_acquire);
+        bool failed = false;
+        for (; t != h; ++t)
+        {
+            const access_record &rec = r->slots[t & (ACCESS_RING_SIZE - 1)];
+            if (!reserve(MAX_LINE))
+            {
+                failed = true;
+                break;
+            }
+            m_used += format_record(rec, m_map + m_used, MAX_LINE);
+            ++count;
+        }
+        // 打开或扩展文件失败时剩下的记录留在队列中，下一轮再试，队列满后由append计入丢弃；
+        // 退出前的最后一轮不会再试，直接计入丢弃
+        if (failed && m_stop)
+        {
+            r->dropped.fetch_add(h - t, std::memory_order_relaxed);
+            t = h;
+        }
+        // 处理完才归还槽位
+        r->tail.store(t, std::memory_order_release);
+        if (failed && !m_stop)
+            break;
+    }
+    return count;
+}
+
+// 路径来自客户端，双引号、反斜杠和不可见字符转义成\xHH，JSON格式用\u00HH
+static int escape_path(const char *in, char *out, int json)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char *o = out;
+    for (const unsigned char *p = (const unsigned char *)in; *p; ++p)
+    {
+        if (*p == '"' || *p == '\\' || *p < 0x20 || *p >= 0x7f)
+        {
+            if (json)
+            {
+                memcpy(o, "\\u00", 4);
+                o += 4;
+            }
+            else
+            {
+                memcpy(o, "\\x", 2);
+                o += 2;
+            }
+            *o++ = hex[*p >> 4];
+            *o++ = hex[*p & 15];
+        }
+        else
+            *o++ = *p;
+    }
+    *o = '\0';
+    return o - out;
+}
+
+int access_log::format_record(const access_record &rec, char *buf, int len)
+{
+    uint64_t ns = m_real_base + (rec.done_ns - m_mono_base);
+    time_t sec = ns / 1000000000ull;
+    if (sec != m_last_sec)
+    {
+        struct tm my_tm;
+        localtime_r(&sec, &my_tm);
+        strftime(m_clf_time, sizeof(m_clf_time), "%d/%b/%Y:%H:%M:%S %z", &my_tm);
+        strftime(m_iso_time, sizeof(m_iso_time), "%Y-%m-%dT%H:%M:%S", &my_tm);
+        strftime(m_iso_zone, sizeof(m_iso_zone), "%z", &my_tm);
+        m_last_sec = sec;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    struct in_addr a;
+    a.s_addr = rec.addr;
+    inet_ntop(AF_INET, &a, ip, sizeof(ip));
+    char path[ACCESS_PATH_LEN * 6];
+    escape_path(rec.path, path, m_format == ACCESS_JSON);
+
+    int n;
+    if (m_format == ACCESS_JSON)
+        n = snprintf(buf, len,
+                     "{\"time\":\"%s.%03d%s\",\"client\":\"%s\",\"port\":%u,\"method\":\"%s\",\"path\":\"%s\","
+                     "\"status\":%u,\"bytes\":%u,\"queue_us\":%u,\"parse_us\":%u,\"handler_us\":%u,\"send_us\":%u}\n",
+                     m_iso_time, (int)(ns / 1000000 % 1000), m_iso_zone, ip, ntohs(rec.port), rec.method, path,
+                     rec.status, rec.bytes, rec.queue_us, rec.parse_us, rec.handler_us, rec.send_us);
+    else
+        n = snprintf(buf, len, "%s - - [%s] \"%s %s HTTP/1.1\" %u %u queue=%uus parse=%uus handler=%uus send=%uus\n",
+                     ip, m_clf_time, rec.method, path, rec.status, rec.bytes,
+                     rec.queue_us, rec.parse_us, rec.handler_us, rec.send_us);
+    if (n >= len)
+    {
+        // 截断时也保证以换行结尾
+        n = len - 1;
+        buf[n - 1] = '\n';
+    }
+    return n;
+}
+
+bool access_log::reserve(int need)
+{
+    if (m_map && m_now.tm_mday == m_today && m_used + need <= m_segment_size)
+        return true;
+    // 段写满换下一段，日期变化从第0段开始
+    if (m_map && m_now.tm_mday == m_today)
+        ++m_seq;
+    else
+        m_seq = 0;
+    close_segment();
+    return open_segment(m_now);
+}
+
+bool access_log::open_segment(const struct tm &my_tm)
+{
+    if (m_today != my_tm.tm_mday)
+    {
+        m_today = my_tm.tm_mday;
+        m_seq = 0;
+    }
+    char name[512];
+    while (true)
+    {
+        if (m_seq == 0)
+            snprintf(name, sizeof(name), "%s%d_%02d_%02d_%s", m_dir,
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, m_name);
+        else
+            snprintf(name, sizeof(name), "%s%d_%02d_%02d_%s.%d", m_dir,
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, m_name, m_seq);
+        m_fd = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(m_fd, &st) != 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        // 已经写满的旧段直接跳过，比段大小还大的文件(改过配置)也不去动它
+        bool full = (size_t)st.st_size > m_segment_size;
+        if (!full && (size_t)st.st_size + MAX_LINE > m_segment_size)
+        {
+            char last = 0;
+            full = pread(m_fd, &last, 1, st.st_size - 1) == 1 && last != '\0';
+        }
+        if (full)
+        {
+            close(m_fd);
+            m_fd = -1;
+            ++m_seq;
+            continue;
+        }
+        // 预分配整段空间，写入时不会再因为扩展文件而阻塞
+        if (posix_fallocate(m_fd, 0, m_segment_size) != 0 && ftruncate(m_fd, m_segment_size) != 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        m_map = (char *)mmap(NULL, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (m_map == MAP_FAILED)
+        {
+            m_map = NULL;
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        // 续写已有的文件，跳过上次异常退出留下的预分配空白
+        m_used = (size_t)st.st_size < m_segment_size ? st.st_size : m_segment_size;
+        while (m_used > 0 && m_map[m_used - 1] == '\0')
+            --m_used;
+        if (m_used + MAX_LINE > m_segment_size)
+        {
+            close_segment();
+            ++m_seq;
+            continue;
+        }
+        m_synced = m_used;
+        return true;
+    }
+}
+
+void access_log::close_segment()
+{
+    if (m_map)
+    {
+        msync(m_map, m_used, MS_SYNC);
+        munmap(m_map, m_segment_size);
+        m_map = NULL;
+    }
+    if (m_fd >= 0)
+    {
+        // 截掉没用到的预分配空间
+        if (ftruncate(m_fd, m_used) != 0)
+            perror("access log ftruncate");
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_used = 0;
+    m_synced = 0;
+}
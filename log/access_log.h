@@ -0,0 +1,118 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <netinet/in.h>
+#include "../lock/locker.h"
+
+// 访问日志格式
+enum ACCESS_FORMAT
+{
+    ACCESS_OFF = 0,
+    ACCESS_CLF,  // Common Log Format，行尾追加各阶段耗时
+    ACCESS_JSON  // 每行一个JSON对象
+};
+
+const int ACCESS_PATH_LEN = 192;
+// 每个线程的环形队列长度，必须是2的幂
+const int ACCESS_RING_SIZE = 1024;
+
+// 一次请求的访问记录，业务线程只拷贝定长字段，格式化由后台线程完成
+struct access_record
+{
+    uint64_t done_ns;        // 完成时的单调时间
+    uint32_t addr;           // 客户端地址，网络字节序
+    uint16_t port;           // 客户端端口，网络字节序
+    uint16_t status;         // 响应状态码
+    uint32_t bytes;          // 发送字节数
+    uint32_t queue_us;       // 在线程池队列中等待
+    uint32_t parse_us;       // 解析请求
+    uint32_t handler_us;     // 生成响应，包括等待口令哈希
+    uint32_t send_us;        // 发送响应
+    const char *method;      // 指向静态字符串
+    char path[ACCESS_PATH_LEN];
+};
+
+// 单生产者单消费者的无锁环形队列，每个线程一个
+// head只由所属线程写，tail只由后台线程写，分开放在不同缓存行上
+struct access_ring
+{
+    access_record slots[ACCESS_RING_SIZE];
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    std::atomic<uint64_t> dropped; // 队列满时丢弃的条数
+    access_ring *next;
+};
+
+// 访问日志
+// 每个请求完成后写一条记录到线程自己的环形队列，后台线程批量格式化后
+// 拷贝进mmap映射的预分配文件段，并定期msync
+class access_log
+{
+public:
+    static access_log *get_instance()
+    {
+        static access_log instance;
+        return &instance;
+    }
+    static void *writer_thread(void *)
+    {
+        access_log::get_instance()->run();
+        return NULL;
+    }
+
+    // file_name同Log::init的规则，按天命名；segment_mb为每个文件预分配的大小
+    bool init(const char *file_name, int format, int segment_mb = 64);
+    bool enabled() const { return m_format != ACCESS_OFF; }
+    // 业务线程调用，不加锁、不阻塞，队列满时丢弃并计数
+    void append(const access_record &rec);
+    // 因队列满被丢弃的总条数
+    uint64_t dropped();
+
+private:
+    access_log();
+    ~access_log();
+    void run();
+    // 把所有线程队列中的记录格式化写入文件，返回处理的条数
+    int drain();
+    access_ring *thread_ring();
+    int format_record(const access_record &rec, char *buf, int len);
+    bool open_segment(const struct tm &my_tm);
+    void close_segment();
+    // 确保当前段至少还有need字节空间
+    bool reserve(int need);
+
+private:
+    int m_format;
+    char m_dir[128];
+    char m_name[128];
+    size_t m_segment_size;
+
+    access_ring *m_rings;          // 所有线程的队列
+    locker m_rings_mutex;          // 只在登记新线程时使用
+    sem m_wake;                    // 队列过半时唤醒后台线程
+    pthread_t m_tid;
+    bool m_running;
+    volatile bool m_stop;
+
+    // 以下只由后台线程访问
+    int m_fd;
+    char *m_map;                   // 当前段的映射地址
+    size_t m_used;                 // 已写入的字节数
+    size_t m_synced;               // 已msync的位置
+    int m_today;
+    int m_seq;                     // 当天第几段
+    uint64_t m_real_base;          // 单调时间换算墙上时间用的基准
+    uint64_t m_mono_base;
+    time_t m_now_sec;              // 本批处理的当前时间，用于判断换天
+    struct tm m_now;
+    time_t m_last_sec;             // 时间字符串按秒缓存
+    char m_clf_time[32];
+    char m_iso_time[32];
+    char m_iso_zone[8];
+};
+
+#endif
@@ -1,182 +1,1022 @@
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include <algorithm>
 #include "log.h"
 #include <pthread.h>
 using namespace std;
 
+// 一次writev最多携带的缓冲区数
+static const int MAX_IOV = 64;
+// 行数或大小达到上限的90%、离午夜不到ROTATE_AHEAD_SEC秒时，后台线程预先打开下一个文件
+static const int ROTATE_AHEAD_SEC = 60;
+
+// 线程退出时把缓冲区标记为可复用，剩余内容仍由后台线程写出
+struct thread_buffer_holder
+{
+    thread_log_buffer *tb;
+    thread_buffer_holder() : tb(NULL) {}
+    ~thread_buffer_holder()
+    {
+        if (tb)
+        {
+            tb->mutex.lock();
+            tb->orphan = true;
+            tb->mutex.unlock();
+        }
+    }
+};
+static thread_local thread_buffer_holder t_holder;
+
 Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_fp = NULL;
+    m_buffers = NULL;
+    m_stop = false;
+    m_thread_running = false;
+    m_level = 0;
+    m_binary = false;
+    m_sites_written = 0;
+    m_thread_buf_size = 0;
+    m_flush_interval_ms = 1000;
+    m_flush_bytes = 64 * 1024;
+    m_unflushed = 0;
+    m_segment = 0;
+    m_file_size = 0;
+    m_max_size = 0;
+    m_keep_files = 0;
+    m_compress = false;
+    m_compress_running = false;
+    m_split_fp = NULL;
+    m_day_fp = NULL;
+    m_day_mday = 0;
+    dir_name[0] = '\0';
+    log_name[0] = '\0';
+    m_cur_name[0] = '\0';
+    m_limiting = false;
+    for (int i = 0; i < 4; ++i)
+        m_sample_every[i] = 1;
+    m_rate_interval = 0;
+    m_rate_tolerance = 0;
+    m_last_report = 0;
 }
 
 Log::~Log()
 {
+    // 后台线程退出前会把剩余日志全部写出
+    if (m_thread_running)
+    {
+        m_stop = true;
+        m_wake.post();
+        pthread_join(m_tid, NULL);
+    }
+    if (m_compress_running)
+    {
+        m_compress_mutex.lock();
+        m_compress_queue.push_back(string());
+        m_compress_mutex.unlock();
+        m_compress_sem.post();
+        pthread_join(m_compress_tid, NULL);
+        m_compress_running = false;
+    }
+    close_retired();
+    // 预先打开但没用上的文件是空的，删掉
+    if (m_split_fp != NULL)
+    {
+        fclose(m_split_fp);
+        unlink(m_split_name);
+    }
+    if (m_day_fp != NULL)
+    {
+        fclose(m_day_fp);
+        unlink(m_day_name);
+    }
     if (m_fp != NULL)
     {
         fclose(m_fp);
     }
 }
-// 异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
+// 崩溃时尽力把还在内存里的日志写出，然后按默认行为重新触发信号
+static volatile sig_atomic_t g_crashing = 0;
+static void crash_handler(int sig)
 {
-    // 如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
+    if (!g_crashing)
     {
-        // 设置写入方式flag
-        m_is_async = true;
-        // 创建并设置阻塞队列长度
-        m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
-        // flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        g_crashing = 1;
+        Log::get_instance()->flush_on_crash();
     }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void install_crash_handlers()
+{
+    static const int sigs[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); ++i)
+        sigaction(sigs[i], &sa, NULL);
+}
+
+FILE *Log::open_file(const char *name)
+{
+    FILE *fp = fopen(name, "a");
+    // stdio默认缓冲区只有几KB，调大到刷盘阈值，否则达不到按大小刷盘的效果
+    if (fp != NULL)
+        setvbuf(fp, NULL, _IOFBF, m_flush_bytes);
+    return fp;
+}
 
+// 异步需要设置每个线程缓冲区的大小，同步不需要设置
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int thread_buf_size,
+               int flush_interval_ms, int flush_kb, bool binary)
+{
     // 输出内容的长度
     m_close_log = close_log;
     m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
     // 日志的最大行数
     m_split_lines = split_lines;
+    // 同步模式下线程缓冲区只用来格式化一行日志
+    // 异步模式下缓冲区至少能放下两行，保证写满交换后总能写入当前行
+    m_thread_buf_size = thread_buf_size;
+    if (m_thread_buf_size < 2 * m_log_buf_size)
+        m_thread_buf_size = 2 * m_log_buf_size;
+    m_flush_interval_ms = flush_interval_ms > 0 ? flush_interval_ms : 1000;
+    m_flush_bytes = (flush_kb > 0 ? flush_kb : 64) * 1024;
+    // 二进制记录只能写在线程缓冲区里，强制使用异步
+    m_binary = binary;
+    if (m_binary && thread_buf_size < 1)
+        thread_buf_size = 64 * 1024;
 
     time_t t = time(NULL);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
     // 从后往前找到第一个/的位置
     const char *p = strrchr(file_name, '/');
-    char log_full_name[256] = {0};
+
+    // 目录或文件名放不下时直接失败，截断后的名字在轮转时可能和其他日志重名
+    const char *base = p ? p + 1 : file_name;
+    if (strlen(base) >= sizeof(log_name) || (p && p - file_name + 1 >= (int)sizeof(dir_name)))
+        return false;
 
     // 相当于自定义日志名
     // 若输入的文件名没有/，则直接将时间+文件名作为日志名
     if (p == NULL)
     {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        dir_name[0] = '\0';
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
     }
     else
     {
         // 将/的位置向后移动一个位置，然后复制到logname中
         // p - file_name + 1是文件所在路径文件夹的长度
         // dirname相当于./
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
-        // 后面的参数跟format有关
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+        snprintf(log_name, sizeof(log_name), "%s", p + 1);
+        snprintf(dir_name, sizeof(dir_name), "%.*s", (int)(p - file_name + 1), file_name);
     }
 
     m_today = my_tm.tm_mday;
+    m_segment = 0;
+    make_name(m_cur_name, my_tm, 0);
 
-    m_fp = fopen(log_full_name, "a");
+    m_fp = open_file(m_cur_name);
     if (m_fp == NULL)
     {
         return false;
     }
+    struct stat st;
+    if (fstat(fileno(m_fp), &st) == 0)
+        m_file_size = st.st_size;
+    if (m_binary)
+        write_binary_header();
 
+    // 如果设置了thread_buf_size,则设置为异步
+    if (thread_buf_size >= 1)
+    {
+        // 设置写入方式flag
+        m_is_async = true;
+    }
+    // flush_log_thread为回调函数,异步模式下负责写日志，同步模式下负责定时刷盘
+    if (pthread_create(&m_tid, NULL, flush_log_thread, NULL) == 0)
+        m_thread_running = true;
+    else
+        m_is_async = false;
+
+    install_crash_handlers();
     return true;
 }
 
-// 将系统信息格式化后输出，具体为：格式化时间 + 格式化内容
-void Log::write_log(int level, const char *format, ...)
+thread_log_buffer *Log::thread_buffer()
 {
+    if (t_holder.tb)
+        return t_holder.tb;
+
+    thread_log_buffer *tb = NULL;
+    m_buffers_mutex.lock();
+    // 优先复用已退出线程留下的缓冲区
+    for (thread_log_buffer *p = m_buffers; p && !tb; p = p->next)
+    {
+        p->mutex.lock();
+        if (p->orphan)
+        {
+            p->orphan = false;
+            tb = p;
+        }
+        p->mutex.unlock();
+    }
+    if (!tb)
+    {
+        tb = new thread_log_buffer;
+        tb->cur = new char[m_thread_buf_size];
+        tb->cur_len = 0;
+        tb->spare = new char[m_thread_buf_size];
+        tb->full = NULL;
+        tb->full_len = 0;
+        tb->waits = 0;
+        tb->orphan = false;
+        tb->last_sec = 0;
+        // 初始化完成后再挂到表头，后台线程遍历时看到的节点都是完整的
+        tb->next = m_buffers;
+        m_buffers = tb;
+    }
+    m_buffers_mutex.unlock();
+    t_holder.tb = tb;
+    return tb;
+}
+
+int Log::format_prefix(thread_log_buffer *tb, char *buf, int level)
+{
+    static const char *tags[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
-    // 日志分级
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
-    }
-    // 写入一个log，对m_count++, m_split_lines最大行数
-    m_mutex.lock();
-    // 更新现有行数
-    m_count++;
+    // 同一秒内复用上次的结果
+    if (now.tv_sec != tb->last_sec)
+    {
+        time_t t = now.tv_sec;
+        localtime_r(&t, &tb->last_tm);
+        tb->last_sec = now.tv_sec;
+    }
+    const struct tm &my_tm = tb->last_tm;
+    const char *s = (level >= 0 && level <= 3) ? tags[level] : tags[1];
+    // 写入内容格式：时间 + 内容
+    // 时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
+    return snprintf(buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+                    my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                    my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, (long)now.tv_usec, s);
+}
 
-    // 日志不是今天或写入的日志行数是最大行的倍数
-    // m_split_lines为最大行数
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) // everyday log
+// 将系统信息格式化后输出，具体为：格式化时间 + 格式化内容
+void Log::write_log(int level, const char *format, ...)
+{
+    thread_log_buffer *tb = thread_buffer();
+    va_list valst;
+    // 将传入的format参数赋值给valst，便于格式化输出
+    va_start(valst, format);
+
+    if (!m_is_async)
     {
+        // 同步模式在线程自己的缓冲区里格式化，只有写文件时加锁
+        char *buf = tb->cur;
+        int n = format_prefix(tb, buf, level);
+        int avail = m_log_buf_size - n - 2;
+        int m = vsnprintf(buf + n, avail + 1, format, valst);
+        if (m > avail)
+            m = avail;
+        buf[n + m] = '\n';
+        buf[n + m + 1] = '\0';
 
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-        // 格式化日志名中的时间部分
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-        // 如果是时间不是今天,则创建今天的日志，更新m_today和m_count
-        if (m_today != my_tm.tm_mday)
+        m_mutex.lock();
+        // 更新现有行数
+        m_count++;
+        // 日志不是今天、写入的日志行数是最大行的倍数或文件超过大小上限
+        // 新文件已由后台线程提前打开，这里只交换文件指针
+        if (m_today != tb->last_tm.tm_mday || m_count % m_split_lines == 0 ||
+            (m_max_size > 0 && m_file_size >= m_max_size)) // everyday log
+            rotate(tb->last_tm);
+        fwrite(buf, 1, n + m + 1, m_fp);
+        m_file_size += n + m + 1;
+        m_unflushed += n + m + 1;
+        // ERROR立即刷盘，其余累积到阈值再刷，剩下的交给后台线程定时刷
+        if (level == 3 || m_unflushed >= m_flush_bytes)
+        {
+            fflush(m_fp);
+            m_unflushed = 0;
+        }
+        m_mutex.unlock();
+        va_end(valst);
+        return;
+    }
+
+    // 异步模式直接格式化到线程自己的缓冲区，不拷贝、不申请内存
+    char *buf = begin_record(tb);
+    int n = format_prefix(tb, buf, level);
+    int avail = m_log_buf_size - n - 2;
+    int m = vsnprintf(buf + n, avail + 1, format, valst);
+    if (m > avail)
+        m = avail;
+    buf[n + m] = '\n';
+    end_record(tb, n + m + 1, level);
+    va_end(valst);
+}
+
+char *Log::begin_record(thread_log_buffer *&tb)
+{
+    tb = thread_buffer();
+    tb->mutex.lock();
+    if (m_thread_buf_size - tb->cur_len < m_log_buf_size)
+    {
+        // 备用缓冲区还在后台线程手里，说明落盘跟不上，等它写完再继续，日志不丢行
+        while (tb->full || !tb->spare)
+        {
+            tb->waits++;
+            tb->mutex.unlock();
+            m_wake.post();
+            // 限时等待，错过唤醒时最多多等1ms
+            struct timespec t;
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_nsec += 1000000;
+            if (t.tv_nsec >= 1000000000)
+            {
+                t.tv_sec += 1;
+                t.tv_nsec -= 1000000000;
+            }
+            m_spare_mutex.lock();
+            m_spare_cond.timewait(m_spare_mutex.get(), t);
+            m_spare_mutex.unlock();
+            tb->mutex.lock();
+        }
+        // 当前缓冲区写满，换上备用缓冲区并通知后台线程
+        tb->full = tb->cur;
+        tb->full_len = tb->cur_len;
+        tb->cur = tb->spare;
+        tb->cur_len = 0;
+        tb->spare = NULL;
+        m_wake.post();
+    }
+    return tb->cur + tb->cur_len;
+}
+
+void Log::end_record(thread_log_buffer *tb, int len, int level)
+{
+    tb->cur_len += len;
+    // 刚好越过刷盘阈值时提前唤醒后台线程，ERROR每条都唤醒
+    bool wake = level == 3 || (tb->cur_len >= m_flush_bytes && tb->cur_len - len < m_flush_bytes);
+    tb->mutex.unlock();
+
+    if (wake)
+        m_wake.post();
+}
+
+void Log::encode_arg(char *&p, char *end, const char *v)
+{
+    if (v == NULL)
+        v = "(null)";
+    if (end - p < 3)
+        return;
+    size_t len = strnlen(v, end - p - 3);
+    uint16_t n = len;
+    *p++ = LOG_ARG_STR;
+    memcpy(p, &n, 2);
+    memcpy(p + 2, v, len);
+    p += 2 + len;
+}
+
+uint32_t Log::register_site(log_site *site)
+{
+    m_sites_mutex.lock();
+    uint32_t id = m_sites.size();
+    m_sites.push_back(site);
+    m_sites_mutex.unlock();
+    return id;
+}
+
+// 写满整个缓冲区，被信号打断时继续
+static void write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+void Log::write_binary_header()
+{
+    char head[LOG_BIN_HEADER_LEN];
+    uint64_t real = realtime_ns();
+    uint64_t mono = monotonic_ns();
+    memcpy(head, LOG_BIN_MAGIC, 8);
+    memcpy(head + 8, &real, 8);
+    memcpy(head + 16, &mono, 8);
+    write_all(fileno(m_fp), head, sizeof(head));
+    m_sites_written = 0;
+    write_site_defs(fileno(m_fp), 0, true);
+}
+
+void Log::write_site_defs(int fd, size_t from, bool lock)
+{
+    // 不申请内存，崩溃处理函数中以lock为false调用
+    char buf[LOG_BIN_DEF_HEAD + 65535];
+    if (lock)
+        m_sites_mutex.lock();
+    size_t count = m_sites.size();
+    for (size_t i = from; i < count; ++i)
+    {
+        const log_site *site = m_sites[i];
+        size_t len = strnlen(site->format, 65535);
+        uint16_t n = len;
+        buf[0] = LOG_REC_DEF;
+        memcpy(buf + 1, &site->id, 4);
+        buf[5] = (char)site->level;
+        memcpy(buf + 6, &n, 2);
+        memcpy(buf + LOG_BIN_DEF_HEAD, site->format, len);
+        write_all(fd, buf, LOG_BIN_DEF_HEAD + len);
+    }
+    if (lock)
+        m_sites_mutex.unlock();
+    m_sites_written = count;
+}
+
+void Log::make_name(char *out, const struct tm &my_tm, int segment)
+{
+    // 格式化日志名中的时间部分，当天第一个文件不带后缀，之后依次为.1 .2 ...
+    if (segment == 0)
+        snprintf(out, LOG_NAME_LEN, "%s%d_%02d_%02d_%s", dir_name,
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+    else
+        snprintf(out, LOG_NAME_LEN, "%s%d_%02d_%02d_%s.%d", dir_name,
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name, segment);
+}
+
+void Log::retire(FILE *fp, const char *name, bool remove)
+{
+    retired_file r;
+    r.fp = fp;
+    r.remove = remove;
+    snprintf(r.name, LOG_NAME_LEN, "%s", name);
+    m_retired.push_back(r);
+}
+
+void Log::rotate(const struct tm &my_tm)
+{
+    char new_log[LOG_NAME_LEN];
+    FILE *next = NULL;
+    // 如果是时间不是今天,则创建今天的日志，更新m_today和m_count
+    if (m_today != my_tm.tm_mday)
+    {
+        if (m_day_fp != NULL && m_day_mday == my_tm.tm_mday)
+        {
+            next = m_day_fp;
+            snprintf(new_log, LOG_NAME_LEN, "%s", m_day_name);
+            m_day_fp = NULL;
+        }
+        else
+        {
+            // 后台线程没来得及准备(例如系统时间被调整)，只能在这里打开
+            make_name(new_log, my_tm, 0);
+            next = open_file(new_log);
+        }
+        if (next == NULL)
+            return;
+        // 为昨天准备的下一段和日期不对的预开文件都用不上了
+        if (m_split_fp != NULL)
+        {
+            retire(m_split_fp, m_split_name, true);
+            m_split_fp = NULL;
+        }
+        if (m_day_fp != NULL)
+        {
+            retire(m_day_fp, m_day_name, true);
+            m_day_fp = NULL;
+        }
+        m_today = my_tm.tm_mday;
+        m_count = 0;
+        m_segment = 0;
+    }
+    else
+    {
+        // 超过了最大行或大小上限，在之前的日志名基础上加后缀
+        if (m_split_fp != NULL)
         {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
+            next = m_split_fp;
+            snprintf(new_log, LOG_NAME_LEN, "%s", m_split_name);
+            m_split_fp = NULL;
         }
         else
         {
-            // 超过了最大行，在之前的日志名基础上加后缀, m_count/m_split_lines
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            make_name(new_log, my_tm, m_segment + 1);
+            next = open_file(new_log);
         }
-        m_fp = fopen(new_log, "a");
+        if (next == NULL)
+            return;
+        m_segment++;
     }
+    // 旧文件交给后台线程关闭，fclose时的刷盘不占用写日志的线程
+    retire(m_fp, m_cur_name, false);
+    m_fp = next;
+    snprintf(m_cur_name, LOG_NAME_LEN, "%s", new_log);
+    m_file_size = 0;
+    m_unflushed = 0;
+    if (m_binary)
+        write_binary_header();
+    m_wake.post();
+}
+
+void Log::prepare_rotation()
+{
+    char name[LOG_NAME_LEN];
+    time_t t = time(NULL);
 
+    // 当前文件快写满时，提前打开下一段
+    m_mutex.lock();
+    bool need_split = m_split_fp == NULL &&
+                      (m_count % m_split_lines >= m_split_lines / 10 * 9 ||
+                       (m_max_size > 0 && m_file_size >= m_max_size / 10 * 9));
+    int segment = m_segment + 1;
+    int today = m_today;
     m_mutex.unlock();
+    if (need_split)
+    {
+        struct tm my_tm;
+        localtime_r(&t, &my_tm);
+        if (my_tm.tm_mday == today)
+        {
+            make_name(name, my_tm, segment);
+            FILE *fp = open_file(name);
+            m_mutex.lock();
+            if (fp != NULL && m_split_fp == NULL && m_segment + 1 == segment && m_today == today)
+            {
+                m_split_fp = fp;
+                snprintf(m_split_name, LOG_NAME_LEN, "%s", name);
+                fp = NULL;
+            }
+            m_mutex.unlock();
+            if (fp != NULL)
+            {
+                fclose(fp);
+                unlink(name);
+            }
+        }
+    }
 
-    va_list valst;
-    // 将传入的format参数赋值给valst，便于格式化输出
-    va_start(valst, format);
+    // 快到午夜时，提前打开明天的第一个文件
+    struct tm next_tm;
+    time_t ahead = t + ROTATE_AHEAD_SEC;
+    localtime_r(&ahead, &next_tm);
+    m_mutex.lock();
+    bool need_day = m_day_fp == NULL && next_tm.tm_mday != m_today;
+    m_mutex.unlock();
+    if (need_day)
+    {
+        make_name(name, next_tm, 0);
+        FILE *fp = open_file(name);
+        m_mutex.lock();
+        if (fp != NULL && m_day_fp == NULL && m_today != next_tm.tm_mday)
+        {
+            m_day_fp = fp;
+            m_day_mday = next_tm.tm_mday;
+            snprintf(m_day_name, LOG_NAME_LEN, "%s", name);
+            fp = NULL;
+        }
+        m_mutex.unlock();
+        if (fp != NULL)
+            fclose(fp);
+    }
+}
 
-    string log_str;
+void Log::close_retired()
+{
     m_mutex.lock();
+    std::vector<retired_file> retired;
+    retired.swap(m_retired);
+    m_mutex.unlock();
+    if (retired.empty())
+        return;
 
-    // 写入内容格式：时间 + 内容
-    // 时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    // 内容格式化，用于向字符串中打印数据、数据格式用户自定义，返回写入到字符数组str中的字符个数(不包含终止符)
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        fclose(retired[i].fp);
+        if (retired[i].remove)
+        {
+            unlink(retired[i].name);
+        }
+        else if (m_compress && m_compress_running)
+        {
+            m_compress_mutex.lock();
+            m_compress_queue.push_back(retired[i].name);
+            m_compress_mutex.unlock();
+            m_compress_sem.post();
+        }
+    }
+    // 开启压缩时由压缩线程在压缩完成后清理
+    if (m_keep_files > 0 && !(m_compress && m_compress_running))
+        remove_old_files();
+}
 
-    m_mutex.unlock();
-    // 若m_is_async为true表示异步，默认为同步
-    // 若异步,则将日志信息加入阻塞队列,同步则加锁向文件中写
-    if (m_is_async && !m_log_queue->full())
+void Log::remove_old_files()
+{
+    const char *dir = dir_name[0] ? dir_name : "./";
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+    // 属于这个日志的文件名形如 YYYY_MM_DD_name[.N][.gz]，按日期和段号排序
+    // 压缩会改变修改时间，不能按mtime排
+    std::vector<std::pair<std::pair<string, int>, string> > files;
+    size_t name_len = strlen(log_name);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
     {
-        m_log_queue->push(log_str);
+        const char *n = e->d_name;
+        if (strlen(n) < 11 + name_len || n[4] != '_' || n[7] != '_' || n[10] != '_' ||
+            strncmp(n + 11, log_name, name_len) != 0)
+            continue;
+        const char *rest = n + 11 + name_len;
+        if (*rest != '\0' && *rest != '.')
+            continue;
+        int segment = 0;
+        if (*rest == '.' && rest[1] >= '0' && rest[1] <= '9')
+            segment = atoi(rest + 1);
+        string path = string(dir_name) + n;
+        m_mutex.lock();
+        bool open = path == m_cur_name || (m_split_fp && path == m_split_name) || (m_day_fp && path == m_day_name);
+        m_mutex.unlock();
+        if (open)
+            continue;
+        files.push_back(std::make_pair(std::make_pair(string(n, 10), segment), path));
+    }
+    closedir(d);
+    if ((int)files.size() <= m_keep_files)
+        return;
+    // 从旧到新，删掉超出保留个数的部分
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i + m_keep_files < files.size(); ++i)
+        unlink(files[i].second.c_str());
+}
+
+void Log::compress_file(const char *name)
+{
+    char gz_name[LOG_NAME_LEN + 3];
+    snprintf(gz_name, sizeof(gz_name), "%s.gz", name);
+    FILE *in = fopen(name, "rb");
+    if (in == NULL)
+        return;
+    gzFile out = gzopen(gz_name, "wb6");
+    if (out == NULL)
+    {
+        fclose(in);
+        return;
+    }
+    char buf[64 * 1024];
+    size_t n;
+    bool ok = true;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        if (gzwrite(out, buf, n) != (int)n)
+        {
+            ok = false;
+            break;
+        }
     }
+    fclose(in);
+    if (gzclose(out) != Z_OK)
+        ok = false;
+    // 压缩成功才删除原文件，失败时保留原文件、删除残缺的.gz
+    if (ok)
+        unlink(name);
     else
+        unlink(gz_name);
+}
+
+void Log::compress_loop()
+{
+    // 压缩只占空闲CPU，不和业务线程抢
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    while (true)
+    {
+        m_compress_sem.wait();
+        m_compress_mutex.lock();
+        if (m_compress_queue.empty())
+        {
+            m_compress_mutex.unlock();
+            continue;
+        }
+        string name = m_compress_queue.front();
+        m_compress_queue.pop_front();
+        m_compress_mutex.unlock();
+        // 空文件名表示退出
+        if (name.empty())
+            break;
+        compress_file(name.c_str());
+        if (m_keep_files > 0)
+            remove_old_files();
+    }
+}
+
+void Log::set_rotation(long long max_size, int keep_files, bool compress)
+{
+    m_max_size = max_size > 0 ? max_size : 0;
+    m_keep_files = keep_files > 0 ? keep_files : 0;
+    m_compress = compress;
+    if (m_compress && !m_compress_running)
+    {
+        if (pthread_create(&m_compress_tid, NULL, compress_log_thread, NULL) == 0)
+            m_compress_running = true;
+    }
+}
+
+void Log::drain()
+{
+    struct iovec iov[MAX_IOV];
+    thread_log_buffer *owners[MAX_IOV];
+    int cnt = 0;
+
+    m_buffers_mutex.lock();
+    thread_log_buffer *head = m_buffers;
+    m_buffers_mutex.unlock();
+
+    thread_log_buffer *tb = head;
+    while (tb || cnt > 0)
     {
+        // 收集写满的缓冲区，没写满但有内容的也换下来，保证日志按时落盘
+        for (; tb && cnt < MAX_IOV; tb = tb->next)
+        {
+            tb->mutex.lock();
+            if (!tb->full && tb->cur_len > 0 && tb->spare)
+            {
+                tb->full = tb->cur;
+                tb->full_len = tb->cur_len;
+                tb->cur = tb->spare;
+                tb->cur_len = 0;
+                tb->spare = NULL;
+            }
+            if (tb->full)
+            {
+                iov[cnt].iov_base = tb->full;
+                iov[cnt].iov_len = tb->full_len;
+                owners[cnt++] = tb;
+            }
+            tb->mutex.unlock();
+        }
+        if (cnt == 0)
+            break;
+
+        long long lines = 0;
+        for (int i = 0; i < cnt; ++i)
+        {
+            const char *p = (const char *)iov[i].iov_base;
+            const char *end = p + iov[i].iov_len;
+            if (m_binary)
+            {
+                // 二进制记录按长度字段逐条跳过
+                for (; p + LOG_BIN_MSG_HEAD <= end; ++lines)
+                {
+                    uint16_t len;
+                    memcpy(&len, p + 13, 2);
+                    p += LOG_BIN_MSG_HEAD + len;
+                }
+                continue;
+            }
+            while ((p = (const char *)memchr(p, '\n', end - p)) != NULL)
+            {
+                ++lines;
+                ++p;
+            }
+        }
+
+        time_t t = time(NULL);
+        struct tm my_tm;
+        localtime_r(&t, &my_tm);
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        if (m_today != my_tm.tm_mday)
+            rotate(my_tm);
+        // 所有缓冲区一次writev写入，写入不完整时从断点继续
+        int fd = fileno(m_fp);
+        long long written = 0;
+        // 这批记录用到的调用点在收集缓冲区之前就已登记，先把新增的格式定义写出
+        if (m_binary)
+            write_site_defs(fd, m_sites_written, true);
+        struct iovec *v = iov;
+        int left = cnt;
+        while (left > 0)
+        {
+            ssize_t n = writev(fd, v, left);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            written += n;
+            while (left > 0 && (size_t)n >= v->iov_len)
+            {
+                n -= v->iov_len;
+                ++v;
+                --left;
+            }
+            if (left > 0)
+            {
+                v->iov_base = (char *)v->iov_base + n;
+                v->iov_len -= n;
+            }
+        }
+        long long before = m_count;
+        m_count += lines;
+        m_file_size += written;
+        // 行数跨过了m_split_lines的整数倍或超过大小上限，切换到带后缀的新文件
+        if (before / m_split_lines != m_count / m_split_lines || (m_max_size > 0 && m_file_size >= m_max_size))
+            rotate(my_tm);
         m_mutex.unlock();
+
+        // 写完的缓冲区还给对应线程作为备用
+        for (int i = 0; i < cnt; ++i)
+        {
+            owners[i]->mutex.lock();
+            owners[i]->spare = owners[i]->full;
+            owners[i]->full = NULL;
+            owners[i]->full_len = 0;
+            owners[i]->mutex.unlock();
+        }
+        m_spare_mutex.lock();
+        m_spare_cond.broadcast();
+        m_spare_mutex.unlock();
+        cnt = 0;
     }
+}
 
-    va_end(valst);
+void Log::async_write_log()
+{
+    while (!m_stop)
+    {
+        // 有缓冲区写满、越过刷盘阈值或写了ERROR时被唤醒，否则定时落盘
+        m_wake.timewait(m_flush_interval_ms);
+        report_suppressed(false);
+        flush();
+        // 关闭换下来的文件、提前打开下一个文件都在这里做
+        close_retired();
+        prepare_rotation();
+    }
+    report_suppressed(true);
+    flush();
+    close_retired();
+}
+
+bool Log::set_sampling(const char *spec)
+{
+    int every[4] = {1, 1, 1, 1};
+    const char *p = spec;
+    for (int i = 0; i < 4 && p && *p; ++i)
+    {
+        every[i] = atoi(p);
+        if (every[i] < 1)
+            return false;
+        p = strchr(p, ',');
+        if (p)
+            ++p;
+    }
+    for (int i = 0; i < 4; ++i)
+        m_sample_every[i] = every[i];
+    m_limiting = m_rate_interval > 0 || every[0] > 1 || every[1] > 1 || every[2] > 1 || every[3] > 1;
+    return true;
+}
+
+void Log::set_rate_limit(int per_sec, int burst)
+{
+    if (per_sec > 0)
+    {
+        m_rate_interval = 1000000000ull / per_sec;
+        m_rate_tolerance = m_rate_interval * (burst > 1 ? burst - 1 : 0);
+    }
+    else
+    {
+        m_rate_interval = 0;
+        m_rate_tolerance = 0;
+    }
+    m_limiting = m_rate_interval > 0 || m_sample_every[0] > 1 || m_sample_every[1] > 1 ||
+                 m_sample_every[2] > 1 || m_sample_every[3] > 1;
+}
+
+void Log::report_suppressed(bool force)
+{
+    if (!m_limiting)
+        return;
+    uint64_t now = monotonic_ns();
+    if (m_last_report == 0)
+        m_last_report = now;
+    // 每个刷盘窗口最多一行摘要，退出前强制汇总一次
+    if (!force && now - m_last_report < (uint64_t)m_flush_interval_ms * 1000000)
+        return;
+    uint64_t window_ms = (now - m_last_report) / 1000000;
+    m_last_report = now;
+
+    long long total = 0, top_count = 0;
+    int sites = 0;
+    const log_site *top = NULL;
+    m_sites_mutex.lock();
+    for (size_t i = 0; i < m_sites.size(); ++i)
+    {
+        long long n = m_sites[i]->suppressed.exchange(0, std::memory_order_relaxed);
+        if (n == 0)
+            continue;
+        total += n;
+        ++sites;
+        if (n > top_count)
+        {
+            top_count = n;
+            top = m_sites[i];
+        }
+    }
+    m_sites_mutex.unlock();
+    if (total == 0)
+        return;
+
+    // 摘要本身不经过限流
+    static const char *fmt = "suppressed %lld messages from %d call sites in last %llu ms, most from %s:%d \"%.64s\" (%lld)";
+    const char *file = strrchr(top->file, '/') ? strrchr(top->file, '/') + 1 : top->file;
+    if (m_binary)
+    {
+        static log_site site(2, fmt);
+        write_binary(site, total, sites, (unsigned long long)window_ms, file, top->line, top->format, top_count);
+    }
+    else
+        write_log(2, fmt, total, sites, (unsigned long long)window_ms, file, top->line, top->format, top_count);
+}
+
+long long Log::waits()
+{
+    long long n = 0;
+    m_buffers_mutex.lock();
+    thread_log_buffer *head = m_buffers;
+    m_buffers_mutex.unlock();
+    for (thread_log_buffer *tb = head; tb; tb = tb->next)
+    {
+        tb->mutex.lock();
+        n += tb->waits;
+        tb->mutex.unlock();
+    }
+    return n;
 }
 
 void Log::flush(void)
 {
+    if (m_is_async)
+    {
+        // 线程还有待写的full时，本轮不会换下它的cur，第二轮才能带上
+        // 两轮之后，调用flush()之前写入的日志都已落盘
+        m_drain_mutex.lock();
+        drain();
+        drain();
+        m_drain_mutex.unlock();
+    }
     m_mutex.lock();
     // 强制刷新写入流缓冲区
-    fflush(m_fp);
+    if (m_fp != NULL && (m_is_async || m_unflushed > 0))
+        fflush(m_fp);
+    m_unflushed = 0;
     m_mutex.unlock();
 }
+
+void Log::flush_on_crash()
+{
+    if (m_fp == NULL)
+        return;
+    if (!m_is_async)
+    {
+        // 崩溃线程可能正持有文件锁，用不加锁的版本，尽力而为
+        fflush_unlocked(m_fp);
+        return;
+    }
+    // 不加锁直接写出各线程缓冲区，后台线程正在写的部分可能重复出现
+    int fd = fileno(m_fp);
+    if (m_binary)
+        write_site_defs(fd, m_sites_written, false);
+    for (thread_log_buffer *tb = m_buffers; tb; tb = tb->next)
+    {
+        if (tb->full && tb->full_len > 0)
+            write(fd, tb->full, tb->full_len);
+        if (tb->cur_len > 0)
+            write(fd, tb->cur, tb->cur_len);
+    }
+}
@@ -6,10 +6,70 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <time.h>
+#include <string.h>
+#include <vector>
+#include <list>
+#include <type_traits>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../timer/clock.h"
+#include "log_format.h"
 
 using namespace std;
 
+// 每个线程独占的日志缓冲区
+// 业务线程只往cur里追加，写满后与spare交换，写满的缓冲区挂到full上等待后台线程落盘
+// 每个线程固定持有两块缓冲区，热路径上不申请内存
+struct thread_log_buffer
+{
+    locker mutex;              // 只有交换缓冲区时才会和后台线程竞争
+    char *cur;                 // 当前写入的缓冲区
+    int cur_len;               // cur中已写入的字节数
+    char *spare;               // 备用缓冲区，后台线程正在写盘时为NULL
+    char *full;                // 待落盘的缓冲区
+    int full_len;              // full中的字节数
+    long long waits;           // 后台来不及落盘，业务线程等待备用缓冲区的次数
+    bool orphan;               // 所属线程已退出，可以交给新线程复用
+    thread_log_buffer *next;   // 所有线程的缓冲区串成链表，只在表头插入
+
+    // 线程本地的时间缓存，同一秒内不再调用localtime
+    time_t last_sec;
+    struct tm last_tm;
+};
+
+class Log;
+
+const int LOG_DIR_LEN = 128;  // 日志目录部分，含结尾的/
+const int LOG_FILE_LEN = 128; // 日志文件名部分
+// 完整文件名：目录、日期、文件名和段号，按各部分的上限留足，make_name不会截断
+const int LOG_NAME_LEN = LOG_DIR_LEN + LOG_FILE_LEN + 64;
+
+// 换下来等待后台线程关闭的文件
+struct retired_file
+{
+    FILE *fp;
+    bool remove;               // 预先打开但没用上的空文件，关闭后删除
+    char name[LOG_NAME_LEN];
+};
+
+// 每个日志调用点对应一个静态的log_site，第一次执行时登记格式串并分配id
+// 二进制模式下每条日志只记录id和原始参数；限流和采样也按调用点计数
+struct log_site
+{
+    uint32_t id;
+    int level;
+    const char *format;
+    const char *file;                 // 调用点所在位置，限流摘要里用来定位
+    int line;
+    std::atomic<uint64_t> hits;       // 采样计数
+    std::atomic<uint64_t> tat;        // 令牌桶(GCRA)的理论到达时间
+    std::atomic<uint64_t> suppressed; // 本窗口内被丢弃的条数
+    log_site(int level, const char *format, const char *file = "", int line = 0);
+    // 是否写这一条，在参数求值之前调用
+    bool allow();
+};
+
 class Log
 {
 public:
@@ -19,72 +79,264 @@ public:
         static Log instance;
         return &instance;
     }
-    // 异步写日志公有方法，调用私有方法async_write_log
-    static void *flush_log_thread(void *args)
+    // 后台线程：异步模式下负责落盘，同步模式下定时刷新文件缓冲区
+    static void *flush_log_thread(void *)
     {
         Log::get_instance()->async_write_log();
+        return NULL;
+    }
+    // 压缩旧日志的低优先级线程
+    static void *compress_log_thread(void *)
+    {
+        Log::get_instance()->compress_loop();
+        return NULL;
     }
-    // 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
-    // 将输出内容按照标准格式整理
-    void write_log(int level, const char *format, ...);
-    // 强制刷新缓冲区
+    // 可选择的参数有日志文件、单行日志的最大长度、最大行数以及每个线程缓冲区的大小
+    // thread_buf_size大于0时为异步写入，每个线程持有两块该大小的缓冲区
+    // 刷盘策略：每flush_interval_ms毫秒或累积flush_kb KB刷一次，ERROR级别立即刷
+    // binary为true时写二进制格式，由logdecode还原成文本，二进制模式总是使用线程缓冲区异步写入
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int thread_buf_size = 0,
+              int flush_interval_ms = 1000, int flush_kb = 64, bool binary = false);
+    // 将输出内容按照标准格式整理，由编译器检查格式串和参数是否匹配
+    void write_log(int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    // 运行时最低级别，低于该级别的日志不求值参数
+    void set_level(int level) { m_level = level; }
+    bool enabled(int level) const { return level >= m_level; }
+    bool is_binary() const { return m_binary; }
+    // 登记调用点的格式串，返回分配的id
+    uint32_t register_site(log_site *site);
+    // 二进制模式写一条日志：不格式化，只拷贝单调时间戳和原始参数
+    template <typename... Args>
+    void write_binary(const log_site &site, Args... args);
+    // 每级别1/N采样，spec形如"100,10,1,1"依次对应DEBUG/INFO/WARN/ERROR，1为不采样
+    bool set_sampling(const char *spec);
+    // 每个调用点每秒最多per_sec条，允许burst条突发，0不限制
+    void set_rate_limit(int per_sec, int burst);
+    bool limiting() const { return m_limiting; }
+    int sample_every(int level) const { return m_sample_every[level & 3]; }
+    uint64_t rate_interval() const { return m_rate_interval; }
+    uint64_t rate_tolerance() const { return m_rate_tolerance; }
+    // 文件切分策略：max_size字节上限(0不限制)、保留最近keep_files个旧文件(0不删除)、是否gzip压缩旧文件
+    void set_rotation(long long max_size, int keep_files, bool compress);
+    // 把所有已写入的日志刷到文件，返回前保证落盘
     void flush(void);
+    // 崩溃信号处理函数中调用，不加锁，尽力把缓冲区写出
+    void flush_on_crash();
+    // 业务线程等待后台落盘的次数，持续增长说明缓冲区偏小或磁盘跟不上
+    long long waits();
 
 private:
     Log();
     virtual ~Log();
     // 异步写日志方法
-    void *async_write_log()
+    void async_write_log();
+    // 汇总上一个窗口内被限流和采样丢弃的条数，写一行摘要
+    void report_suppressed(bool force);
+    // 把所有线程的待写缓冲区用一次writev写入文件
+    void drain();
+    // 取得当前线程的缓冲区，首次调用时注册
+    thread_log_buffer *thread_buffer();
+    // 格式化时间和级别前缀，返回写入的长度
+    int format_prefix(thread_log_buffer *tb, char *buf, int level);
+    // 日期变化、行数或大小达到上限时切换日志文件，调用方需持有m_mutex
+    // 只交换文件指针，打开和关闭文件由后台线程完成
+    void rotate(const struct tm &my_tm);
+    void make_name(char *out, const struct tm &my_tm, int segment);
+    void retire(FILE *fp, const char *name, bool remove);
+    // 后台线程：提前打开下一段和明天的文件
+    void prepare_rotation();
+    // 后台线程：关闭换下来的文件，交给压缩线程或按保留个数清理
+    void close_retired();
+    void remove_old_files();
+    void compress_loop();
+    void compress_file(const char *name);
+    // 打开日志文件，并按刷盘阈值设置stdio缓冲区大小
+    FILE *open_file(const char *name);
+    // 锁住当前线程的缓冲区并保证剩余空间至少m_log_buf_size，返回写入位置
+    char *begin_record(thread_log_buffer *&tb);
+    // 提交len字节并解锁，按级别和刷盘阈值决定是否唤醒后台线程
+    void end_record(thread_log_buffer *tb, int len, int level);
+    // 二进制模式：写文件头和格式定义，调用方需持有m_mutex
+    void write_binary_header();
+    void write_site_defs(int fd, size_t from, bool lock);
+
+    // 按参数类型编码，超出缓冲区的参数直接丢弃
+    static void encode_arg(char *&p, char *end, const char *v);
+    static void encode_arg(char *&p, char *end, char *v) { encode_arg(p, end, (const char *)v); }
+    static void encode_arg(char *&p, char *end, double v) { encode_raw(p, end, LOG_ARG_DOUBLE, &v); }
+    static void encode_arg(char *&p, char *end, const void *v) { encode_raw(p, end, LOG_ARG_PTR, &v); }
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    encode_arg(char *&p, char *end, T v)
     {
-        string single_log;
-        // 从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
+        if (std::is_signed<T>::value)
+        {
+            int64_t x = (int64_t)v;
+            encode_raw(p, end, LOG_ARG_INT, &x);
+        }
+        else
         {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
+            uint64_t x = (uint64_t)v;
+            encode_raw(p, end, LOG_ARG_UINT, &x);
         }
     }
+    static void encode_raw(char *&p, char *end, char type, const void *v8)
+    {
+        if (end - p < 9)
+            return;
+        *p++ = type;
+        memcpy(p, v8, 8);
+        p += 8;
+    }
+    static void encode_args(char *&, char *) {}
+    template <typename T, typename... Rest>
+    static void encode_args(char *&p, char *end, T v, Rest... rest)
+    {
+        encode_arg(p, end, v);
+        encode_args(p, end, rest...);
+    }
 
 private:
-    char dir_name[128];               // 路径名
-    char log_name[128];               // log文件名
+    char dir_name[LOG_DIR_LEN];       // 路径名
+    char log_name[LOG_FILE_LEN];      // log文件名
     int m_split_lines;                // 日志最大行数
-    int m_log_buf_size;               // 日志缓冲区大小
+    int m_log_buf_size;               // 单行日志的最大长度
+    int m_thread_buf_size;            // 每个线程缓冲区的大小
     long long m_count;                // 日志行数记录
     int m_today;                      // 因为按天分类,记录当前时间是那一天
     FILE *m_fp;                       // 打开log的文件指针
-    char *m_buf;                      // 要输出的内容
-    block_queue<string> *m_log_queue; // 阻塞队列
+    char m_cur_name[LOG_NAME_LEN];    // 当前文件名
+    int m_segment;                    // 当天第几段，0表示不带后缀
+    long long m_file_size;            // 当前文件大小
+    long long m_max_size;             // 单个文件大小上限，0不限制
+    FILE *m_split_fp;                 // 预先打开的下一段
+    char m_split_name[LOG_NAME_LEN];
+    FILE *m_day_fp;                   // 预先打开的明天第一个文件
+    int m_day_mday;
+    char m_day_name[LOG_NAME_LEN];
+    std::vector<retired_file> m_retired; // 等待关闭的文件，由m_mutex保护
+    int m_keep_files;                 // 保留的旧文件个数
+    bool m_compress;                  // 是否压缩旧文件
+    bool m_compress_running;
+    pthread_t m_compress_tid;
+    std::list<string> m_compress_queue;
+    locker m_compress_mutex;
+    sem m_compress_sem;
     bool m_is_async;                  // 是否异步标志位
-    locker m_mutex;                   // 同步类
+    locker m_mutex;                   // 保护文件指针
     int m_close_log;                  // 关闭日志
+    int m_level;                      // 运行时最低级别
+
+    thread_log_buffer *m_buffers;     // 所有线程的缓冲区链表
+    locker m_buffers_mutex;           // 保护链表的插入
+    sem m_wake;                       // 有缓冲区写满时唤醒后台线程
+    locker m_spare_mutex;             // 配合m_spare_cond使用
+    cond m_spare_cond;                // 后台线程归还缓冲区后唤醒等待的业务线程
+    pthread_t m_tid;                  // 后台线程
+    bool m_stop;                      // 通知后台线程退出
+    bool m_thread_running;            // 后台线程是否已启动
+
+    int m_flush_interval_ms;          // 定时刷盘间隔
+    int m_flush_bytes;                // 累积多少字节刷一次
+    long long m_unflushed;            // 同步模式下上次刷新后写入的字节数，由m_mutex保护
+    locker m_drain_mutex;             // 后台线程和flush()都会落盘，保证同一时刻只有一个
+
+    bool m_binary;                    // 二进制格式
+    std::vector<log_site *> m_sites;  // 已登记的调用点，下标即id
+    size_t m_sites_written;           // 当前文件中已写入的格式定义数，由m_mutex保护
+    locker m_sites_mutex;             // 保护m_sites
+
+    bool m_limiting;                  // 是否开启了限流或采样
+    int m_sample_every[4];            // 各级别的采样间隔
+    uint64_t m_rate_interval;         // 令牌桶：两条之间的最小间隔(ns)
+    uint64_t m_rate_tolerance;        // 令牌桶：允许的突发量折算成时间
+    uint64_t m_last_report;           // 上次输出摘要的时间
 };
-// 这四个宏定义在其他文件中使用，主要用于不同类型的日志输出
-#define LOG_DEBUG(format, ...)                                    \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(0, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
-    }
-#define LOG_INFO(format, ...)                                     \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(1, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
-    }
-#define LOG_WARN(format, ...)                                     \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(2, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
+
+inline log_site::log_site(int level, const char *format, const char *file, int line)
+    : id(0), level(level), format(format), file(file), line(line), hits(0), tat(0), suppressed(0)
+{
+    id = Log::get_instance()->register_site(this);
+}
+
+inline bool log_site::allow()
+{
+    Log *log = Log::get_instance();
+    if (!log->limiting())
+        return true;
+    // 1/N采样
+    int every = log->sample_every(level);
+    if (every > 1 && hits.fetch_add(1, std::memory_order_relaxed) % every != 0)
+    {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
-#define LOG_ERROR(format, ...)                                    \
-    if (0 == m_close_log)                                         \
-    {                                                             \
-        Log::get_instance()->write_log(3, format, ##__VA_ARGS__); \
-        Log::get_instance()->flush();                             \
+    // 令牌桶，用一个原子变量实现：理论到达时间超前当前时间太多说明令牌用完了
+    uint64_t interval = log->rate_interval();
+    if (interval > 0)
+    {
+        uint64_t now = monotonic_ns();
+        uint64_t t = tat.load(std::memory_order_relaxed);
+        while (true)
+        {
+            uint64_t start = t > now ? t : now;
+            if (start - now > log->rate_tolerance())
+            {
+                suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (tat.compare_exchange_weak(t, start + interval, std::memory_order_relaxed))
+                break;
+        }
     }
+    return true;
+}
+
+template <typename... Args>
+void Log::write_binary(const log_site &site, Args... args)
+{
+    thread_log_buffer *tb;
+    char *buf = begin_record(tb);
+    char *end = buf + m_log_buf_size;
+    char *p = buf;
+    uint64_t now = monotonic_ns();
+    *p++ = LOG_REC_MSG;
+    memcpy(p, &site.id, 4);
+    memcpy(p + 4, &now, 8);
+    p += 14;
+    encode_args(p, end, args...);
+    uint16_t len = p - buf - LOG_BIN_MSG_HEAD;
+    memcpy(buf + 13, &len, 2);
+    end_record(tb, p - buf, site.level);
+}
+// 编译期最低日志级别，0 DEBUG，1 INFO，2 WARN，3 ERROR
+// 低于该级别的调用在编译期就被丢弃，参数不会求值，例如 make LOG_LEVEL_MIN=2
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN 0
+#endif
+
+// 先比较编译期常量，再检查运行时开关、级别以及调用点的限流采样，都通过后才对参数求值并格式化
+// 二进制模式下格式串只登记一次，参数原样拷贝，格式化推迟到logdecode
+// 宏本身不再刷盘，何时写到文件由init中的刷盘策略决定
+#define LOG_BASE(level, format, ...)                                                      \
+    do                                                                                    \
+    {                                                                                     \
+        if ((level) >= LOG_LEVEL_MIN && 0 == m_close_log && Log::get_instance()->enabled(level)) \
+        {                                                                                 \
+            static log_site _log_site(level, format, __FILE__, __LINE__);                 \
+            if (!_log_site.allow())                                                       \
+                break;                                                                    \
+            if (Log::get_instance()->is_binary())                                         \
+                Log::get_instance()->write_binary(_log_site, ##__VA_ARGS__);              \
+            else                                                                          \
+                Log::get_instance()->write_log(level, format, ##__VA_ARGS__);             \
+        }                                                                                 \
+    } while (0)
+
+// 这四个宏定义在其他文件中使用，主要用于不同类型的日志输出
+#define LOG_DEBUG(format, ...) LOG_BASE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(3, format, ##__VA_ARGS__)
 
 #endif
@@ -0,0 +1,35 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+
+// 二进制日志文件格式，整数按本机字节序存放，解码需在同构机器上进行
+//
+// 文件头: magic[8] | realtime_ns(u64) | monotonic_ns(u64)
+//         两个时间戳在打开文件时成对记录，用来把记录里的单调时间换算成日期
+// 格式定义: LOG_REC_DEF | id(u32) | level(u8) | len(u16) | 格式串
+// 日志记录: LOG_REC_MSG | id(u32) | monotonic_ns(u64) | len(u16) | 参数
+// 参数:     类型(u8) | 数据，整数、浮点和指针固定8字节，字符串为len(u16) + 内容
+//
+// 每个文件开头都会重写已登记的全部格式定义，文件可以单独解码
+static const char LOG_BIN_MAGIC[8] = {'T', 'W', 'S', 'B', 'L', 'O', 'G', '1'};
+static const int LOG_BIN_HEADER_LEN = 8 + 8 + 8;
+static const int LOG_BIN_DEF_HEAD = 1 + 4 + 1 + 2;
+static const int LOG_BIN_MSG_HEAD = 1 + 4 + 8 + 2;
+
+enum LOG_RECORD
+{
+    LOG_REC_DEF = 1,
+    LOG_REC_MSG = 2
+};
+
+enum LOG_ARG_TYPE
+{
+    LOG_ARG_INT = 1,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR,
+    LOG_ARG_PTR
+};
+
+#endif
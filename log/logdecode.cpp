@@ -0,0 +1,278 @@
+/*************************************************************
+ * 二进制日志解码：把二进制模式写出的日志还原成文本格式
+ * 用法: ./logdecode 日志文件 [日志文件...]，结果输出到标准输出，压缩过的.gz文件可直接解码
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include "log_format.h"
+
+using namespace std;
+
+struct site_def
+{
+    bool valid;
+    int level;
+    string format;
+    site_def() : valid(false), level(1) {}
+};
+
+struct log_arg
+{
+    int type;
+    uint64_t bits;
+    const char *str;
+    int len;
+};
+
+static vector<site_def> g_sites;
+static uint64_t g_real_base = 0;
+static uint64_t g_mono_base = 0;
+
+static bool read_file(const char *name, vector<char> &out)
+{
+    // gzread对未压缩的文件原样读出
+    gzFile fp = gzopen(name, "rb");
+    if (fp == NULL)
+        return false;
+    char buf[1 << 16];
+    int n;
+    while ((n = gzread(fp, buf, sizeof(buf))) > 0)
+        out.insert(out.end(), buf, buf + n);
+    gzclose(fp);
+    return n == 0;
+}
+
+// 与Log::format_prefix输出相同的时间和级别前缀
+static void print_prefix(uint64_t mono, int level)
+{
+    static const char *tags[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+    uint64_t ns = g_real_base + (mono - g_mono_base);
+    time_t sec = ns / 1000000000ull;
+    long usec = (ns % 1000000000ull) / 1000;
+    struct tm my_tm;
+    localtime_r(&sec, &my_tm);
+    const char *s = (level >= 0 && level <= 3) ? tags[level] : tags[1];
+    printf("%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+           my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+           my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, usec, s);
+}
+
+// 按格式串逐个说明符取参数，长度修饰统一换成参数实际的8字节类型
+static void print_message(const string &format, const vector<log_arg> &args)
+{
+    size_t next = 0;
+    const char *f = format.c_str();
+    while (*f)
+    {
+        if (*f != '%')
+        {
+            putchar(*f++);
+            continue;
+        }
+        if (f[1] == '%')
+        {
+            putchar('%');
+            f += 2;
+            continue;
+        }
+        string spec = "%";
+        ++f;
+        while (*f && strchr("-+ #0'", *f))
+            spec += *f++;
+        // 宽度和精度可能是*，此时从参数里取
+        for (int part = 0; part < 2; ++part)
+        {
+            if (part == 1)
+            {
+                if (*f != '.')
+                    break;
+                spec += *f++;
+            }
+            if (*f == '*')
+            {
+                long long v = next < args.size() ? (long long)args[next++].bits : 0;
+                spec += to_string(v);
+                ++f;
+            }
+            while (*f >= '0' && *f <= '9')
+                spec += *f++;
+        }
+        while (*f && strchr("hlLqjzt", *f))
+            ++f;
+        char conv = *f;
+        if (conv == '\0')
+            break;
+        ++f;
+        if (conv == 'n')
+            continue;
+        if (next >= args.size())
+        {
+            fputs("<?>", stdout);
+            continue;
+        }
+        const log_arg &a = args[next++];
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec += "ll";
+            spec += conv;
+            printf(spec.c_str(), (long long)a.bits);
+            break;
+        case 'c':
+            spec += conv;
+            printf(spec.c_str(), (int)a.bits);
+            break;
+        case 's':
+            if (a.type == LOG_ARG_STR)
+            {
+                string s(a.str, a.len);
+                spec += conv;
+                printf(spec.c_str(), s.c_str());
+            }
+            else
+                fputs("<?>", stdout);
+            break;
+        case 'p':
+            spec += conv;
+            printf(spec.c_str(), (void *)(uintptr_t)a.bits);
+            break;
+        default:
+        {
+            // 浮点: f F e E g G a A
+            double d;
+            if (a.type == LOG_ARG_DOUBLE)
+                memcpy(&d, &a.bits, 8);
+            else
+                d = (double)(long long)a.bits;
+            spec += conv;
+            printf(spec.c_str(), d);
+            break;
+        }
+        }
+    }
+    putchar('\n');
+}
+
+static bool decode(const vector<char> &data, const char *name)
+{
+    const char *p = data.data();
+    const char *end = p + data.size();
+    vector<log_arg> args;
+    while (p < end)
+    {
+        // 文件头，同一个文件里也可能因为拼接出现多次
+        if (end - p >= LOG_BIN_HEADER_LEN && memcmp(p, LOG_BIN_MAGIC, 8) == 0)
+        {
+            memcpy(&g_real_base, p + 8, 8);
+            memcpy(&g_mono_base, p + 16, 8);
+            p += LOG_BIN_HEADER_LEN;
+            continue;
+        }
+        if (*p == LOG_REC_DEF && end - p >= LOG_BIN_DEF_HEAD)
+        {
+            uint32_t id;
+            uint16_t len;
+            memcpy(&id, p + 1, 4);
+            memcpy(&len, p + 6, 2);
+            if (end - p < LOG_BIN_DEF_HEAD + len)
+                break;
+            if (id >= g_sites.size())
+                g_sites.resize(id + 1);
+            g_sites[id].valid = true;
+            g_sites[id].level = p[5];
+            g_sites[id].format.assign(p + LOG_BIN_DEF_HEAD, len);
+            p += LOG_BIN_DEF_HEAD + len;
+            continue;
+        }
+        if (*p == LOG_REC_MSG && end - p >= LOG_BIN_MSG_HEAD)
+        {
+            uint32_t id;
+            uint64_t mono;
+            uint16_t len;
+            memcpy(&id, p + 1, 4);
+            memcpy(&mono, p + 5, 8);
+            memcpy(&len, p + 13, 2);
+            if (end - p < LOG_BIN_MSG_HEAD + len)
+                break;
+            const char *a = p + LOG_BIN_MSG_HEAD;
+            const char *aend = a + len;
+            p = aend;
+
+            args.clear();
+            while (a < aend)
+            {
+                log_arg arg;
+                arg.type = *a++;
+                arg.bits = 0;
+                arg.str = NULL;
+                arg.len = 0;
+                if (arg.type == LOG_ARG_STR && aend - a >= 2)
+                {
+                    uint16_t n;
+                    memcpy(&n, a, 2);
+                    arg.str = a + 2;
+                    arg.len = n;
+                    a += 2 + n;
+                }
+                else if (aend - a >= 8)
+                {
+                    memcpy(&arg.bits, a, 8);
+                    a += 8;
+                }
+                else
+                    break;
+                args.push_back(arg);
+            }
+            if (id >= g_sites.size() || !g_sites[id].valid)
+            {
+                fprintf(stderr, "%s: record references unknown format id %u\n", name, id);
+                continue;
+            }
+            print_prefix(mono, g_sites[id].level);
+            print_message(g_sites[id].format, args);
+            continue;
+        }
+        fprintf(stderr, "%s: corrupt record at offset %ld\n", name, (long)(p - data.data()));
+        return false;
+    }
+    if (p < end)
+        fprintf(stderr, "%s: truncated record at offset %ld\n", name, (long)(p - data.data()));
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s log_file [log_file...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        vector<char> data;
+        if (!read_file(argv[i], data))
+        {
+            fprintf(stderr, "open %s failed\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        // 每个文件开头都有完整的格式定义，不同文件之间不共用
+        g_sites.clear();
+        if (!decode(data, argv[i]))
+            ret = 1;
+    }
+    return ret;
+}
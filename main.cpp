@@ -1,5 +1,9 @@
 #include "config.h"
 
+// libgcov提供，把插桩计数写成.gcda；只有PGO插桩构建(TWS_PGO=GEN)链接了libgcov，其余构建中为空
+// 弱引用保证GEN和USE两次编译main的控制流相同，剖析数据才能对上
+extern "C" void __gcov_dump(void) __attribute__((weak));
+
 int main(int argc, char *argv[])
 {
     // 需要修改的数据库信息,登录名,密码,库名
@@ -14,9 +18,7 @@ int main(int argc, char *argv[])
     WebServer server;
 
     // 初始化
-    server.init(config.PORT, user, passwd, databasename, config.LOGWrite,
-                config.OPT_LINGER, config.TRIGMode, config.sql_num, config.thread_num,
-                config.close_log, config.actor_model);
+    server.init(config, user, passwd, databasename);
 
     // 日志
     server.log_write();
@@ -24,11 +26,14 @@ int main(int argc, char *argv[])
     // 数据库
     server.sql_pool();
 
+    // 触发模式，线程池按连接的触发模式实例化工作线程，需要在线程池之前
+    server.trig_mode();
+
     // 线程池
     server.thread_pool();
 
-    // 触发模式
-    server.trig_mode();
+    // 运行指标
+    server.metrics_register();
 
     // 监听
     server.eventListen();
@@ -36,5 +41,9 @@ int main(int argc, char *argv[])
     // 运行
     server.eventLoop();
 
+    // 插桩构建在事件循环退出后立即写出剖析数据，不依赖进程退出时各线程和静态对象的析构顺序
+    if (__gcov_dump)
+        __gcov_dump();
+
     return 0;
 }
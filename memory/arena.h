@@ -0,0 +1,143 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 请求内存池，每个线程一个
+// 处理一个请求时临时需要的内存从这里按顺序切出(bump分配)，不逐个释放，
+// 线程处理完一个任务后(threadpool、hashpool的run中)调用reset一次性回收
+// 取得的内存只在当前任务内有效，发送阶段还要用的数据需要拷贝到连接自己的缓冲区
+// 块在reset后保留复用，稳态下不再向系统申请内存
+class request_arena
+{
+public:
+    static const size_t BLOCK_SIZE = 16 * 1024;  // 每块大小，超过的申请单独一块
+    static const size_t MAX_RETAIN = 256 * 1024; // reset时最多保留的总量，多出的块归还
+
+    // 当前线程的内存池
+    static request_arena *local()
+    {
+        static thread_local request_arena arena;
+        return &arena;
+    }
+
+    // 按align对齐分配size字节，失败返回NULL
+    void *alloc(size_t size, size_t align = 16)
+    {
+        while (m_cur)
+        {
+            // 按地址对齐，align须为2的幂
+            uintptr_t base = (uintptr_t)m_cur->data();
+            size_t off = ((base + m_cur->used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (off + size <= m_cur->size)
+            {
+                m_cur->used = off + size;
+                return m_cur->data() + off;
+            }
+            // 当前块放不下，使用上次保留下来的下一块
+            if (!m_cur->next)
+                break;
+            m_cur = m_cur->next;
+        }
+        return alloc_block(size, align);
+    }
+    char *alloc_str(size_t n) { return (char *)alloc(n, 1); }
+    char *strdup(const char *s)
+    {
+        size_t n = strlen(s) + 1;
+        char *p = alloc_str(n);
+        if (p)
+            memcpy(p, s, n);
+        return p;
+    }
+
+    // 回收本线程分配的全部内存，之前取得的指针全部失效
+    void reset()
+    {
+        size_t kept = 0;
+        block *prev = NULL;
+        for (block *b = m_head; b;)
+        {
+            block *next = b->next;
+            kept += b->size;
+            if (prev && kept > MAX_RETAIN)
+            {
+                prev->next = next;
+                free(b);
+            }
+            else
+            {
+                b->used = 0;
+                prev = b;
+            }
+            b = next;
+        }
+        m_cur = m_head;
+    }
+    // 当前已分配的字节数，用于调试和测试
+    size_t used() const
+    {
+        size_t n = 0;
+        for (block *b = m_head; b; b = b->next)
+        {
+            n += b->used;
+            if (b == m_cur)
+                break;
+        }
+        return n;
+    }
+
+private:
+    struct block
+    {
+        block *next;
+        size_t size;
+        size_t used;
+        char *data() { return (char *)(this + 1); }
+    };
+
+    request_arena() : m_head(NULL), m_cur(NULL) {}
+    ~request_arena()
+    {
+        while (m_head)
+        {
+            block *next = m_head->next;
+            free(m_head);
+            m_head = next;
+        }
+    }
+    request_arena(const request_arena &);
+    request_arena &operator=(const request_arena &);
+
+    // 申请新块并接在当前块之后
+    void *alloc_block(size_t size, size_t align)
+    {
+        size_t cap = size + align > BLOCK_SIZE ? size + align : BLOCK_SIZE;
+        block *b = (block *)malloc(sizeof(block) + cap);
+        if (!b)
+            return NULL;
+        b->size = cap;
+        b->used = 0;
+        if (m_cur)
+        {
+            b->next = m_cur->next;
+            m_cur->next = b;
+        }
+        else
+        {
+            b->next = m_head;
+            m_head = b;
+        }
+        m_cur = b;
+        return alloc(size, align);
+    }
+
+private:
+    block *m_head; // 第一块，reset后从这里重新分配
+    block *m_cur;  // 正在分配的块
+};
+
+#endif
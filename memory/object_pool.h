@@ -0,0 +1,67 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <new>
+#include <vector>
+
+// 定长对象池，用于生命周期跨请求的小对象(如每个连接的定时器)
+// 按CHUNK个一组向系统申请，释放的对象挂到空闲链表上复用，池析构时才归还
+// 不加锁，只能在一个线程中使用
+template <typename T, int CHUNK = 256>
+class object_pool
+{
+public:
+    object_pool() : m_free(NULL) {}
+    ~object_pool()
+    {
+        for (size_t i = 0; i < m_chunks.size(); ++i)
+            delete[] m_chunks[i];
+    }
+
+    // 取出一个对象并默认构造，内存不足时抛出std::bad_alloc
+    T *alloc()
+    {
+        if (!m_free)
+            grow();
+        node *n = m_free;
+        m_free = n->next;
+        return new (n->storage) T();
+    }
+    // 析构并放回空闲链表
+    void free(T *p)
+    {
+        if (!p)
+            return;
+        p->~T();
+        node *n = reinterpret_cast<node *>(p);
+        n->next = m_free;
+        m_free = n;
+    }
+
+private:
+    union node
+    {
+        node *next;
+        alignas(T) char storage[sizeof(T)];
+    };
+
+    void grow()
+    {
+        node *chunk = new node[CHUNK];
+        m_chunks.push_back(chunk);
+        for (int i = 0; i < CHUNK; ++i)
+        {
+            chunk[i].next = m_free;
+            m_free = chunk + i;
+        }
+    }
+
+    object_pool(const object_pool &);
+    object_pool &operator=(const object_pool &);
+
+private:
+    node *m_free;                // 空闲链表
+    std::vector<node *> m_chunks; // 申请过的块
+};
+
+#endif
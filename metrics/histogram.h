@@ -0,0 +1,111 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// HDR风格的对数线性直方图，单位纳秒
+// 每个2的幂区间再等分成32份，相对误差不超过1/32；小于64ns的值精确记录
+// 最大记录2^37ns(约137秒)，更大的值记入最后一个桶
+const int HIST_SUB_BITS = 6;
+const int HIST_SUB_COUNT = 1 << HIST_SUB_BITS;
+const int HIST_HALF_COUNT = HIST_SUB_COUNT / 2;
+const int HIST_MAX_BITS = 37;
+const int HIST_BUCKETS = (HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_HALF_COUNT + HIST_HALF_COUNT;
+
+// 值所在的桶
+inline int hist_index(uint64_t v)
+{
+    if (v < (uint64_t)HIST_SUB_COUNT)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    if (msb >= HIST_MAX_BITS)
+        return HIST_BUCKETS - 1;
+    int shift = msb - HIST_SUB_BITS + 1;
+    return shift * HIST_HALF_COUNT + (int)(v >> shift);
+}
+
+// 桶内的最大值，报告分位数时使用
+inline uint64_t hist_upper(int idx)
+{
+    if (idx < HIST_SUB_COUNT)
+        return idx;
+    int shift = idx / HIST_HALF_COUNT - 1;
+    uint64_t m = idx % HIST_HALF_COUNT + HIST_HALF_COUNT;
+    return ((m + 1) << shift) - 1;
+}
+
+// 每个线程一份，只有所属线程写，汇总线程并发读
+struct histogram
+{
+    std::atomic<uint64_t> counts[HIST_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    void clear()
+    {
+        for (int i = 0; i < HIST_BUCKETS; ++i)
+            counts[i].store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+    // 单写者，不需要原子读改写
+    void record(uint64_t v)
+    {
+        std::atomic<uint64_t> &c = counts[hist_index(v)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        if (v > max.load(std::memory_order_relaxed))
+            max.store(v, std::memory_order_relaxed);
+    }
+};
+
+// 汇总多个线程的直方图后计算分位数
+struct histogram_snapshot
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+
+    histogram_snapshot() { memset(this, 0, sizeof(*this)); }
+    void add(const histogram &h)
+    {
+        uint64_t n = 0;
+        for (int i = 0; i < HIST_BUCKETS; ++i)
+        {
+            uint64_t c = h.counts[i].load(std::memory_order_relaxed);
+            counts[i] += c;
+            n += c;
+        }
+        // 与写入并发时total可能和桶之和差几个，以桶为准
+        total += n;
+        sum += h.sum.load(std::memory_order_relaxed);
+        uint64_t m = h.max.load(std::memory_order_relaxed);
+        if (m > max)
+            max = m;
+    }
+    // q取0~1，返回不小于q比例样本的最小桶上界
+    uint64_t percentile(double q) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t target = (uint64_t)(q * total + 0.5);
+        if (target == 0)
+            target = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_BUCKETS; ++i)
+        {
+            seen += counts[i];
+            if (seen >= target)
+                return hist_upper(i) < max ? hist_upper(i) : max;
+        }
+        return max;
+    }
+};
+
+#endif
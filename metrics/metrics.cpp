@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+
+metrics::metrics()
+{
+    m_threads = NULL;
+}
+
+metrics::~metrics()
+{
+}
+
+thread_metrics *metrics::register_thread()
+{
+    thread_metrics *t = new thread_metrics;
+    for (int i = 0; i < METRICS_STATUS_NUM; ++i)
+        t->requests[i].store(0, std::memory_order_relaxed);
+    t->bytes_in.store(0, std::memory_order_relaxed);
+    t->bytes_out.store(0, std::memory_order_relaxed);
+    t->accept_errors.store(0, std::memory_order_relaxed);
+    t->busy_rejects.store(0, std::memory_order_relaxed);
+    t->shed.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < STAGE_NUM; ++i)
+        t->stages[i].clear();
+    m_mutex.lock();
+    t->next = m_threads;
+    m_threads = t;
+    m_mutex.unlock();
+    return t;
+}
+
+void metrics::count_request(int status)
+{
+    int i = 0;
+    while (i < METRICS_STATUS_NUM - 1 && METRICS_STATUS_CODES[i] != status)
+        ++i;
+    add(local()->requests[i], 1);
+}
+
+static const char *stage_names[STAGE_NUM] = {"accept", "read", "queue", "parse", "handler", "send", "total"};
+
+// 两个时间点之间的耗时，缺少时间点时返回false
+static bool span(uint64_t from, uint64_t to, uint64_t &out)
+{
+    if (from == 0 || to == 0 || to < from)
+        return false;
+    out = to - from;
+    return true;
+}
+
+void metrics::record_stages(const stage_times &t)
+{
+    histogram *h = local()->stages;
+    uint64_t v;
+    // 没有经过do_request的请求(如解析出错)，解析一直算到生成响应
+    uint64_t parsed = t.parsed ? t.parsed : t.handled;
+    if (span(t.accept, t.ready, v))
+        h[STAGE_ACCEPT].record(v);
+    if (t.read_ns)
+        h[STAGE_READ].record(t.read_ns);
+    if (span(t.queued, t.dequeued, v))
+        h[STAGE_QUEUE].record(v);
+    if (span(t.dequeued, parsed, v))
+        h[STAGE_PARSE].record(v);
+    if (span(parsed, t.handled, v))
+        h[STAGE_HANDLER].record(v);
+    if (span(t.handled, t.done, v))
+        h[STAGE_SEND].record(v);
+    if (span(t.ready, t.done, v))
+        h[STAGE_TOTAL].record(v);
+}
+
+void metrics::collect_stages(histogram_snapshot *snaps)
+{
+    for (thread_metrics *t = m_threads; t; t = t->next)
+        for (int i = 0; i < STAGE_NUM; ++i)
+            snaps[i].add(t->stages[i]);
+}
+
+void metrics::dump_latency(string &out)
+{
+    histogram_snapshot *snaps = new histogram_snapshot[STAGE_NUM];
+    m_mutex.lock();
+    collect_stages(snaps);
+    m_mutex.unlock();
+    char buf[256];
+    for (int i = 0; i < STAGE_NUM; ++i)
+    {
+        const histogram_snapshot &s = snaps[i];
+        snprintf(buf, sizeof(buf), "%-8s count=%llu p50=%lluus p99=%lluus p999=%lluus max=%lluus\n", stage_names[i],
+                 (unsigned long long)s.total, (unsigned long long)s.percentile(0.5) / 1000,
+                 (unsigned long long)s.percentile(0.99) / 1000, (unsigned long long)s.percentile(0.999) / 1000,
+                 (unsigned long long)s.max / 1000);
+        out += buf;
+    }
+    delete[] snaps;
+}
+
+void metrics::add_gauge(const char *name, const char *help, metrics_gauge_fn fn, void *arg)
+{
+    add_reading(name, help, "gauge", fn, arg);
+}
+
+void metrics::add_counter(const char *name, const char *help, metrics_gauge_fn fn, void *arg)
+{
+    add_reading(name, help, "counter", fn, arg);
+}
+
+void metrics::add_reading(const char *name, const char *help, const char *type, metrics_gauge_fn fn, void *arg)
+{
+    gauge g;
+    g.name = name;
+    g.help = help;
+    g.type = type;
+    g.fn = fn;
+    g.arg = arg;
+    m_mutex.lock();
+    m_gauges.push_back(g);
+    m_mutex.unlock();
+}
+
+static void append_header(string &out, const char *name, const char *help, const char *type)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void append_value(string &out, const char *name, unsigned long long v)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), " %llu\n", v);
+    out += name;
+    out += buf;
+}
+
+void metrics::render(string &out)
+{
+    uint64_t requests[METRICS_STATUS_NUM] = {0};
+    uint64_t bytes_in = 0, bytes_out = 0, accept_errors = 0, busy_rejects = 0, shed = 0;
+
+    m_mutex.lock();
+    for (thread_metrics *t = m_threads; t; t = t->next)
+    {
+        for (int i = 0; i < METRICS_STATUS_NUM; ++i)
+            requests[i] += t->requests[i].load(std::memory_order_relaxed);
+        bytes_in += t->bytes_in.load(std::memory_order_relaxed);
+        bytes_out += t->bytes_out.load(std::memory_order_relaxed);
+        accept_errors += t->accept_errors.load(std::memory_order_relaxed);
+        busy_rejects += t->busy_rejects.load(std::memory_order_relaxed);
+        shed += t->shed.load(std::memory_order_relaxed);
+    }
+
+    append_header(out, "webserver_requests_total", "Completed HTTP responses by status code.", "counter");
+    for (int i = 0; i < METRICS_STATUS_NUM; ++i)
+    {
+        char name[64];
+        if (i < METRICS_STATUS_NUM - 1)
+            snprintf(name, sizeof(name), "webserver_requests_total{code=\"%d\"}", METRICS_STATUS_CODES[i]);
+        else
+            snprintf(name, sizeof(name), "webserver_requests_total{code=\"other\"}");
+        append_value(out, name, requests[i]);
+    }
+    append_header(out, "webserver_bytes_received_total", "Bytes read from client sockets.", "counter");
+    append_value(out, "webserver_bytes_received_total", bytes_in);
+    append_header(out, "webserver_bytes_sent_total", "Bytes written to client sockets.", "counter");
+    append_value(out, "webserver_bytes_sent_total", bytes_out);
+    append_header(out, "webserver_accept_errors_total", "Failed accept() calls.", "counter");
+    append_value(out, "webserver_accept_errors_total", accept_errors);
+    append_header(out, "webserver_busy_rejections_total", "Connections refused because the connection table was full.", "counter");
+    append_value(out, "webserver_busy_rejections_total", busy_rejects);
+    append_header(out, "webserver_shed_requests_total", "Requests answered with 503 by admission control without being queued.", "counter");
+    append_value(out, "webserver_shed_requests_total", shed);
+
+    // 各阶段耗时按summary输出，分位数是从启动开始的累计值
+    histogram_snapshot *snaps = new histogram_snapshot[STAGE_NUM];
+    collect_stages(snaps);
+    append_header(out, "webserver_stage_latency_seconds", "Time spent in each request stage.", "summary");
+    static const double quantiles[] = {0.5, 0.99, 0.999};
+    for (int i = 0; i < STAGE_NUM; ++i)
+    {
+        char buf[160];
+        for (int j = 0; j < 3; ++j)
+        {
+            snprintf(buf, sizeof(buf), "webserver_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                     stage_names[i], quantiles[j], snaps[i].percentile(quantiles[j]) / 1e9);
+            out += buf;
+        }
+        snprintf(buf, sizeof(buf), "webserver_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[i], snaps[i].sum / 1e9);
+        out += buf;
+        snprintf(buf, sizeof(buf), "webserver_stage_latency_seconds_count{stage=\"%s\"} %llu\n", stage_names[i], (unsigned long long)snaps[i].total);
+        out += buf;
+    }
+    delete[] snaps;
+
+    string last;
+    for (size_t i = 0; i < m_gauges.size(); ++i)
+    {
+        const gauge &g = m_gauges[i];
+        string base = g.name.substr(0, g.name.find('{'));
+        if (base != last)
+        {
+            append_header(out, base.c_str(), g.help.c_str(), g.type);
+            last = base;
+        }
+        char buf[32];
+        snprintf(buf, sizeof(buf), " %lld\n", g.fn(g.arg));
+        out += g.name;
+        out += buf;
+    }
+    m_mutex.unlock();
+}
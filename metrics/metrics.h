@@ -0,0 +1,123 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+#include "histogram.h"
+
+using namespace std;
+
+// 按状态码分别计数的请求，其余状态码计入最后一项
+const int METRICS_STATUS_CODES[] = {200, 400, 403, 404, 500, 503};
+const int METRICS_STATUS_NUM = sizeof(METRICS_STATUS_CODES) / sizeof(int) + 1;
+
+// 请求处理的各个阶段
+enum METRICS_STAGE
+{
+    STAGE_ACCEPT = 0, // accept到第一次读事件就绪，只统计连接上的第一个请求
+    STAGE_READ,       // read_once读取请求
+    STAGE_QUEUE,      // 放入线程池队列到工作线程取出
+    STAGE_PARSE,      // process_read解析请求
+    STAGE_HANDLER,    // do_request和process_write生成响应，包括查库和等待口令哈希
+    STAGE_SEND,       // 发送响应直到write完成
+    STAGE_TOTAL,      // 读事件就绪到write完成
+    STAGE_NUM
+};
+
+// 一个请求各阶段的时间点，单调时间ns，0表示没有经过该阶段
+struct stage_times
+{
+    uint64_t accept;
+    uint64_t ready;
+    uint64_t read_ns; // read_once累计耗时
+    uint64_t queued;
+    uint64_t dequeued;
+    uint64_t parsed;
+    uint64_t handled;
+    uint64_t done;
+};
+
+// 每个线程一份计数器，只有所属线程写，抓取时由抓取线程读
+// 按缓存行对齐，不同线程的计数器不会落在同一缓存行上
+struct alignas(64) thread_metrics
+{
+    std::atomic<uint64_t> requests[METRICS_STATUS_NUM];
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<uint64_t> accept_errors;
+    std::atomic<uint64_t> busy_rejects;
+    std::atomic<uint64_t> shed;  // 准入控制直接回复503的请求
+    histogram stages[STAGE_NUM]; // 在完成请求的线程上记录
+    thread_metrics *next;
+};
+
+// 抓取时才读取的瞬时值，由各模块登记
+typedef long long (*metrics_gauge_fn)(void *arg);
+
+// 运行指标
+// 计数器按线程累加，热路径上没有锁和原子读改写；/metrics请求到来时汇总成Prometheus文本格式
+class metrics
+{
+public:
+    static metrics *get_instance()
+    {
+        static metrics instance;
+        return &instance;
+    }
+
+    // 只有本线程写，普通的读加写即可，不需要lock前缀的原子加
+    static void add(std::atomic<uint64_t> &c, uint64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void count_request(int status);
+    static void count_bytes_in(int n) { if (n > 0) add(local()->bytes_in, n); }
+    static void count_bytes_out(int n) { if (n > 0) add(local()->bytes_out, n); }
+    static void count_accept_error() { add(local()->accept_errors, 1); }
+    static void count_busy_reject() { add(local()->busy_rejects, 1); }
+    static void count_shed() { add(local()->shed, 1); }
+    // 请求完成时把各阶段耗时记入本线程的直方图
+    static void record_stages(const stage_times &t);
+
+    // 登记一个gauge，name可以带标签，如db_connections{state="free"}，同名不同标签的连续登记共用HELP
+    void add_gauge(const char *name, const char *help, metrics_gauge_fn fn, void *arg);
+    // 登记一个由其他模块维护、只增不减的计数器，同样在抓取时读取，name以_total结尾
+    void add_counter(const char *name, const char *help, metrics_gauge_fn fn, void *arg);
+    // 汇总所有线程的计数器和gauge，输出Prometheus文本格式
+    void render(string &out);
+    // 各阶段p50/p99/p999的可读文本，收到SIGUSR1时写入日志
+    void dump_latency(string &out);
+
+private:
+    metrics();
+    ~metrics();
+    static thread_metrics *local()
+    {
+        static thread_local thread_metrics *t = NULL;
+        if (!t)
+            t = get_instance()->register_thread();
+        return t;
+    }
+    thread_metrics *register_thread();
+    void collect_stages(histogram_snapshot *snaps);
+    void add_reading(const char *name, const char *help, const char *type, metrics_gauge_fn fn, void *arg);
+
+private:
+    struct gauge
+    {
+        string name;
+        string help;
+        const char *type;  // gauge或counter
+        metrics_gauge_fn fn;
+        void *arg;
+    };
+
+    thread_metrics *m_threads; // 所有线程的计数器，只增不删
+    locker m_mutex;            // 保护线程登记和gauge表
+    vector<gauge> m_gauges;
+};
+
+#endif
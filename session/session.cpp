@@ -0,0 +1,144 @@
+#include "session.h"
+#include "../crypto/scrypt.h"
+
+using namespace std;
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+int session_store::shard_of(const session_key &key)
+{
+    return ((hex_value(key.id[0]) << 4) | hex_value(key.id[1])) % SESSION_SHARDS;
+}
+
+bool session_store::to_key(const char *sid, int len, session_key &key)
+{
+    if (len != SESSION_ID_LEN)
+        return false;
+    for (int i = 0; i < SESSION_ID_LEN; ++i)
+    {
+        if (hex_value(sid[i]) < 0)
+            return false;
+        key.id[i] = sid[i];
+    }
+    return true;
+}
+
+bool session_store::create(const char *user, char *sid)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned char raw[SESSION_ID_LEN / 2];
+    if (!random_bytes(raw, sizeof(raw)))
+        return false;
+
+    session_key key;
+    for (int i = 0; i < SESSION_ID_LEN / 2; ++i)
+    {
+        key.id[i * 2] = digits[raw[i] >> 4];
+        key.id[i * 2 + 1] = digits[raw[i] & 0xf];
+    }
+    session_info info;
+    strncpy(info.user, user, SESSION_USER_LEN - 1);
+    info.user[SESSION_USER_LEN - 1] = '\0';
+    info.expire = time(NULL) + SESSION_TTL;
+    expiry_entry entry = {info.expire, key};
+
+    shard &s = m_shards[shard_of(key)];
+    s.lock.lock();
+    // 分片已满时淘汰最早创建的会话，队列中已删除的会话直接跳过
+    while ((int)s.sessions.size() >= SESSION_SHARD_MAX && !s.expiry.empty())
+    {
+        s.sessions.erase(s.expiry.front().key);
+        s.expiry.pop_front();
+    }
+    s.sessions[key] = info;
+    s.expiry.push_back(entry);
+    s.lock.unlock();
+
+    memcpy(sid, key.id, SESSION_ID_LEN);
+    sid[SESSION_ID_LEN] = '\0';
+    return true;
+}
+
+bool session_store::validate(const char *sid, int len)
+{
+    session_key key;
+    if (!to_key(sid, len, key))
+        return false;
+
+    time_t now = time(NULL);
+    bool valid = false;
+    shard &s = m_shards[shard_of(key)];
+    s.lock.lock();
+    unordered_map<session_key, session_info, session_key_hash>::iterator it = s.sessions.find(key);
+    if (it != s.sessions.end())
+    {
+        // 过期的会话留给tick统一清理
+        if (it->second.expire > now)
+        {
+            it->second.expire = now + SESSION_TTL;
+            valid = true;
+        }
+    }
+    s.lock.unlock();
+    return valid;
+}
+
+int session_store::expire_shard(shard &s, time_t now)
+{
+    int expired = 0;
+    while (!s.expiry.empty() && s.expiry.front().expire <= now)
+    {
+        expiry_entry entry = s.expiry.front();
+        s.expiry.pop_front();
+        unordered_map<session_key, session_info, session_key_hash>::iterator it = s.sessions.find(entry.key);
+        // 已被淘汰的会话
+        if (it == s.sessions.end())
+            continue;
+        if (it->second.expire <= now)
+        {
+            s.sessions.erase(it);
+            ++expired;
+        }
+        // 入队后被访问过，按顺延后的过期时间排到队尾
+        else
+        {
+            entry.expire = it->second.expire;
+            s.expiry.push_back(entry);
+        }
+    }
+    return expired;
+}
+
+int session_store::tick()
+{
+    time_t now = time(NULL);
+    int expired = 0;
+    // 逐个分片加锁清理，同一时刻只阻塞一个分片上的请求
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        expired += expire_shard(s, now);
+        s.lock.unlock();
+    }
+    return expired;
+}
+
+int session_store::size()
+{
+    int n = 0;
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        n += m_shards[i].sessions.size();
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
@@ -0,0 +1,102 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <time.h>
+#include <string.h>
+#include <unordered_map>
+#include <deque>
+#include "../lock/locker.h"
+
+// 会话id为16字节随机数的十六进制串
+const int SESSION_ID_LEN = 32;
+// 分片数，不同分片的锁互不影响
+const int SESSION_SHARDS = 16;
+const int SESSION_USER_LEN = 100;
+// 会话空闲多久后过期，单位秒
+const int SESSION_TTL = 1800;
+// 每个分片的会话上限，满了淘汰最早创建的会话
+const int SESSION_SHARD_MAX = 4096;
+
+// 定长的会话id，查找时在栈上构造，不需要申请内存
+struct session_key
+{
+    char id[SESSION_ID_LEN];
+    bool operator==(const session_key &other) const
+    {
+        return memcmp(id, other.id, SESSION_ID_LEN) == 0;
+    }
+};
+
+struct session_key_hash
+{
+    size_t operator()(const session_key &key) const
+    {
+        // FNV-1a
+        size_t h = 14695981039346656037ULL;
+        for (int i = 0; i < SESSION_ID_LEN; ++i)
+        {
+            h ^= (unsigned char)key.id[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+};
+
+struct session_info
+{
+    char user[SESSION_USER_LEN]; // 登录的用户名
+    time_t expire;               // 过期时间，每次访问后顺延
+};
+
+// 登录会话表
+// 登录成功后生成随机会话id写入cookie，之后的请求凭cookie访问，不再查询口令
+class session_store
+{
+public:
+    static session_store *get_instance()
+    {
+        static session_store instance;
+        return &instance;
+    }
+
+    // 为用户创建会话，sid至少SESSION_ID_LEN + 1字节
+    bool create(const char *user, char *sid);
+    // 校验会话id，有效时顺延过期时间
+    bool validate(const char *sid, int len);
+    // 清理过期会话，由定时器周期性调用，返回清理的数量
+    // 只检查各分片过期队列的队首，代价与到期的会话数成正比，与会话总数无关
+    int tick();
+    int size();
+    int ttl() { return SESSION_TTL; }
+
+private:
+    session_store() {}
+    ~session_store() {}
+
+    // 由会话id得到分片，id本身是随机数，直接取前两个十六进制字符
+    int shard_of(const session_key &key);
+    // 校验并拷贝会话id，长度不对或含非十六进制字符时返回false
+    bool to_key(const char *sid, int len, session_key &key);
+
+private:
+    struct expiry_entry
+    {
+        time_t expire; // 入队时的过期时间
+        session_key key;
+    };
+
+    struct shard
+    {
+        locker lock;
+        std::unordered_map<session_key, session_info, session_key_hash> sessions;
+        // 按创建顺序排列，每个会话一项；访问顺延过期时间时不动队列，到队首时再按实际过期时间重新入队
+        std::deque<expiry_entry> expiry;
+    } __attribute__((aligned(64)));
+
+    // 清理分片中已过期的会话，调用方持有分片锁
+    int expire_shard(shard &s, time_t now);
+
+    shard m_shards[SESSION_SHARDS];
+};
+
+#endif
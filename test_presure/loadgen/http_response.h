@@ -0,0 +1,39 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// 解析一个完整的响应，返回其长度；不完整返回0，格式错误返回-1
+// loadgen和replay共用
+static inline long parse_response(const char *p, size_t n, int &status, bool &close)
+{
+    const char *end = (const char *)memmem(p, n, "\r\n\r\n", 4);
+    if (end == NULL)
+        return n > 65536 ? -1 : 0;
+    if (n < 12 || strncmp(p, "HTTP/1.", 7) != 0)
+        return -1;
+    status = atoi(p + 9);
+    close = false;
+    long content_length = 0;
+    const char *line = (const char *)memchr(p, '\n', end + 2 - p) + 1;
+    while (line < end)
+    {
+        const char *next = (const char *)memchr(line, '\n', end + 2 - line);
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            content_length = atol(line + 15);
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+        {
+            const char *v = line + 11;
+            while (*v == ' ' || *v == '\t')
+                ++v;
+            close = strncasecmp(v, "close", 5) == 0;
+        }
+        line = next + 1;
+    }
+    long total = (end + 4 - p) + content_length;
+    return (size_t)total <= n ? total : 0;
+}
+
+#endif
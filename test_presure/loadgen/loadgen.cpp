@@ -0,0 +1,614 @@
+/*************************************************************
+ * 压力测试工具：多线程epoll，长连接，可配置流水线深度
+ * 闭环模式下每个连接收到响应后立即发下一个请求；
+ * 开环模式(-R)按固定速率排定请求，延迟从计划发送时刻算起，避免协调遗漏(coordinated omission)
+ * 用法见test_presure/README.md
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include "../../metrics/histogram.h"
+#include "../../timer/clock.h"
+#include "http_response.h"
+
+using namespace std;
+
+enum WORKLOAD
+{
+    WL_GET = 0,
+    WL_LOGIN,
+    WL_REGISTER
+};
+
+struct options
+{
+    char host[256];
+    char port[16];
+    char path[1024];
+    int threads;
+    int connections;
+    int depth;          // 每个连接最多同时发出的请求数
+    int duration;       // 秒
+    long rate;          // 每秒请求数，0为闭环
+    int timeout_ms;     // 请求超时，超时的连接关闭重连
+    int workload;
+    char user[64];
+    char passwd[64];
+};
+
+static options opt;
+static struct sockaddr_storage server_addr;
+static socklen_t server_addr_len;
+
+// 每个线程的统计，线程结束后汇总
+struct thread_stats
+{
+    uint64_t completed;
+    uint64_t status[6];     // 按状态码百位计数，0为无法解析
+    uint64_t bytes_in;
+    uint64_t connect_errors;
+    uint64_t read_errors;
+    uint64_t timeouts;
+    uint64_t max_backlog;   // 开环模式下排队未发出的最大请求数
+    uint64_t unanswered;    // 连接断开或压测结束时仍未收到响应的请求
+};
+
+struct connection
+{
+    int fd;
+    bool connecting;
+    uint64_t retry_at;              // 连接失败后的重试时刻
+    string out;                     // 待发送的数据
+    size_t out_pos;
+    string in;                      // 已收到未解析的数据
+    size_t in_pos;
+    deque<uint64_t> starts;         // 已发出请求的开始时刻，开环为计划时刻
+};
+
+struct worker
+{
+    int id;
+    pthread_t tid;
+    int epollfd;
+    int conn_num;
+    long rate;
+    uint64_t seq;                   // register请求的用户名序号
+    vector<connection> conns;
+    deque<uint64_t> backlog;        // 到了计划时刻还没有连接可发的请求
+    histogram latency;
+    thread_stats stats;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] http://host:port/path\n"
+            "  -t threads       工作线程数，默认2\n"
+            "  -c connections   总连接数，默认100\n"
+            "  -p depth         每个连接的流水线深度，默认1\n"
+            "  -d seconds       测试时长，默认10\n"
+            "  -R rate          开环模式总请求速率(次/秒)，默认0为闭环\n"
+            "  -T ms            请求超时，默认2000\n"
+            "  -w workload      get/login/register，默认get\n"
+            "  -a user:passwd   login使用的账号，默认bench:bench\n",
+            prog);
+    exit(1);
+}
+
+static bool parse_url(const char *url)
+{
+    if (strncasecmp(url, "http://", 7) != 0)
+        return false;
+    url += 7;
+    const char *slash = strchr(url, '/');
+    size_t hostlen = slash ? (size_t)(slash - url) : strlen(url);
+    if (hostlen == 0 || hostlen >= sizeof(opt.host))
+        return false;
+    memcpy(opt.host, url, hostlen);
+    opt.host[hostlen] = '\0';
+    snprintf(opt.path, sizeof(opt.path), "%s", slash ? slash : "/");
+    char *colon = strchr(opt.host, ':');
+    if (colon)
+    {
+        *colon = '\0';
+        snprintf(opt.port, sizeof(opt.port), "%s", colon + 1);
+    }
+    else
+        strcpy(opt.port, "80");
+    return true;
+}
+
+static bool resolve()
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int ret = getaddrinfo(opt.host, opt.port, &hints, &res);
+    if (ret != 0)
+    {
+        fprintf(stderr, "resolve %s:%s: %s\n", opt.host, opt.port, gai_strerror(ret));
+        return false;
+    }
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+// 生成一个请求追加到out
+static void build_request(worker *w, string &out)
+{
+    char body[256];
+    const char *path = opt.path;
+    int body_len = -1;
+    if (opt.workload == WL_LOGIN)
+    {
+        path = "/2CGISQL.cgi";
+        body_len = snprintf(body, sizeof(body), "user=%s&password=%s", opt.user, opt.passwd);
+    }
+    else if (opt.workload == WL_REGISTER)
+    {
+        // 每次注册一个新用户，进程号区分多次运行
+        path = "/3CGISQL.cgi";
+        body_len = snprintf(body, sizeof(body), "user=lg%d_%d_%llu&password=%s",
+                            (int)getpid(), w->id, (unsigned long long)w->seq++, opt.passwd);
+    }
+    char head[1536];
+    int n;
+    if (body_len < 0)
+        n = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: %s:%s\r\nConnection: keep-alive\r\n\r\n",
+                     path, opt.host, opt.port);
+    else
+        n = snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: %s:%s\r\nConnection: keep-alive\r\n"
+                     "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n",
+                     path, opt.host, opt.port, body_len);
+    out.append(head, n);
+    if (body_len > 0)
+        out.append(body, body_len);
+}
+
+// 丢弃未收到响应的请求时，按截至now的等待时间记入延迟并计数，
+// 否则服务器越慢、断开越多，延迟反而越好看
+static void drop_pending(worker *w, deque<uint64_t> &starts, uint64_t now)
+{
+    for (size_t i = 0; i < starts.size(); ++i)
+        w->latency.record(now > starts[i] ? now - starts[i] : 0);
+    w->stats.unanswered += starts.size();
+    starts.clear();
+}
+
+static void close_conn(worker *w, connection &c, uint64_t now)
+{
+    if (c.fd >= 0)
+    {
+        epoll_ctl(w->epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+    }
+    c.fd = -1;
+    c.connecting = false;
+    c.out.clear();
+    c.out_pos = 0;
+    c.in.clear();
+    c.in_pos = 0;
+    drop_pending(w, c.starts, now);
+}
+
+static void open_conn(worker *w, int idx, uint64_t now)
+{
+    connection &c = w->conns[idx];
+    int fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        ++w->stats.connect_errors;
+        c.retry_at = now + 100000000ull;
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(fd, (struct sockaddr *)&server_addr, server_addr_len);
+    if (ret < 0 && errno != EINPROGRESS)
+    {
+        ++w->stats.connect_errors;
+        close(fd);
+        c.retry_at = now + 100000000ull;
+        return;
+    }
+    c.fd = fd;
+    c.connecting = ret < 0;
+    struct epoll_event ev;
+    ev.data.u32 = idx;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    epoll_ctl(w->epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// 尽量把out写完，写不完等EPOLLOUT
+static bool flush_conn(worker *w, int idx)
+{
+    connection &c = w->conns[idx];
+    while (c.out_pos < c.out.size())
+    {
+        ssize_t n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN)
+                break;
+            return false;
+        }
+        c.out_pos += n;
+    }
+    struct epoll_event ev;
+    ev.data.u32 = idx;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (c.out_pos < c.out.size())
+        ev.events |= EPOLLOUT;
+    else
+    {
+        c.out.clear();
+        c.out_pos = 0;
+    }
+    epoll_ctl(w->epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+    return true;
+}
+
+// 在连接上发出一个请求，start为延迟起点
+static void send_request(worker *w, int idx, uint64_t start)
+{
+    connection &c = w->conns[idx];
+    build_request(w, c.out);
+    c.starts.push_back(start);
+}
+
+// 读取并处理所有完整响应，返回false表示连接需要关闭
+static bool read_conn(worker *w, int idx, uint64_t &now)
+{
+    connection &c = w->conns[idx];
+    char buf[65536];
+    bool eof = false;
+    while (true)
+    {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n < 0)
+        {
+            if (errno == EAGAIN)
+                break;
+            ++w->stats.read_errors;
+            return false;
+        }
+        if (n == 0)
+        {
+            // 响应和FIN可能在同一轮读到(如带Connection: close的503)，先处理已收到的响应
+            eof = true;
+            break;
+        }
+        w->stats.bytes_in += n;
+        c.in.append(buf, n);
+    }
+    now = monotonic_ns();
+    while (c.in_pos < c.in.size())
+    {
+        int status = 0;
+        bool close_after = false;
+        long len = parse_response(c.in.data() + c.in_pos, c.in.size() - c.in_pos, status, close_after);
+        if (len == 0)
+            break;
+        if (len < 0 || c.starts.empty())
+        {
+            ++w->stats.read_errors;
+            return false;
+        }
+        c.in_pos += len;
+        w->latency.record(now - c.starts.front());
+        c.starts.pop_front();
+        ++w->stats.completed;
+        ++w->stats.status[status >= 100 && status < 600 ? status / 100 : 0];
+        if (close_after)
+            return false;
+    }
+    if (eof)
+    {
+        // 还有请求没收到响应就被关闭才算错误
+        if (!c.starts.empty())
+            ++w->stats.read_errors;
+        return false;
+    }
+    if (c.in_pos == c.in.size())
+    {
+        c.in.clear();
+        c.in_pos = 0;
+    }
+    else if (c.in_pos > sizeof(buf))
+    {
+        c.in.erase(0, c.in_pos);
+        c.in_pos = 0;
+    }
+    return true;
+}
+
+static void *worker_main(void *arg)
+{
+    worker *w = (worker *)arg;
+    w->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    w->conns.resize(w->conn_num);
+    uint64_t now = monotonic_ns();
+    uint64_t end = now + (uint64_t)opt.duration * 1000000000ull;
+    uint64_t timeout_ns = (uint64_t)opt.timeout_ms * 1000000ull;
+    for (int i = 0; i < w->conn_num; ++i)
+    {
+        w->conns[i].fd = -1;
+        w->conns[i].connecting = false;
+        w->conns[i].retry_at = 0;
+        w->conns[i].out_pos = 0;
+        w->conns[i].in_pos = 0;
+        open_conn(w, i, now);
+    }
+    // 开环模式的请求间隔，各线程错开起点
+    uint64_t interval = w->rate > 0 ? 1000000000ull / w->rate : 0;
+    uint64_t next_send = now + (interval ? interval * w->id / opt.threads : 0);
+    vector<struct epoll_event> events(w->conn_num + 1);
+    uint64_t last_sweep = now;
+
+    while (now < end)
+    {
+        // 到了计划时刻的请求先进入积压队列，不管有没有连接可用
+        if (interval)
+        {
+            while (next_send <= now && next_send < end)
+            {
+                w->backlog.push_back(next_send);
+                next_send += interval;
+            }
+            if (w->backlog.size() > w->stats.max_backlog)
+                w->stats.max_backlog = w->backlog.size();
+        }
+        for (int i = 0; i < w->conn_num; ++i)
+        {
+            connection &c = w->conns[i];
+            if (c.fd < 0)
+            {
+                if (now >= c.retry_at)
+                    open_conn(w, i, now);
+                continue;
+            }
+            if (c.connecting)
+                continue;
+            bool added = false;
+            while ((int)c.starts.size() < opt.depth)
+            {
+                if (interval)
+                {
+                    if (w->backlog.empty())
+                        break;
+                    send_request(w, i, w->backlog.front());
+                    w->backlog.pop_front();
+                }
+                else
+                    send_request(w, i, now);
+                added = true;
+            }
+            if (added && !flush_conn(w, i))
+            {
+                ++w->stats.read_errors;
+                close_conn(w, c, now);
+            }
+        }
+
+        int wait_ms = 10;
+        if (interval && next_send > now)
+        {
+            uint64_t ms = (next_send - now) / 1000000;
+            wait_ms = ms < (uint64_t)wait_ms ? (int)ms : wait_ms;
+        }
+        int n = epoll_wait(w->epollfd, events.data(), events.size(), wait_ms);
+        now = monotonic_ns();
+        for (int k = 0; k < n; ++k)
+        {
+            int idx = events[k].data.u32;
+            connection &c = w->conns[idx];
+            if (c.fd < 0)
+                continue;
+            if (c.connecting)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || (events[k].events & (EPOLLERR | EPOLLHUP)))
+                {
+                    ++w->stats.connect_errors;
+                    close_conn(w, c, now);
+                    c.retry_at = now + 100000000ull;
+                    continue;
+                }
+                c.connecting = false;
+                flush_conn(w, idx);
+                continue;
+            }
+            if ((events[k].events & EPOLLOUT) && !flush_conn(w, idx))
+            {
+                ++w->stats.read_errors;
+                close_conn(w, c, now);
+                continue;
+            }
+            if ((events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) && !read_conn(w, idx, now))
+                close_conn(w, c, now);
+        }
+
+        // 每10ms检查一次超时
+        if (now - last_sweep >= 10000000ull)
+        {
+            last_sweep = now;
+            for (int i = 0; i < w->conn_num; ++i)
+            {
+                connection &c = w->conns[i];
+                if (c.fd >= 0 && !c.starts.empty() && now - c.starts.front() > timeout_ns)
+                {
+                    w->stats.timeouts += c.starts.size();
+                    close_conn(w, c, now);
+                }
+            }
+        }
+    }
+    // 结束时还在积压队列或在途的请求同样计入，开环模式下从计划时刻算到结束
+    now = monotonic_ns();
+    drop_pending(w, w->backlog, now);
+    for (int i = 0; i < w->conn_num; ++i)
+        close_conn(w, w->conns[i], now);
+    close(w->epollfd);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    memset(&opt, 0, sizeof(opt));
+    opt.threads = 2;
+    opt.connections = 100;
+    opt.depth = 1;
+    opt.duration = 10;
+    opt.timeout_ms = 2000;
+    opt.workload = WL_GET;
+    strcpy(opt.user, "bench");
+    strcpy(opt.passwd, "bench");
+
+    int c;
+    const char *str = "t:c:p:d:R:T:w:a:";
+    while ((c = getopt(argc, argv, str)) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            opt.threads = atoi(optarg);
+            break;
+        case 'c':
+            opt.connections = atoi(optarg);
+            break;
+        case 'p':
+            opt.depth = atoi(optarg);
+            break;
+        case 'd':
+            opt.duration = atoi(optarg);
+            break;
+        case 'R':
+            opt.rate = atol(optarg);
+            break;
+        case 'T':
+            opt.timeout_ms = atoi(optarg);
+            break;
+        case 'w':
+            if (strcmp(optarg, "get") == 0)
+                opt.workload = WL_GET;
+            else if (strcmp(optarg, "login") == 0)
+                opt.workload = WL_LOGIN;
+            else if (strcmp(optarg, "register") == 0)
+                opt.workload = WL_REGISTER;
+            else
+                usage(argv[0]);
+            break;
+        case 'a':
+        {
+            const char *colon = strchr(optarg, ':');
+            if (colon == NULL)
+                usage(argv[0]);
+            snprintf(opt.user, sizeof(opt.user), "%.*s", (int)(colon - optarg), optarg);
+            snprintf(opt.passwd, sizeof(opt.passwd), "%s", colon + 1);
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || !parse_url(argv[optind]))
+        usage(argv[0]);
+    if (opt.threads < 1 || opt.connections < opt.threads || opt.depth < 1 || opt.duration < 1 || opt.timeout_ms < 1)
+        usage(argv[0]);
+    if (opt.rate > 0 && opt.rate < opt.threads)
+        opt.rate = opt.threads;
+    if (!resolve())
+        return 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *names[] = {"get", "login", "register"};
+    printf("target %s:%s%s, workload %s, %d threads, %d connections, pipeline %d, %d s, ",
+           opt.host, opt.port, opt.workload == WL_GET ? opt.path : "", names[opt.workload],
+           opt.threads, opt.connections, opt.depth, opt.duration);
+    if (opt.rate > 0)
+        printf("open loop %ld req/s\n", opt.rate);
+    else
+        printf("closed loop\n");
+    fflush(stdout);
+
+    vector<worker *> workers(opt.threads);
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker *w = new worker;
+        w->id = i;
+        w->seq = 0;
+        // 连接数和速率平均分给各线程，余数给前面的线程
+        w->conn_num = opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0);
+        w->rate = opt.rate / opt.threads + (i < opt.rate % opt.threads ? 1 : 0);
+        w->latency.clear();
+        memset(&w->stats, 0, sizeof(w->stats));
+        workers[i] = w;
+        if (pthread_create(&w->tid, NULL, worker_main, w) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+
+    histogram_snapshot *lat = new histogram_snapshot;
+    thread_stats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker *w = workers[i];
+        pthread_join(w->tid, NULL);
+        lat->add(w->latency);
+        total.completed += w->stats.completed;
+        for (int s = 0; s < 6; ++s)
+            total.status[s] += w->stats.status[s];
+        total.bytes_in += w->stats.bytes_in;
+        total.connect_errors += w->stats.connect_errors;
+        total.read_errors += w->stats.read_errors;
+        total.timeouts += w->stats.timeouts;
+        total.max_backlog += w->stats.max_backlog;
+        total.unanswered += w->stats.unanswered;
+        delete w;
+    }
+    double secs = (monotonic_ns() - start) / 1e9;
+
+    printf("requests %llu in %.2f s, %.1f req/s, %.2f MB/s\n",
+           (unsigned long long)total.completed, secs, total.completed / secs, total.bytes_in / secs / 1048576.0);
+    printf("status 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+           (unsigned long long)total.status[2], (unsigned long long)total.status[3],
+           (unsigned long long)total.status[4], (unsigned long long)total.status[5],
+           (unsigned long long)(total.status[0] + total.status[1]));
+    printf("errors connect %llu, read %llu, timeout %llu\n",
+           (unsigned long long)total.connect_errors, (unsigned long long)total.read_errors,
+           (unsigned long long)total.timeouts);
+    if (opt.rate > 0)
+        printf("backlog max %llu requests\n", (unsigned long long)total.max_backlog);
+    printf("unanswered %llu requests (included in latency up to drop or end of run)\n",
+           (unsigned long long)total.unanswered);
+    printf("latency(us)  mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  p99.99 %.1f  max %.1f\n",
+           lat->total ? lat->sum / 1000.0 / lat->total : 0.0,
+           lat->percentile(0.5) / 1000.0, lat->percentile(0.9) / 1000.0, lat->percentile(0.99) / 1000.0,
+           lat->percentile(0.999) / 1000.0, lat->percentile(0.9999) / 1000.0, lat->max / 1000.0);
+    delete lat;
+    return total.completed ? 0 : 1;
+}
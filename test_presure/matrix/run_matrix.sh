@@ -0,0 +1,117 @@
+#!/bin/bash
+# 在本机依次以不同并发模型、触发模式、线程数启动server_standin，用loadgen跑固定的负载组合，
+# 记录吞吐、p99、服务器CPU占用和内存，输出CSV和Markdown报告
+# 用法: test_presure/matrix/run_matrix.sh，参数通过环境变量调整，见test_presure/README.md
+
+ACTORS=${ACTORS:-"0 1"}
+TRIGS=${TRIGS:-"0 1 2 3"}
+THREADS=${THREADS:-"4 8"}
+SQLS=${SQLS:-"8"}
+WORKLOADS=${WORKLOADS:-"small large login register"}
+DURATION=${DURATION:-10}
+WARMUP=${WARMUP:-2}
+CONNS=${CONNS:-100}
+LG_THREADS=${LG_THREADS:-2}
+TIMEOUT_MS=${TIMEOUT_MS:-10000}
+PORT=${PORT:-9200}
+SERVER=${SERVER:-}
+
+cd "$(dirname "$0")/../.." || exit 1
+ROOT=$(pwd)
+OUT_DIR=${OUT_DIR:-$ROOT/test_presure/matrix/results}
+LOADGEN=$ROOT/test_presure/loadgen/loadgen
+
+# 默认用makefile编译server_standin；SERVER可以指定其他构建，如CMake的Release或PGO版本，对比编译选项的效果
+if [ -z "$SERVER" ]; then
+    make -s server_standin || exit 1
+    SERVER=./server_standin
+fi
+make -s -C test_presure/loadgen || exit 1
+mkdir -p "$OUT_DIR"
+STAMP=$(date +%Y%m%d_%H%M%S)
+CSV=$OUT_DIR/matrix_$STAMP.csv
+MD=$OUT_DIR/matrix_$STAMP.md
+HZ=$(getconf CLK_TCK)
+
+# 每种负载的loadgen参数；登录用替身数据库预置的用户，注册每次都是新用户
+workload_args()
+{
+    case $1 in
+    small) echo "-c $CONNS http://127.0.0.1:$PORT/judge.html" ;;
+    large) echo "-c $CONNS http://127.0.0.1:$PORT/frame.jpg" ;;
+    login) echo "-c $CONNS -w login -a user1:passwd1 http://127.0.0.1:$PORT/" ;;
+    register) echo "-c $CONNS -w register http://127.0.0.1:$PORT/" ;;
+    esac
+}
+
+# 进程累计的用户态加内核态CPU时间，单位时钟滴答
+cpu_ticks()
+{
+    awk '{ print $14 + $15 }' /proc/$1/stat
+}
+
+wait_port()
+{
+    for i in $(seq 1 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+echo "actor,trig,threads,sql,workload,req_per_sec,mb_per_sec,p50_us,p99_us,non_2xx,errors,cpu_pct,rss_kb,peak_rss_kb" > "$CSV"
+{
+    echo "# 压测矩阵 $STAMP"
+    echo
+    echo "$SERVER, $(uname -srm), $(nproc) CPU, 每项${DURATION}s, $CONNS 连接, loadgen $LG_THREADS 线程"
+    echo
+    echo "| actor | trig | threads | sql | workload | req/s | MB/s | p50(us) | p99(us) | 非2xx | 错误 | CPU% | RSS(KB) | 峰值RSS(KB) |"
+    echo "| --- | --- | --- | --- | --- | ---: | ---: | ---: | ---: | ---: | ---: | ---: | ---: | ---: |"
+} > "$MD"
+
+for actor in $ACTORS; do
+for trig in $TRIGS; do
+for threads in $THREADS; do
+for sql in $SQLS; do
+    $SERVER -p $PORT -a $actor -m $trig -t $threads -s $sql -c 1 > /dev/null 2>&1 &
+    pid=$!
+    if ! wait_port; then
+        echo "server failed to start: -a $actor -m $trig -t $threads -s $sql" >&2
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null
+        continue
+    fi
+    for wl in $WORKLOADS; do
+        args=$(workload_args $wl)
+        [ "$WARMUP" -gt 0 ] && $LOADGEN -t $LG_THREADS -T $TIMEOUT_MS -d $WARMUP $args > /dev/null
+        before=$(cpu_ticks $pid)
+        out=$($LOADGEN -t $LG_THREADS -T $TIMEOUT_MS -d $DURATION $args)
+        if ! kill -0 $pid 2>/dev/null; then
+            # 服务器在压测中退出，记录下来继续下一个配置
+            echo "$actor,$trig,$threads,$sql,$wl,crashed,,,,,,,," >> "$CSV"
+            echo "| $actor | $trig | $threads | $sql | $wl | 服务器退出 | | | | | | | | |" >> "$MD"
+            echo "server exited: -a $actor -m $trig -t $threads -s $sql $wl" >&2
+            break
+        fi
+        after=$(cpu_ticks $pid)
+        line=$(echo "$out" | awk -v cpu=$((after - before)) -v hz=$HZ -v d=$DURATION '
+            /^requests/ { rps = $6; mbps = $8 }
+            /^status/ { gsub(",", ""); non2xx = $5 + $7 + $9 + $11 }
+            /^errors/ { gsub(",", ""); errors = $3 + $5 + $7 }
+            /^latency/ { p50 = $5; p99 = $9 }
+            END { printf "%s,%s,%s,%s,%d,%d,%.1f", rps, mbps, p50, p99, non2xx, errors, cpu * 100 / hz / d }')
+        rss=$(awk '/^VmRSS/ { print $2 }' /proc/$pid/status)
+        hwm=$(awk '/^VmHWM/ { print $2 }' /proc/$pid/status)
+        echo "$actor,$trig,$threads,$sql,$wl,$line,$rss,$hwm" >> "$CSV"
+        echo "| $actor | $trig | $threads | $sql | $wl | $(echo "$line" | sed 's/,/ | /g') | $rss | $hwm |" >> "$MD"
+        echo "-a $actor -m $trig -t $threads -s $sql $wl: $line,$rss,$hwm"
+    done
+    kill $pid 2>/dev/null
+    wait $pid 2>/dev/null
+done
+done
+done
+done
+
+echo "report: $CSV"
+echo "        $MD"
@@ -0,0 +1,56 @@
+#!/bin/bash
+# 两阶段PGO构建：先编译插桩版本，用loadgen对root/下的页面和登录注册跑一遍训练负载，
+# 服务器正常退出时写出.gcda，再在同一个构建目录中用这些数据重新编译
+# 用法: test_presure/pgo/pgo.sh，生成的服务器为$BUILD_DIR/server，参数见test_presure/README.md
+
+BUILD_DIR=${BUILD_DIR:-_pgo_build}
+TRAIN_SECONDS=${TRAIN_SECONDS:-5}
+CONNS=${CONNS:-100}
+PORT=${PORT:-9210}
+
+cd "$(dirname "$0")/../.." || exit 1
+ROOT=$(pwd)
+LOADGEN=$BUILD_DIR/loadgen
+
+cmake -S . -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DTWS_PGO=GEN "$@" > /dev/null || exit 1
+cmake --build "$BUILD_DIR" -j"$(nproc)" || exit 1
+# 清掉上次训练留下的数据
+find "$BUILD_DIR" -name '*.gcda' -delete
+
+wait_port()
+{
+    for i in $(seq 1 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# proactor+LT和reactor+ET各训练一轮，两种模式的代码路径都有剖析数据
+for mode in "-a 0 -m 0" "-a 1 -m 3"; do
+    $BUILD_DIR/server -p $PORT $mode -t 8 -c 1 > /dev/null 2>&1 &
+    pid=$!
+    if ! wait_port; then
+        echo "server failed to start: $mode" >&2
+        kill $pid 2>/dev/null
+        exit 1
+    fi
+    # 口令哈希很慢，登录注册用少量连接，放在前面跑，后面的负载期间哈希队列清空
+    for args in "-c 8 -w login -a user1:passwd1 http://127.0.0.1:$PORT/" "-c 8 -w register http://127.0.0.1:$PORT/" \
+                "-c $CONNS http://127.0.0.1:$PORT/judge.html" "-c $CONNS http://127.0.0.1:$PORT/frame.jpg"; do
+        $LOADGEN -t 2 -T 10000 -d $TRAIN_SECONDS $args | sed -n 2p
+    done
+    # SIGTERM让服务器排空后退出事件循环，插桩构建随即写出.gcda
+    kill -TERM $pid
+    wait $pid 2>/dev/null || echo "server exited with status $?" >&2
+done
+
+n=$(find "$BUILD_DIR" -name '*.gcda' | wc -l)
+if [ "$n" -eq 0 ]; then
+    echo "no profile data written" >&2
+    exit 1
+fi
+echo "$n profile files, rebuilding with -fprofile-use"
+cmake -S . -B "$BUILD_DIR" -DTWS_PGO=USE > /dev/null || exit 1
+cmake --build "$BUILD_DIR" -j"$(nproc)" || exit 1
+echo "PGO server: $ROOT/$BUILD_DIR/server"
@@ -0,0 +1,917 @@
+/*************************************************************
+ * 流量重放工具：读取服务器-u捕获的Capture_xxx.bin，按原来的连接关系和时间间隔把请求字节重新发给服务器
+ * 同一连接上，一段数据要等捕获中排在它前面的响应都收到后才发出，保持客户端原来的因果顺序；
+ * 延迟从该段数据可以发出的时刻算起，另外统计实际发出时刻落后于计划时刻多少
+ * -i模式把JSON格式的访问日志(-x 2)转换成同样格式的捕获文件
+ * 用法见test_presure/README.md
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "../../trace/capture.h"
+#include "../../metrics/histogram.h"
+#include "../../timer/clock.h"
+#include "../loadgen/http_response.h"
+
+using namespace std;
+
+struct options
+{
+    char host[256];
+    char port[16];
+    int threads;
+    double speed;       // 重放速度倍数，0为不等待计划时刻
+    int timeout_ms;     // 响应超时，超时的连接放弃
+};
+
+static options opt;
+static struct sockaddr_storage server_addr;
+static socklen_t server_addr_len;
+static string trace;    // 整个捕获文件，DATA记录的数据直接指向这里
+
+struct event
+{
+    uint64_t t_ns;
+    uint16_t type;
+    uint16_t status;
+    uint32_t len;
+    size_t off;         // DATA数据在trace中的位置
+};
+
+struct pending
+{
+    uint64_t start;
+    int status;         // 捕获时的状态码，0为未知
+};
+
+// 捕获中的一个连接
+struct session
+{
+    uint32_t id;
+    vector<event> ev;
+    size_t next;        // 下一个要处理的事件
+    uint64_t wake;      // 下一个事件的计划时刻，等待网络时为0
+    int fd;
+    bool connecting;
+    bool done;
+    string out;
+    size_t out_pos;
+    string in;
+    size_t in_pos;
+    uint32_t expected;  // 已经过的RESP事件数
+    uint32_t received;  // 已收到的响应数
+    uint64_t caught_up; // 最近一次收齐所有响应的时刻
+    uint64_t last_start;
+    deque<pending> pend;
+};
+
+struct thread_stats
+{
+    uint64_t completed;
+    uint64_t status[6];
+    uint64_t mismatch;      // 状态码与捕获时不同
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint64_t connect_errors;
+    uint64_t read_errors;
+    uint64_t timeouts;
+    uint64_t aborted;       // 出错后放弃的连接
+};
+
+struct worker
+{
+    int id;
+    pthread_t tid;
+    int epollfd;
+    vector<session> sessions;
+    histogram latency;
+    histogram lag;
+    thread_stats stats;
+};
+
+static uint64_t t_first;    // 捕获中第一个事件的时间
+static uint64_t t_base;     // 重放开始的单调时间
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] Capture_xxx.bin http://host:port\n"
+            "  -t threads       工作线程数，默认2，连接按编号分给各线程\n"
+            "  -s speed         重放速度倍数，默认1，0为不按时间间隔尽快发送\n"
+            "  -T ms            响应超时，默认5000\n"
+            "       %s -i AccessLog -o out.bin [-P path] [-B body]\n"
+            "  -i file          把JSON格式的访问日志转换成捕获文件\n"
+            "  -P path          POST请求发往的路径，默认/2CGISQL.cgi\n"
+            "  -B body          POST请求的正文，默认user=user1&password=passwd1\n",
+            prog, prog);
+    exit(1);
+}
+
+static bool parse_url(const char *url)
+{
+    if (strncasecmp(url, "http://", 7) != 0)
+        return false;
+    url += 7;
+    const char *slash = strchr(url, '/');
+    size_t hostlen = slash ? (size_t)(slash - url) : strlen(url);
+    if (hostlen == 0 || hostlen >= sizeof(opt.host))
+        return false;
+    memcpy(opt.host, url, hostlen);
+    opt.host[hostlen] = '\0';
+    char *colon = strchr(opt.host, ':');
+    if (colon)
+    {
+        *colon = '\0';
+        snprintf(opt.port, sizeof(opt.port), "%s", colon + 1);
+    }
+    else
+        strcpy(opt.port, "80");
+    return true;
+}
+
+static bool resolve()
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int ret = getaddrinfo(opt.host, opt.port, &hints, &res);
+    if (ret != 0)
+    {
+        fprintf(stderr, "resolve %s:%s: %s\n", opt.host, opt.port, gai_strerror(ret));
+        return false;
+    }
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static bool read_file(const char *name, string &out)
+{
+    FILE *fp = fopen(name, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "open %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    fclose(fp);
+    return true;
+}
+
+// 把捕获文件拆成每个连接的事件序列
+static bool load_trace(const char *name, vector<session> &sessions)
+{
+    if (!read_file(name, trace))
+        return false;
+    if (trace.size() < sizeof(cap_file_header) || memcmp(trace.data(), CAP_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s: not a capture file\n", name);
+        return false;
+    }
+    map<uint32_t, size_t> index;
+    size_t pos = sizeof(cap_file_header);
+    bool first = true;
+    while (pos + sizeof(cap_record) <= trace.size())
+    {
+        cap_record r;
+        memcpy(&r, trace.data() + pos, sizeof(r));
+        if (pos + sizeof(r) + r.len > trace.size())
+            break;
+        event e;
+        e.t_ns = r.t_ns;
+        e.type = r.type;
+        e.status = r.status;
+        e.len = r.len;
+        e.off = pos + sizeof(r);
+        pos += sizeof(r) + r.len;
+        if (first)
+        {
+            t_first = r.t_ns;
+            first = false;
+        }
+        // 捕获写满时停在任意位置，没有OPEN的连接不完整，跳过
+        map<uint32_t, size_t>::iterator it = index.find(r.conn);
+        if (it == index.end())
+        {
+            if (r.type != CAP_OPEN)
+                continue;
+            it = index.insert(make_pair(r.conn, sessions.size())).first;
+            sessions.push_back(session());
+            sessions.back().id = r.conn;
+        }
+        sessions[it->second].ev.push_back(e);
+    }
+    if (pos != trace.size())
+        fprintf(stderr, "%s: truncated after %zu bytes\n", name, pos);
+    return true;
+}
+
+// 事件的计划时刻
+static uint64_t scheduled(const event &e)
+{
+    if (opt.speed <= 0)
+        return t_base;
+    return t_base + (uint64_t)((e.t_ns - t_first) / opt.speed);
+}
+
+static void close_session(worker *w, session &s)
+{
+    if (s.fd >= 0)
+    {
+        epoll_ctl(w->epollfd, EPOLL_CTL_DEL, s.fd, NULL);
+        close(s.fd);
+    }
+    s.fd = -1;
+    s.connecting = false;
+    s.done = true;
+    s.out.clear();
+    s.in.clear();
+}
+
+static void abort_session(worker *w, session &s)
+{
+    ++w->stats.aborted;
+    close_session(w, s);
+}
+
+static bool open_session(worker *w, int idx)
+{
+    session &s = w->sessions[idx];
+    int fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(fd, (struct sockaddr *)&server_addr, server_addr_len);
+    if (ret < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return false;
+    }
+    s.fd = fd;
+    s.connecting = true;
+    struct epoll_event ev;
+    ev.data.u32 = idx;
+    ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    epoll_ctl(w->epollfd, EPOLL_CTL_ADD, fd, &ev);
+    return true;
+}
+
+static bool flush_session(worker *w, int idx)
+{
+    session &s = w->sessions[idx];
+    while (s.out_pos < s.out.size())
+    {
+        ssize_t n = send(s.fd, s.out.data() + s.out_pos, s.out.size() - s.out_pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN)
+                break;
+            return false;
+        }
+        s.out_pos += n;
+        w->stats.bytes_out += n;
+    }
+    struct epoll_event ev;
+    ev.data.u32 = idx;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (s.out_pos < s.out.size())
+        ev.events |= EPOLLOUT;
+    else
+    {
+        s.out.clear();
+        s.out_pos = 0;
+    }
+    epoll_ctl(w->epollfd, EPOLL_CTL_MOD, s.fd, &ev);
+    return true;
+}
+
+// 按顺序处理连接上到期的事件，直到需要等待计划时刻或网络
+static void advance(worker *w, int idx, uint64_t now)
+{
+    session &s = w->sessions[idx];
+    bool added = false;
+    s.wake = 0;
+    while (!s.done && s.next < s.ev.size())
+    {
+        const event &e = s.ev[s.next];
+        uint64_t at = scheduled(e);
+        if (e.type != CAP_RESP && at > now)
+        {
+            s.wake = at;
+            break;
+        }
+        if (e.type == CAP_OPEN)
+        {
+            if (!open_session(w, idx))
+            {
+                ++w->stats.connect_errors;
+                abort_session(w, s);
+                return;
+            }
+        }
+        else if (e.type == CAP_DATA)
+        {
+            // 等连接建立，等前面的响应都收到
+            if (s.connecting || s.received < s.expected)
+                break;
+            if (s.fd < 0)
+            {
+                abort_session(w, s);
+                return;
+            }
+            s.out.append(trace.data() + e.off, e.len);
+            s.last_start = at > s.caught_up ? at : s.caught_up;
+            w->lag.record(now - at);
+            added = true;
+        }
+        else if (e.type == CAP_RESP)
+        {
+            pending p;
+            p.start = s.last_start;
+            p.status = e.status;
+            s.pend.push_back(p);
+            ++s.expected;
+        }
+        else if (e.type == CAP_CLOSE)
+        {
+            if (s.received < s.expected)
+                break;
+            close_session(w, s);
+            return;
+        }
+        ++s.next;
+    }
+    // 捕获在连接关闭前结束，收齐响应后关闭
+    if (!s.done && s.next == s.ev.size() && s.received >= s.expected)
+    {
+        close_session(w, s);
+        return;
+    }
+    if (added && !flush_session(w, idx))
+    {
+        ++w->stats.read_errors;
+        abort_session(w, s);
+    }
+}
+
+// 读取并处理所有完整响应，返回false表示连接已被关闭或出错
+static bool read_session(worker *w, int idx, uint64_t &now)
+{
+    session &s = w->sessions[idx];
+    char buf[65536];
+    bool peer_closed = false;
+    while (true)
+    {
+        ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+        if (n < 0)
+        {
+            if (errno == EAGAIN)
+                break;
+            peer_closed = true;
+            break;
+        }
+        if (n == 0)
+        {
+            peer_closed = true;
+            break;
+        }
+        w->stats.bytes_in += n;
+        s.in.append(buf, n);
+    }
+    now = monotonic_ns();
+    while (s.in_pos < s.in.size())
+    {
+        int status = 0;
+        bool close_after = false;
+        long len = parse_response(s.in.data() + s.in_pos, s.in.size() - s.in_pos, status, close_after);
+        if (len == 0)
+            break;
+        if (len < 0)
+        {
+            ++w->stats.read_errors;
+            return false;
+        }
+        s.in_pos += len;
+        // 捕获时客户端没等到响应就关闭了连接，重放时多出来的响应不计入
+        if (s.pend.empty())
+            continue;
+        const pending &p = s.pend.front();
+        w->latency.record(now - p.start);
+        if (p.status != 0 && p.status != status)
+            ++w->stats.mismatch;
+        s.pend.pop_front();
+        ++s.received;
+        if (s.received == s.expected)
+            s.caught_up = now;
+        ++w->stats.completed;
+        ++w->stats.status[status >= 100 && status < 600 ? status / 100 : 0];
+        if (close_after)
+            peer_closed = true;
+    }
+    if (s.in_pos == s.in.size())
+    {
+        s.in.clear();
+        s.in_pos = 0;
+    }
+    if (peer_closed)
+    {
+        // 服务器关闭连接时，捕获中后面还有数据要发才算错误
+        for (size_t i = s.next; i < s.ev.size(); ++i)
+        {
+            if (s.ev[i].type == CAP_DATA || s.ev[i].type == CAP_RESP)
+            {
+                ++w->stats.read_errors;
+                return false;
+            }
+        }
+        if (!s.pend.empty())
+        {
+            ++w->stats.read_errors;
+            return false;
+        }
+        close_session(w, s);
+        return true;
+    }
+    return true;
+}
+
+static void *worker_main(void *arg)
+{
+    worker *w = (worker *)arg;
+    w->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    uint64_t timeout_ns = (uint64_t)opt.timeout_ms * 1000000ull;
+    int remaining = w->sessions.size();
+    vector<struct epoll_event> events(1024);
+    uint64_t now = monotonic_ns();
+    uint64_t last_sweep = now;
+
+    while (remaining > 0)
+    {
+        // 处理到期的事件，同时找出最近的下一个计划时刻
+        uint64_t next_wake = 0;
+        remaining = 0;
+        for (size_t i = 0; i < w->sessions.size(); ++i)
+        {
+            session &s = w->sessions[i];
+            if (s.done)
+                continue;
+            if (s.wake && s.wake <= now)
+                advance(w, i, now);
+            if (s.done)
+                continue;
+            ++remaining;
+            if (s.wake && (next_wake == 0 || s.wake < next_wake))
+                next_wake = s.wake;
+        }
+        if (remaining == 0)
+            break;
+
+        int wait_ms = 10;
+        if (next_wake)
+        {
+            uint64_t ms = next_wake > now ? (next_wake - now) / 1000000 : 0;
+            wait_ms = ms < (uint64_t)wait_ms ? (int)ms : wait_ms;
+        }
+        int n = epoll_wait(w->epollfd, events.data(), events.size(), wait_ms);
+        now = monotonic_ns();
+        for (int k = 0; k < n; ++k)
+        {
+            int idx = events[k].data.u32;
+            session &s = w->sessions[idx];
+            if (s.fd < 0)
+                continue;
+            if (s.connecting)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || (events[k].events & (EPOLLERR | EPOLLHUP)))
+                {
+                    ++w->stats.connect_errors;
+                    abort_session(w, s);
+                    continue;
+                }
+                s.connecting = false;
+                s.caught_up = now;
+                flush_session(w, idx);
+                advance(w, idx, now);
+                continue;
+            }
+            if ((events[k].events & EPOLLOUT) && !flush_session(w, idx))
+            {
+                ++w->stats.read_errors;
+                abort_session(w, s);
+                continue;
+            }
+            if (events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+            {
+                if (!read_session(w, idx, now))
+                    abort_session(w, s);
+                else if (!s.done)
+                    advance(w, idx, now);
+            }
+        }
+
+        // 每10ms检查一次超时
+        if (now - last_sweep >= 10000000ull)
+        {
+            last_sweep = now;
+            for (size_t i = 0; i < w->sessions.size(); ++i)
+            {
+                session &s = w->sessions[i];
+                if (!s.done && !s.pend.empty() && now > s.pend.front().start + timeout_ns)
+                {
+                    w->stats.timeouts += s.pend.size();
+                    abort_session(w, s);
+                }
+            }
+        }
+    }
+    close(w->epollfd);
+    return NULL;
+}
+
+// 解析访问日志JSON行中"key":后面的值，字符串去掉引号并还原\u00XX转义
+static bool json_field(const char *line, const char *key, string &out)
+{
+    char pat[64];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(line, pat);
+    if (p == NULL)
+        return false;
+    p += strlen(pat);
+    out.clear();
+    if (*p != '"')
+    {
+        while (*p && *p != ',' && *p != '}')
+            out += *p++;
+        return true;
+    }
+    for (++p; *p && *p != '"'; ++p)
+    {
+        if (p[0] == '\\' && p[1] == 'u' && p[2] && p[3] && p[4] && p[5])
+        {
+            char hex[3] = {p[4], p[5], 0};
+            out += (char)strtol(hex, NULL, 16);
+            p += 5;
+        }
+        else
+            out += *p;
+    }
+    return true;
+}
+
+// 2026-01-02T03:04:05.678+0800，换算成纳秒
+static bool parse_time(const string &s, uint64_t &ns)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int ms = 0, zone = 0;
+    char sign = '+';
+    if (sscanf(s.c_str(), "%d-%d-%dT%d:%d:%d.%d%c%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &ms, &sign, &zone) != 9)
+        return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    long offset = (zone / 100 * 3600 + zone % 100 * 60) * (sign == '-' ? -1 : 1);
+    ns = ((uint64_t)(timegm(&tm) - offset) * 1000 + ms) * 1000000ull;
+    return true;
+}
+
+struct log_request
+{
+    uint64_t start;
+    uint64_t done;
+    string method;
+    string path;
+    int status;
+};
+
+static void put_record(FILE *fp, uint64_t t, uint32_t conn, int type, int status, const string &data)
+{
+    cap_record r;
+    r.t_ns = t;
+    r.conn = conn;
+    r.type = type;
+    r.status = status;
+    r.len = data.size();
+    r.reserved = 0;
+    fwrite(&r, sizeof(r), 1, fp);
+    if (r.len)
+        fwrite(data.data(), 1, r.len, fp);
+}
+
+// 访问日志中同一客户端地址和端口的请求看作一个连接
+// 请求开始时刻由完成时刻减去各阶段耗时得到；POST的正文没有记录，统一用-P和-B指定
+static int import_log(const char *in, const char *out, const char *post_path, const char *post_body)
+{
+    FILE *fp = fopen(in, "r");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "open %s: %s\n", in, strerror(errno));
+        return 1;
+    }
+    map<string, vector<log_request> > conns;
+    char line[4096];
+    long lines = 0, skipped = 0;
+    uint64_t t_min = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        ++lines;
+        string time, client, port, status, queue, parse, handler, send;
+        log_request r;
+        if (!json_field(line, "time", time) || !json_field(line, "client", client) ||
+            !json_field(line, "port", port) || !json_field(line, "method", r.method) ||
+            !json_field(line, "path", r.path) || !json_field(line, "status", status) ||
+            !parse_time(time, r.done) || r.path == "-")
+        {
+            ++skipped;
+            continue;
+        }
+        uint64_t us = 0;
+        if (json_field(line, "queue_us", queue) && json_field(line, "parse_us", parse) &&
+            json_field(line, "handler_us", handler) && json_field(line, "send_us", send))
+            us = atoll(queue.c_str()) + atoll(parse.c_str()) + atoll(handler.c_str()) + atoll(send.c_str());
+        r.start = r.done > us * 1000 ? r.done - us * 1000 : r.done;
+        r.status = atoi(status.c_str());
+        if (t_min == 0 || r.start < t_min)
+            t_min = r.start;
+        conns[client + ":" + port].push_back(r);
+    }
+    fclose(fp);
+    if (conns.empty())
+    {
+        fprintf(stderr, "%s: no JSON access log records (start the server with -x 2)\n", in);
+        return 1;
+    }
+
+    // 先生成全部事件，再按时间排序写出；同一连接内的时间不回退，排序后顺序不变
+    struct gen_event
+    {
+        uint64_t t;
+        uint32_t conn;
+        uint32_t seq;
+        int type;
+        int status;
+        string data;
+        bool operator<(const gen_event &o) const
+        {
+            if (t != o.t)
+                return t < o.t;
+            if (conn != o.conn)
+                return conn < o.conn;
+            return seq < o.seq;
+        }
+    };
+    vector<gen_event> all;
+    uint32_t conn_id = 0;
+    long requests = 0;
+    for (map<string, vector<log_request> >::iterator it = conns.begin(); it != conns.end(); ++it)
+    {
+        vector<log_request> &reqs = it->second;
+        sort(reqs.begin(), reqs.end(), [](const log_request &a, const log_request &b) { return a.start < b.start; });
+        ++conn_id;
+        uint32_t seq = 0;
+        uint64_t t = reqs[0].start - t_min;
+        gen_event e;
+        e.conn = conn_id;
+        e.status = 0;
+        e.t = t;
+        e.seq = seq++;
+        e.type = CAP_OPEN;
+        all.push_back(e);
+        for (size_t i = 0; i < reqs.size(); ++i)
+        {
+            const log_request &r = reqs[i];
+            char head[1024];
+            int n;
+            if (r.method == "POST")
+                n = snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: replay\r\nConnection: keep-alive\r\n"
+                             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n%s",
+                             post_path, strlen(post_body), post_body);
+            else
+                n = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: replay\r\nConnection: keep-alive\r\n\r\n",
+                             r.method.c_str(), r.path.c_str());
+            if (n <= 0 || n >= (int)sizeof(head))
+                continue;
+            t = max(t, r.start - t_min);
+            e.t = t;
+            e.seq = seq++;
+            e.type = CAP_DATA;
+            e.status = 0;
+            e.data.assign(head, n);
+            all.push_back(e);
+            t = max(t, r.done - t_min);
+            e.t = t;
+            e.seq = seq++;
+            e.type = CAP_RESP;
+            e.status = r.status;
+            e.data.clear();
+            all.push_back(e);
+            ++requests;
+        }
+        e.t = t;
+        e.seq = seq++;
+        e.type = CAP_CLOSE;
+        e.status = 0;
+        all.push_back(e);
+    }
+    sort(all.begin(), all.end());
+
+    FILE *ofp = fopen(out, "wb");
+    if (ofp == NULL)
+    {
+        fprintf(stderr, "open %s: %s\n", out, strerror(errno));
+        return 1;
+    }
+    cap_file_header h;
+    memcpy(h.magic, CAP_MAGIC, 8);
+    h.real_base = t_min;
+    fwrite(&h, sizeof(h), 1, ofp);
+    for (size_t i = 0; i < all.size(); ++i)
+        put_record(ofp, all[i].t, all[i].conn, all[i].type, all[i].status, all[i].data);
+    fclose(ofp);
+    printf("%s: %ld lines, %ld skipped, %ld requests on %u connections -> %s\n",
+           in, lines, skipped, requests, conn_id, out);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    memset(&opt, 0, sizeof(opt));
+    opt.threads = 2;
+    opt.speed = 1;
+    opt.timeout_ms = 5000;
+    const char *import_in = NULL, *import_out = NULL;
+    const char *post_path = "/2CGISQL.cgi";
+    const char *post_body = "user=user1&password=passwd1";
+
+    int c;
+    const char *str = "t:s:T:i:o:P:B:";
+    while ((c = getopt(argc, argv, str)) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            opt.threads = atoi(optarg);
+            break;
+        case 's':
+            opt.speed = atof(optarg);
+            break;
+        case 'T':
+            opt.timeout_ms = atoi(optarg);
+            break;
+        case 'i':
+            import_in = optarg;
+            break;
+        case 'o':
+            import_out = optarg;
+            break;
+        case 'P':
+            post_path = optarg;
+            break;
+        case 'B':
+            post_body = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (import_in || import_out)
+    {
+        if (!import_in || !import_out || optind != argc)
+            usage(argv[0]);
+        return import_log(import_in, import_out, post_path, post_body);
+    }
+    if (optind != argc - 2 || !parse_url(argv[optind + 1]))
+        usage(argv[0]);
+    if (opt.threads < 1 || opt.speed < 0 || opt.timeout_ms < 1)
+        usage(argv[0]);
+    if (!resolve())
+        return 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<session> sessions;
+    if (!load_trace(argv[optind], sessions))
+        return 1;
+    uint64_t t_last = t_first, data_events = 0;
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        const vector<event> &ev = sessions[i].ev;
+        t_last = max(t_last, ev.back().t_ns);
+        for (size_t k = 0; k < ev.size(); ++k)
+            data_events += ev[k].type == CAP_RESP;
+    }
+    printf("replay %s to %s:%s: %zu connections, %llu requests, span %.2f s, speed %s, %d threads\n",
+           argv[optind], opt.host, opt.port, sessions.size(), (unsigned long long)data_events,
+           (t_last - t_first) / 1e9, opt.speed > 0 ? to_string(opt.speed).c_str() : "max", opt.threads);
+    fflush(stdout);
+
+    vector<worker *> workers(opt.threads);
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        workers[i] = new worker;
+        workers[i]->id = i;
+        workers[i]->latency.clear();
+        workers[i]->lag.clear();
+        memset(&workers[i]->stats, 0, sizeof(thread_stats));
+    }
+    for (size_t i = 0; i < sessions.size(); ++i)
+        workers[sessions[i].id % opt.threads]->sessions.push_back(sessions[i]);
+    sessions.clear();
+
+    t_base = monotonic_ns();
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker *w = workers[i];
+        for (size_t k = 0; k < w->sessions.size(); ++k)
+        {
+            session &s = w->sessions[k];
+            s.next = 0;
+            s.wake = scheduled(s.ev[0]);
+            s.fd = -1;
+            s.connecting = false;
+            s.done = false;
+            s.out_pos = 0;
+            s.in_pos = 0;
+            s.expected = 0;
+            s.received = 0;
+            s.caught_up = 0;
+            s.last_start = 0;
+        }
+        if (pthread_create(&w->tid, NULL, worker_main, w) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+
+    histogram_snapshot *lat = new histogram_snapshot;
+    histogram_snapshot *lag = new histogram_snapshot;
+    thread_stats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker *w = workers[i];
+        pthread_join(w->tid, NULL);
+        lat->add(w->latency);
+        lag->add(w->lag);
+        total.completed += w->stats.completed;
+        for (int s = 0; s < 6; ++s)
+            total.status[s] += w->stats.status[s];
+        total.mismatch += w->stats.mismatch;
+        total.bytes_out += w->stats.bytes_out;
+        total.bytes_in += w->stats.bytes_in;
+        total.connect_errors += w->stats.connect_errors;
+        total.read_errors += w->stats.read_errors;
+        total.timeouts += w->stats.timeouts;
+        total.aborted += w->stats.aborted;
+        delete w;
+    }
+    double secs = (monotonic_ns() - t_base) / 1e9;
+
+    printf("requests %llu in %.2f s, %.1f req/s, out %.2f MB, in %.2f MB\n",
+           (unsigned long long)total.completed, secs, total.completed / secs,
+           total.bytes_out / 1048576.0, total.bytes_in / 1048576.0);
+    printf("status 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu, differ from capture %llu\n",
+           (unsigned long long)total.status[2], (unsigned long long)total.status[3],
+           (unsigned long long)total.status[4], (unsigned long long)total.status[5],
+           (unsigned long long)(total.status[0] + total.status[1]), (unsigned long long)total.mismatch);
+    printf("errors connect %llu, read %llu, timeout %llu, aborted connections %llu\n",
+           (unsigned long long)total.connect_errors, (unsigned long long)total.read_errors,
+           (unsigned long long)total.timeouts, (unsigned long long)total.aborted);
+    printf("latency(us)  mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           lat->total ? lat->sum / 1000.0 / lat->total : 0.0,
+           lat->percentile(0.5) / 1000.0, lat->percentile(0.9) / 1000.0, lat->percentile(0.99) / 1000.0,
+           lat->percentile(0.999) / 1000.0, lat->max / 1000.0);
+    printf("send lag(us) mean %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+           lag->total ? lag->sum / 1000.0 / lag->total : 0.0,
+           lag->percentile(0.5) / 1000.0, lag->percentile(0.99) / 1000.0, lag->max / 1000.0);
+    delete lat;
+    delete lag;
+    return total.completed == data_events ? 0 : 1;
+}
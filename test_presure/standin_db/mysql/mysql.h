@@ -0,0 +1,31 @@
+#ifndef STANDIN_MYSQL_H
+#define STANDIN_MYSQL_H
+
+// 替身数据库的头文件，只声明服务器用到的libmysqlclient接口
+// 编译时用-I./test_presure/standin_db让<mysql/mysql.h>指向这里
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct st_mysql MYSQL;
+typedef struct st_mysql_res MYSQL_RES;
+typedef char **MYSQL_ROW;
+typedef unsigned long long my_ulonglong;
+
+MYSQL *mysql_init(MYSQL *mysql);
+MYSQL *mysql_real_connect(MYSQL *mysql, const char *host, const char *user, const char *passwd,
+                          const char *db, unsigned int port, const char *unix_socket, unsigned long clientflag);
+void mysql_close(MYSQL *mysql);
+int mysql_query(MYSQL *mysql, const char *q);
+const char *mysql_error(MYSQL *mysql);
+unsigned long mysql_real_escape_string(MYSQL *mysql, char *to, const char *from, unsigned long length);
+MYSQL_RES *mysql_store_result(MYSQL *mysql);
+my_ulonglong mysql_num_rows(MYSQL_RES *res);
+MYSQL_ROW mysql_fetch_row(MYSQL_RES *res);
+void mysql_free_result(MYSQL_RES *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+/*************************************************************
+ * 替身数据库：在进程内存中实现user表，代替libmysqlclient链接进服务器
+ * 只识别服务器实际发出的几种SQL，压测时不需要安装和配置MySQL
+ * 环境变量:
+ *   STANDIN_USERS     启动时预置的用户数，用户名userN、口令passwdN(明文，首次登录后被服务器升级为哈希)，默认100
+ *   STANDIN_DELAY_US  每条语句额外等待的微秒数，模拟数据库往返，默认0
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <mysql/mysql.h>
+
+using namespace std;
+
+struct user_row
+{
+    long long id;
+    string username;
+    string passwd;
+    long long updated_us;   // updated_at，微秒
+};
+
+struct st_mysql
+{
+    MYSQL_RES *result;      // 最近一次SELECT的结果，由mysql_store_result取走
+    char error[128];
+};
+
+struct st_mysql_res
+{
+    vector<vector<string> > rows;
+    vector<char *> current;     // mysql_fetch_row返回的指针数组
+    size_t next;
+};
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<user_row> table;
+static int delay_us = 0;
+
+// 模拟ON UPDATE CURRENT_TIMESTAMP(6)
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static string format_us(long long us)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld.%06lld", us / 1000000, us % 1000000);
+    return buf;
+}
+
+// 按(updated_at, id)排序，对应ORDER BY updated_at,id
+static bool updated_before(const user_row *a, const user_row *b)
+{
+    return a->updated_us != b->updated_us ? a->updated_us < b->updated_us : a->id < b->id;
+}
+
+// 进程启动时按环境变量预置用户
+static struct table_seed
+{
+    table_seed()
+    {
+        const char *users = getenv("STANDIN_USERS");
+        const char *delay = getenv("STANDIN_DELAY_US");
+        int n = users ? atoi(users) : 100;
+        delay_us = delay ? atoi(delay) : 0;
+        char name[32], passwd[32];
+        long long now = now_us();
+        for (int i = 1; i <= n; ++i)
+        {
+            snprintf(name, sizeof(name), "user%d", i);
+            snprintf(passwd, sizeof(passwd), "passwd%d", i);
+            user_row row = {i, name, passwd, now};
+            table.push_back(row);
+        }
+    }
+} seed;
+
+// 取出从p开始的第一个'...'中的内容并还原mysql_real_escape_string的转义，返回右引号后的位置，失败返回NULL
+static const char *quoted(const char *p, string &out)
+{
+    const char *l = strchr(p, '\'');
+    if (l == NULL)
+        return NULL;
+    out.clear();
+    for (const char *r = l + 1; *r; ++r)
+    {
+        if (*r == '\'')
+            return r + 1;
+        if (*r != '\\')
+        {
+            out += *r;
+            continue;
+        }
+        if (*++r == '\0')
+            return NULL;
+        switch (*r)
+        {
+        case '0': out += '\0'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 'Z': out += '\032'; break;
+        default: out += *r; break;
+        }
+    }
+    return NULL;
+}
+
+static long long number_after(const char *q, const char *key, long long def)
+{
+    const char *p = strstr(q, key);
+    return p ? atoll(p + strlen(key)) : def;
+}
+
+extern "C" {
+
+MYSQL *mysql_init(MYSQL *mysql)
+{
+    // 服务器总是传NULL，由这里分配
+    MYSQL *m = mysql ? mysql : new MYSQL;
+    m->result = NULL;
+    m->error[0] = '\0';
+    return m;
+}
+
+MYSQL *mysql_real_connect(MYSQL *mysql, const char *, const char *, const char *,
+                          const char *, unsigned int, const char *, unsigned long)
+{
+    return mysql;
+}
+
+void mysql_close(MYSQL *mysql)
+{
+    if (mysql == NULL)
+        return;
+    mysql_free_result(mysql->result);
+    delete mysql;
+}
+
+int mysql_query(MYSQL *mysql, const char *q)
+{
+    if (delay_us > 0)
+        usleep(delay_us);
+    mysql_free_result(mysql->result);
+    mysql->result = NULL;
+    mysql->error[0] = '\0';
+
+    pthread_mutex_lock(&table_lock);
+    int ret = 0;
+    if (strncmp(q, "SELECT IFNULL(MIN(id)", 21) == 0)
+    {
+        // 用户缓存预热前查询id范围
+        MYSQL_RES *res = new MYSQL_RES;
+        vector<string> row;
+        row.push_back(table.empty() ? "0" : to_string(table.front().id));
+        row.push_back(table.empty() ? "0" : to_string(table.back().id));
+        long long max_us = 0;
+        for (size_t i = 0; i < table.size(); ++i)
+            max_us = max(max_us, table[i].updated_us);
+        row.push_back(format_us(max_us));
+        res->rows.push_back(row);
+        mysql->result = res;
+    }
+    else if (strncmp(q, "SELECT id,username,passwd FROM user", 35) == 0)
+    {
+        // 按id分段加载和增量同步，id递增插入，表本身就是有序的
+        long long lo = number_after(q, "id > ", -1);
+        long long hi = number_after(q, "id <= ", -1);
+        long long limit = number_after(q, "LIMIT ", -1);
+        MYSQL_RES *res = new MYSQL_RES;
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            const user_row &r = table[i];
+            if (r.id <= lo || (hi >= 0 && r.id > hi))
+                continue;
+            if (limit >= 0 && (long long)res->rows.size() >= limit)
+                break;
+            vector<string> row;
+            row.push_back(to_string(r.id));
+            row.push_back(r.username);
+            row.push_back(r.passwd);
+            res->rows.push_back(row);
+        }
+        mysql->result = res;
+    }
+    else if (strncmp(q, "SELECT id,username,passwd,UNIX_TIMESTAMP(updated_at) FROM user", 62) == 0)
+    {
+        // 按(updated_at, id)翻页同步改过的用户，两处FROM_UNIXTIME是同一个值
+        const char *p = strstr(q, "FROM_UNIXTIME(");
+        long long from_us = p ? llround(atof(p + 14) * 1000000) : 0;
+        long long from_id = number_after(q, "OR id > ", 0);
+        long long limit = number_after(q, "LIMIT ", -1);
+        vector<const user_row *> hit;
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            const user_row &r = table[i];
+            if (r.updated_us > from_us || (r.updated_us == from_us && r.id > from_id))
+                hit.push_back(&r);
+        }
+        sort(hit.begin(), hit.end(), updated_before);
+        if (limit >= 0 && (long long)hit.size() > limit)
+            hit.resize(limit);
+        MYSQL_RES *res = new MYSQL_RES;
+        for (size_t i = 0; i < hit.size(); ++i)
+        {
+            vector<string> row;
+            row.push_back(to_string(hit[i]->id));
+            row.push_back(hit[i]->username);
+            row.push_back(hit[i]->passwd);
+            row.push_back(format_us(hit[i]->updated_us));
+            res->rows.push_back(row);
+        }
+        mysql->result = res;
+    }
+    else if (strncmp(q, "INSERT INTO user", 16) == 0)
+    {
+        user_row r;
+        const char *p = strstr(q, "VALUES");
+        if (p && (p = quoted(p, r.username)) && quoted(p, r.passwd))
+        {
+            r.id = table.empty() ? 1 : table.back().id + 1;
+            r.updated_us = now_us();
+            table.push_back(r);
+        }
+        else
+            ret = 1;
+    }
+    else if (strncmp(q, "UPDATE user SET passwd=", 23) == 0)
+    {
+        string passwd, username;
+        const char *p = quoted(q, passwd);
+        if (p && (p = strstr(p, "username=")) && quoted(p, username))
+        {
+            for (size_t i = 0; i < table.size(); ++i)
+                if (table[i].username == username && table[i].passwd != passwd)
+                {
+                    table[i].passwd = passwd;
+                    table[i].updated_us = now_us();
+                }
+        }
+        else
+            ret = 1;
+    }
+    else
+        ret = 1;
+    pthread_mutex_unlock(&table_lock);
+
+    if (ret)
+        snprintf(mysql->error, sizeof(mysql->error), "standin db: unsupported statement");
+    return ret;
+}
+
+const char *mysql_error(MYSQL *mysql)
+{
+    return mysql->error;
+}
+
+unsigned long mysql_real_escape_string(MYSQL *, char *to, const char *from, unsigned long length)
+{
+    char *out = to;
+    for (unsigned long i = 0; i < length; ++i)
+    {
+        char esc = 0;
+        switch (from[i])
+        {
+        case '\0': esc = '0'; break;
+        case '\n': esc = 'n'; break;
+        case '\r': esc = 'r'; break;
+        case '\032': esc = 'Z'; break;
+        case '\\': case '\'': case '"': esc = from[i]; break;
+        }
+        if (esc)
+        {
+            *out++ = '\\';
+            *out++ = esc;
+        }
+        else
+            *out++ = from[i];
+    }
+    *out = '\0';
+    return out - to;
+}
+
+MYSQL_RES *mysql_store_result(MYSQL *mysql)
+{
+    MYSQL_RES *res = mysql->result;
+    mysql->result = NULL;
+    if (res)
+        res->next = 0;
+    return res;
+}
+
+my_ulonglong mysql_num_rows(MYSQL_RES *res)
+{
+    return res ? res->rows.size() : 0;
+}
+
+MYSQL_ROW mysql_fetch_row(MYSQL_RES *res)
+{
+    if (res == NULL || res->next >= res->rows.size())
+        return NULL;
+    vector<string> &row = res->rows[res->next++];
+    res->current.clear();
+    for (size_t i = 0; i < row.size(); ++i)
+        res->current.push_back((char *)row[i].c_str());
+    return res->current.data();
+}
+
+void mysql_free_result(MYSQL_RES *res)
+{
+    delete res;
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <atomic>
+
+// 基于排队时延的准入控制，思路来自CoDel
+// 工作线程取出任务时报告它在队列中等待的时间；等待时间连续interval都高于target，说明队列是持续积压
+// 而不是短暂的突发，进入过载状态；之后取出的任务只要有一个低于target就退出
+// 过载期间由线程池的admit决定是否放行新请求，见threadpool.h
+class admission
+{
+public:
+    admission() : m_target_ns(0), m_interval_ns(0), m_first_above(0), m_overloaded(false) {}
+
+    // target_ms为0时关闭，永远不会进入过载状态
+    void init(int target_ms, int interval_ms = 100)
+    {
+        m_target_ns = (uint64_t)(target_ms > 0 ? target_ms : 0) * 1000000;
+        m_interval_ns = (uint64_t)(interval_ms > 0 ? interval_ms : 100) * 1000000;
+    }
+    bool enabled() const { return m_target_ns != 0; }
+
+    // 工作线程取出任务时调用，调用方持有队列锁
+    // sojourn_ns为任务的排队时间，remaining为取出后队列中剩余的任务数
+    void on_dequeue(uint64_t sojourn_ns, int remaining, uint64_t now)
+    {
+        if (!m_target_ns)
+            return;
+        if (sojourn_ns < m_target_ns)
+        {
+            m_first_above = 0;
+            m_overloaded.store(false, std::memory_order_relaxed);
+        }
+        // 队列已经取空，积压没有持续，重新计时
+        else if (remaining == 0)
+            m_first_above = 0;
+        else if (m_first_above == 0)
+            m_first_above = now + m_interval_ns;
+        else if (now >= m_first_above)
+            m_overloaded.store(true, std::memory_order_relaxed);
+    }
+    // 主线程读取，不需要与队列同步，晚一次事件看到状态变化没有影响
+    bool overloaded() const { return m_overloaded.load(std::memory_order_relaxed); }
+
+private:
+    uint64_t m_target_ns;             // 排队时间目标
+    uint64_t m_interval_ns;           // 超过目标持续多久才算过载
+    uint64_t m_first_above;           // 预计进入过载的时间点，0表示当前没有超过目标
+    std::atomic<bool> m_overloaded;   // 是否处于过载状态
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef HASHPOOL_H
+#define HASHPOOL_H
+
+#include <cstdio>
+#include <exception>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "../memory/arena.h"
+#include "ring_queue.h"
+#include "../trace/recorder.h"
+#include "../trace/profiler.h"
+
+// 口令哈希线程池，与处理I/O的threadpool分开
+// 哈希一次耗费数十毫秒CPU，放在工作线程上会拖慢静态文件请求
+// 队列有上限，满了直接拒绝，由调用方返回503
+template <typename T>
+class hashpool
+{
+public:
+    /*thread_number是哈希线程数，即同时进行的哈希计算上限，max_requests是排队等待哈希的请求上限*/
+    hashpool(int thread_number = 2, int max_requests = 64);
+    ~hashpool();
+    // 队列已满时返回false，请求不会被处理
+    bool append(T *request);
+    // 当前排队数量
+    int size();
+    // 队列为空且没有线程正在哈希
+    bool idle();
+    // 处理完队列中剩余的请求后让线程退出并回收，可重复调用
+    void stop();
+
+private:
+    static void *worker(void *arg);
+    void run();
+
+private:
+    int m_thread_number;        // 哈希线程数
+    int m_max_requests;         // 队列上限
+    pthread_t *m_threads;       // 线程数组
+    ring_queue<T *> m_workqueue; // 请求队列，入队不申请内存
+    locker m_queuelocker;       // 保护请求队列的互斥锁
+    sem m_queuestat;            // 是否有任务需要处理
+    int m_active;               // 正在哈希的线程数，锁内读写
+    bool m_stop;                // 是否停止，锁内读写
+    bool m_joined;              // 线程是否已回收
+};
+template <typename T>
+hashpool<T>::hashpool(int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_workqueue(max_requests > 0 ? max_requests : 1), m_active(0), m_stop(false), m_joined(false)
+{
+    if (thread_number <= 0 || max_requests <= 0)
+        throw std::exception();
+    m_threads = new pthread_t[m_thread_number];
+    for (int i = 0; i < thread_number; ++i)
+    {
+        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
+        {
+            delete[] m_threads;
+            throw std::exception();
+        }
+    }
+}
+template <typename T>
+hashpool<T>::~hashpool()
+{
+    stop();
+    delete[] m_threads;
+}
+template <typename T>
+bool hashpool<T>::idle()
+{
+    m_queuelocker.lock();
+    bool ret = m_workqueue.empty() && 0 == m_active;
+    m_queuelocker.unlock();
+    return ret;
+}
+template <typename T>
+void hashpool<T>::stop()
+{
+    if (m_joined)
+        return;
+    m_queuelocker.lock();
+    m_stop = true;
+    m_queuelocker.unlock();
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
+    m_joined = true;
+}
+template <typename T>
+bool hashpool<T>::append(T *request)
+{
+    m_queuelocker.lock();
+    if (m_stop || m_workqueue.full())
+    {
+        m_queuelocker.unlock();
+        return false;
+    }
+    m_workqueue.push_back(request);
+    m_queuelocker.unlock();
+    m_queuestat.post();
+    return true;
+}
+template <typename T>
+int hashpool<T>::size()
+{
+    m_queuelocker.lock();
+    int n = m_workqueue.size();
+    m_queuelocker.unlock();
+    return n;
+}
+template <typename T>
+void *hashpool<T>::worker(void *arg)
+{
+    hashpool *pool = (hashpool *)arg;
+    pool->run();
+    return pool;
+}
+template <typename T>
+void hashpool<T>::run()
+{
+    flight_recorder::set_thread_name("hash");
+    cpu_profiler::register_thread();
+    while (true)
+    {
+        m_queuestat.wait();
+        m_queuelocker.lock();
+        if (m_workqueue.empty())
+        {
+            bool stop = m_stop;
+            m_queuelocker.unlock();
+            if (stop)
+                break;
+            continue;
+        }
+        T *request = m_workqueue.pop_front();
+        ++m_active;
+        m_queuelocker.unlock();
+        if (request)
+        {
+            // 完成哈希后由请求自己生成响应并注册写事件
+            request->process_hash();
+            request_arena::local()->reset();
+        }
+        m_queuelocker.lock();
+        --m_active;
+        m_queuelocker.unlock();
+    }
+}
+#endif
@@ -0,0 +1,49 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+// 定长环形队列，容量在构造时确定，入队出队不申请内存
+// 不加锁，由threadpool、hashpool在各自的队列锁内使用
+template <typename T>
+class ring_queue
+{
+public:
+    explicit ring_queue(int capacity) : m_items(new T[capacity]), m_capacity(capacity), m_front(0), m_size(0) {}
+    ~ring_queue() { delete[] m_items; }
+
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size == m_capacity; }
+    int size() const { return m_size; }
+
+    // 队列已满时返回false
+    bool push_back(const T &item)
+    {
+        if (full())
+            return false;
+        int tail = m_front + m_size;
+        if (tail >= m_capacity)
+            tail -= m_capacity;
+        m_items[tail] = item;
+        ++m_size;
+        return true;
+    }
+    // 调用方保证队列非空
+    T pop_front()
+    {
+        T item = m_items[m_front];
+        if (++m_front == m_capacity)
+            m_front = 0;
+        --m_size;
+        return item;
+    }
+
+private:
+    ring_queue(const ring_queue &);
+    ring_queue &operator=(const ring_queue &);
+
+    T *m_items;
+    int m_capacity;
+    int m_front; // 队头下标
+    int m_size;  // 元素个数
+};
+
+#endif
@@ -1,12 +1,20 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
 #include <pthread.h>
 #include "../lock/locker.h"
+#include "../memory/arena.h"
+#include "ring_queue.h"
+#include "admission.h"
+#include "../timer/clock.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../trace/recorder.h"
+#include "../trace/profiler.h"
+#include "../trace/probes.h"
+#include "../http/io_policy.h"
 
 // 线程池类，为了提高复用性定义为模板类
 template <typename T>
@@ -14,28 +22,64 @@ class threadpool
 {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*Actor为ProactorPolicy或ReactorPolicy，Trig为reactor模式下工作线程读写连接的触发模式，见http/io_policy.h*/
+    template <typename Actor, typename Trig>
+    threadpool(Actor, Trig, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
     ~threadpool();
     bool append(T *request, int state);
     bool append_p(T *request);
+    // 当前排队数量
+    int size();
+    // 按排队时间做准入控制，target_ms为0时关闭，见admission.h
+    void set_admission(int target_ms) { m_admission.init(target_ms); }
+    // 主线程在读事件入队前调用，返回false时不应入队，由调用方直接回复503
+    // 队列满时拒绝；过载时只在队列短于线程数时放行，保证工作线程有活干，也用这些请求测出过载是否已经结束
+    bool admit()
+    {
+        int depth = m_depth.load(std::memory_order_relaxed);
+        if (depth >= m_max_requests)
+            return false;
+        return !m_admission.overloaded() || depth < m_thread_number;
+    }
+    bool overloaded() { return m_admission.overloaded(); }
+    // 队列为空且没有线程正在处理任务
+    bool idle();
+    // 不再接收任务，等工作线程处理完队列中剩余的任务后退出并回收，可重复调用
+    void stop();
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
+    template <typename Actor, typename Trig>
     static void *worker(void *arg);
+    template <typename Actor, typename Trig>
     void run();
 
+private:
+    // 队列中的任务和入队时间，出队时算出排队时间交给准入控制
+    struct queued_task
+    {
+        T *request;
+        uint64_t t_enqueue;
+    };
+    bool push(T *request);
+
 private:
     int m_thread_number;         // 线程池中的线程数
     int m_max_requests;          // 请求队列中允许的最大请求数
     pthread_t *m_threads;        // 描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue;  // 请求队列
+    ring_queue<queued_task> m_workqueue; // 请求队列，容量为m_max_requests，入队不申请内存
     locker m_queuelocker;        // 保护请求队列的互斥锁
     sem m_queuestat;             // 信号量用来判断是否有任务需要处理
     connection_pool *m_connPool; // 数据库
-    int m_actor_model;           // 模型切换
+    std::atomic<int> m_depth;    // 队列长度，锁内更新，主线程准入时不加锁读取
+    std::atomic<int> m_active;   // 正在处理任务的线程数，出队时在锁内加一
+    bool m_stop;                 // 是否停止，锁内读写
+    bool m_joined;               // 线程是否已回收
+    admission m_admission;       // 准入控制，出队时在锁内更新
 };
 template <typename T>
-threadpool<T>::threadpool(int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model), m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_connPool(connPool)
+template <typename Actor, typename Trig>
+threadpool<T>::threadpool(Actor, Trig, connection_pool *connPool, int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_workqueue(max_requests > 0 ? max_requests : 1), m_connPool(connPool), m_depth(0), m_active(0), m_stop(false), m_joined(false)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
@@ -47,13 +91,9 @@ threadpool<T>::threadpool(int actor_model, connection_pool *connPool, int thread
     for (int i = 0; i < thread_number; ++i)
     {
         // 创建线程并且检查是否出错
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        // 将线程和主线程分离，结束时直接自动释放所有资源
-        if (pthread_detach(m_threads[i]))
+        // 工作线程按并发模型和触发模式实例化，run中不再判断模型
+        // 线程不分离，退出时由stop回收，保证析构前没有线程还在访问连接和队列
+        if (pthread_create(m_threads + i, NULL, worker<Actor, Trig>, this) != 0)
         {
             delete[] m_threads;
             throw std::exception();
@@ -63,60 +103,103 @@ threadpool<T>::threadpool(int actor_model, connection_pool *connPool, int thread
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    stop();
     delete[] m_threads;
 }
 
-// 向请求队列中添加任务
 template <typename T>
-bool threadpool<T>::append(T *request, int state)
+bool threadpool<T>::idle()
 {
+    m_queuelocker.lock();
+    bool ret = m_workqueue.empty() && 0 == m_active.load(std::memory_order_acquire);
+    m_queuelocker.unlock();
+    return ret;
+}
+
+template <typename T>
+void threadpool<T>::stop()
+{
+    if (m_joined)
+        return;
+    m_queuelocker.lock();
+    m_stop = true;
+    m_queuelocker.unlock();
+    // 每个线程一次唤醒，线程取空队列后看到m_stop退出
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
+    m_joined = true;
+}
+
+// 入队，队列满时返回false
+template <typename T>
+bool threadpool<T>::push(T *request)
+{
+    queued_task task;
+    task.request = request;
+    task.t_enqueue = monotonic_ns();
     // 请求锁
     m_queuelocker.lock();
-    // 如果请求数量已经超过最大请求数量，释放锁并返回错误
-    if (m_workqueue.size() >= m_max_requests)
+    // 已经停止，或请求数量已经超过最大请求数量，释放锁并返回错误
+    if (m_stop || !m_workqueue.push_back(task))
     {
         m_queuelocker.unlock();
         return false;
     }
-    request->m_state = state;
-    // 加入请求队列
-    m_workqueue.push_back(request);
+    int depth = m_workqueue.size();
+    m_depth.store(depth, std::memory_order_relaxed);
     // 解锁
     m_queuelocker.unlock();
+    flight_recorder::record(FR_QUEUE_PUSH, depth);
+    PROBE2(queue__push, request, depth);
     // 信号量post，通知其他线程
     m_queuestat.post();
     return true;
 }
 
-// 请求队列添加请求的无状态版本
+// 向请求队列中添加任务，state为0表示读、1表示写，reactor模式使用
+template <typename T>
+bool threadpool<T>::append(T *request, int state)
+{
+    // 入队后工作线程随时可能取出，先设置状态
+    request->m_state = state;
+    return push(request);
+}
+
+// 请求队列添加请求的无状态版本，proactor模式使用
 template <typename T>
 bool threadpool<T>::append_p(T *request)
+{
+    return push(request);
+}
+
+template <typename T>
+int threadpool<T>::size()
 {
     m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests)
-    {
-        m_queuelocker.unlock();
-        return false;
-    }
-    m_workqueue.push_back(request);
+    int n = m_workqueue.size();
     m_queuelocker.unlock();
-    m_queuestat.post();
-    return true;
+    return n;
 }
 
 // 工作线程的工作
 template <typename T>
+template <typename Actor, typename Trig>
 void *threadpool<T>::worker(void *arg)
 {
     // worker是静态成员函数，无法直接访问类成员pool，此处的arg创建线程时传this
     threadpool *pool = (threadpool *)arg;
-    pool->run();
+    pool->template run<Actor, Trig>();
     return pool;
 }
 template <typename T>
+template <typename Actor, typename Trig>
 void threadpool<T>::run()
 {
-    // 死循环一直工作，也可以在成员中设置m_stop来决定线程是否停止
+    flight_recorder::set_thread_name("worker");
+    cpu_profiler::register_thread();
+    // 一直工作，直到stop设置m_stop并且队列已经取空
     while (true)
     {
         // 等待条件变量
@@ -126,43 +209,57 @@ void threadpool<T>::run()
         // 如果请求队列无内容，则释放锁，并进入下一次循环
         if (m_workqueue.empty())
         {
+            bool stop = m_stop;
             m_queuelocker.unlock();
+            if (stop)
+                break;
             continue;
         }
         // 取出一个请求，并将队列中的任务弹出
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
+        queued_task task = m_workqueue.pop_front();
+        T *request = task.request;
+        int depth = m_workqueue.size();
+        m_depth.store(depth, std::memory_order_relaxed);
+        uint64_t now = monotonic_ns();
+        m_admission.on_dequeue(now - task.t_enqueue, depth, now);
+        m_active.fetch_add(1, std::memory_order_relaxed);
         // 取出请求后释放锁
         m_queuelocker.unlock();
+        flight_recorder::record(FR_QUEUE_POP, depth);
+        PROBE2(queue__pop, request, depth);
         // 如果请求为空，continue
         if (!request)
+        {
+            m_active.fetch_sub(1, std::memory_order_release);
             continue;
-        if (1 == m_actor_model)
+        }
+        if (1 == Actor::model)
         {
+            // 主线程在improv上等待：先写timer_flag，再以release写improv
             if (0 == request->m_state)
             {
-                if (request->read_once())
+                if (request->template read_once<Trig>())
                 {
-                    request->improv = 1;
+                    request->improv.store(1, std::memory_order_release);
                     connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
                 }
                 else
                 {
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                    request->timer_flag.store(1, std::memory_order_relaxed);
+                    request->improv.store(1, std::memory_order_release);
                 }
             }
             else
             {
-                if (request->write())
+                if (request->template write<Trig>())
                 {
-                    request->improv = 1;
+                    request->improv.store(1, std::memory_order_release);
                 }
                 else
                 {
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                    request->timer_flag.store(1, std::memory_order_relaxed);
+                    request->improv.store(1, std::memory_order_release);
                 }
             }
         }
@@ -172,6 +269,9 @@ void threadpool<T>::run()
             // 执行处理
             request->process();
         }
+        // 任务处理完，回收本线程请求内存池中的临时内存
+        request_arena::local()->reset();
+        m_active.fetch_sub(1, std::memory_order_release);
     }
 }
 #endif
@@ -0,0 +1,32 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+// 单调时钟，单位纳秒，不受系统改时间影响，适合记录耗时和事件先后
+inline uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 墙上时间，单位纳秒，和monotonic_ns成对记录即可把单调时间换算成日期
+inline uint64_t realtime_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// CPU时间戳计数器，比clock_gettime便宜一个数量级，单位是时钟周期
+// 需要与monotonic_ns成对记录两次才能换算成时间；非x86平台退化为monotonic_ns
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t tsc_now() { return __rdtsc(); }
+#else
+inline uint64_t tsc_now() { return monotonic_ns(); }
+#endif
+
+#endif
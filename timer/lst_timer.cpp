@@ -1,10 +1,14 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../trace/recorder.h"
+#include "../trace/probes.h"
+#include "../trace/capture.h"
 
 sort_timer_lst::sort_timer_lst()
 {
     head = NULL;
     tail = NULL;
+    m_size = 0;
 }
 sort_timer_lst::~sort_timer_lst()
 {
@@ -12,7 +16,7 @@ sort_timer_lst::~sort_timer_lst()
     while (tmp)
     {
         head = tmp->next;
-        delete tmp;
+        m_pool.free(tmp);
         tmp = head;
     }
 }
@@ -24,6 +28,7 @@ void sort_timer_lst::add_timer(util_timer *timer)
     {
         return;
     }
+    ++m_size;
     if (!head)
     {
         head = tail = timer;
@@ -78,10 +83,11 @@ void sort_timer_lst::del_timer(util_timer *timer)
     {
         return;
     }
+    --m_size;
     // 链表中只有一个定时器，需要删除该定时器
     if ((timer == head) && (timer == tail))
     {
-        delete timer;
+        m_pool.free(timer);
         head = NULL;
         tail = NULL;
         return;
@@ -91,7 +97,7 @@ void sort_timer_lst::del_timer(util_timer *timer)
     {
         head = head->next;
         head->prev = NULL;
-        delete timer;
+        m_pool.free(timer);
         return;
     }
     // 被删除的定时器为尾结点
@@ -99,13 +105,13 @@ void sort_timer_lst::del_timer(util_timer *timer)
     {
         tail = tail->prev;
         tail->next = NULL;
-        delete timer;
+        m_pool.free(timer);
         return;
     }
     // 被删除的定时器在链表内部，常规链表结点删除
     timer->prev->next = timer->next;
     timer->next->prev = timer->prev;
-    delete timer;
+    m_pool.free(timer);
 }
 // 定时任务处理函数
 void sort_timer_lst::tick()
@@ -114,6 +120,8 @@ void sort_timer_lst::tick()
     {
         return;
     }
+    flight_recorder::record(FR_TIMER_TICK, m_size);
+    int before = m_size;
     // 获取当前时间
     time_t cur = time(NULL);
     util_timer *tmp = head;
@@ -126,7 +134,16 @@ void sort_timer_lst::tick()
         {
             break;
         }
+        // 请求正在其他线程中异步处理，顺延到下一次tick再检查
+        if (tmp->user_data->busy && tmp->user_data->busy->load(std::memory_order_acquire))
+        {
+            tmp->expire = cur + 1;
+            adjust_timer(tmp);
+            tmp = head;
+            continue;
+        }
         // 当前定时器到期，则调用回调函数，执行定时事件，即关闭与客户的连接
+        flight_recorder::record(FR_TIMER_EXPIRE, tmp->user_data->sockfd);
         tmp->cb_func(tmp->user_data);
         // 将处理后的定时器从链表容器中删除，并重置头结点
         head = tmp->next;
@@ -134,9 +151,11 @@ void sort_timer_lst::tick()
         {
             head->prev = NULL;
         }
-        delete tmp;
+        --m_size;
+        m_pool.free(tmp);
         tmp = head;
     }
+    PROBE2(timer__tick, before, before - m_size);
 }
 
 // 私有成员，被公有成员add_timer和adjust_time调用
@@ -225,8 +244,10 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
         sa.sa_flags |= SA_RESTART;
     // 将所有信号添加到信号集中
     sigfillset(&sa.sa_mask);
-    // 执行sigaction函数
-    assert(sigaction(sig, &sa, NULL) != -1);
+    // 执行sigaction函数，不能写在assert里，Release构建定义NDEBUG后assert中的表达式不会执行
+    int ret = sigaction(sig, &sa, NULL);
+    assert(ret != -1);
+    (void)ret;
 }
 
 // 定时处理任务，重新定时以不断触发SIGALRM信号
@@ -250,6 +271,8 @@ class Utils;
 // 定时器回调函数
 void cb_func(client_data *user_data)
 {
+    PROBE1(conn__close, user_data->sockfd);
+    traffic_capture::close(user_data->sockfd);
     // 删除非活动连接在socket上的注册事件
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
@@ -257,4 +280,6 @@ void cb_func(client_data *user_data)
     close(user_data->sockfd);
     // 减少连接数
     http_conn::m_user_count--;
+    // 定时器由调用方随后释放，这里置空；users_timer中timer非空即表示连接打开
+    user_data->timer = NULL;
 }
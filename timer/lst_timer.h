@@ -22,7 +22,9 @@
 #include <sys/uio.h>
 
 #include <time.h>
+#include <atomic>
 #include "../log/log.h"
+#include "../memory/object_pool.h"
 
 // 连接资源结构体成员需要用到定时器类
 // 需要前向声明
@@ -37,6 +39,8 @@ struct client_data
     int sockfd;
     // 定时器
     util_timer *timer;
+    // 指向连接的异步处理标志，为真时到期顺延，不关闭连接
+    const std::atomic<bool> *busy;
 };
 
 // 定时器类
@@ -65,16 +69,23 @@ public:
     sort_timer_lst();
     ~sort_timer_lst();
 
+    // 从对象池取一个定时器，由add_timer加入链表，删除或到期时放回对象池
+    util_timer *alloc_timer() { return m_pool.alloc(); }
     void add_timer(util_timer *timer);
     void adjust_timer(util_timer *timer);
     void del_timer(util_timer *timer);
     void tick();
+    // 链表中定时器的数量
+    int size() { return m_size; }
 
 private:
     // 添加定时器，内部调用私有成员add_timer
     void add_timer(util_timer *timer, util_timer *lst_head);
     util_timer *head;
     util_timer *tail;
+    int m_size;
+    // 定时器只在主线程中创建和删除，对象池不需要加锁
+    object_pool<util_timer> m_pool;
 };
 
 // 工具类
@@ -0,0 +1,166 @@
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+#include "../log/log.h"
+
+// 缓冲区1MB，至少每秒刷一次盘
+static const int CAP_BUF_SIZE = 1 << 20;
+static const uint64_t CAP_FLUSH_NS = 1000000000ull;
+
+std::atomic<bool> traffic_capture::m_enabled(false);
+
+// 表单中需要替换的字段，值到&、空白或数据结束为止
+static const char CAP_SECRET_KEY[] = "password=";
+static const int CAP_SECRET_KEY_LEN = sizeof(CAP_SECRET_KEY) - 1;
+
+traffic_capture::traffic_capture()
+{
+    m_fp = NULL;
+    m_buf = NULL;
+    m_conn_of_fd = NULL;
+    m_secret_state = NULL;
+    m_next_conn = 0;
+    m_mono_base = 0;
+    m_last_flush = 0;
+    m_bytes = 0;
+    m_max_bytes = 0;
+    m_close_log = 0;
+}
+
+traffic_capture::~traffic_capture()
+{
+    close_file();
+}
+
+bool traffic_capture::init(int max_mb, int close_log, const char *dir)
+{
+    m_close_log = close_log;
+    char name[256];
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    snprintf(name, sizeof(name), "%sCapture_%d%02d%02d_%02d%02d%02d.bin", dir,
+             my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+             my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+    m_fp = fopen(name, "wb");
+    if (m_fp == NULL)
+        return false;
+    m_buf = new char[CAP_BUF_SIZE];
+    setvbuf(m_fp, m_buf, _IOFBF, CAP_BUF_SIZE);
+    m_conn_of_fd = new uint32_t[CAP_MAX_FD];
+    memset(m_conn_of_fd, 0, sizeof(uint32_t) * CAP_MAX_FD);
+    m_secret_state = new uint8_t[CAP_MAX_FD];
+    memset(m_secret_state, 0, CAP_MAX_FD);
+
+    cap_file_header h;
+    memcpy(h.magic, CAP_MAGIC, 8);
+    m_mono_base = monotonic_ns();
+    h.real_base = realtime_ns();
+    fwrite(&h, sizeof(h), 1, m_fp);
+    m_bytes = sizeof(h);
+    m_max_bytes = (uint64_t)(max_mb > 0 ? max_mb : 1) << 20;
+    m_last_flush = m_mono_base;
+    m_enabled.store(true);
+    return true;
+}
+
+void traffic_capture::close_file()
+{
+    // 锁内关闭后write不会再用到下面这些
+    m_mutex.lock();
+    m_enabled.store(false);
+    if (m_fp)
+    {
+        fclose(m_fp);
+        m_fp = NULL;
+    }
+    delete[] m_buf;
+    m_buf = NULL;
+    delete[] m_conn_of_fd;
+    m_conn_of_fd = NULL;
+    delete[] m_secret_state;
+    m_secret_state = NULL;
+    m_mutex.unlock();
+}
+
+// 写DATA记录的数据，口令值替换成*，长度不变，重放时Content-Length仍然正确
+// m_secret_state[fd]为已经匹配上的字段名长度，等于CAP_SECRET_KEY_LEN时处在值中，跨recv接着匹配
+void traffic_capture::write_masked(int fd, const char *buf, int len)
+{
+    char out[256];
+    int n = 0;
+    uint8_t state = m_secret_state[fd];
+    for (int i = 0; i < len; ++i)
+    {
+        char c = buf[i];
+        if (state == CAP_SECRET_KEY_LEN)
+        {
+            if (c == '&' || c == '\r' || c == '\n' || c == ' ')
+                state = 0;
+            else
+                c = '*';
+        }
+        else if (c == CAP_SECRET_KEY[state])
+            ++state;
+        else
+            state = c == CAP_SECRET_KEY[0] ? 1 : 0;
+        out[n++] = c;
+        if (n == (int)sizeof(out))
+        {
+            fwrite(out, 1, n, m_fp);
+            n = 0;
+        }
+    }
+    fwrite(out, 1, n, m_fp);
+    m_secret_state[fd] = state;
+}
+
+void traffic_capture::write(int type, int fd, int status, const char *buf, int len)
+{
+    if (fd < 0 || fd >= CAP_MAX_FD)
+        return;
+    m_mutex.lock();
+    if (!m_enabled)
+    {
+        m_mutex.unlock();
+        return;
+    }
+    cap_record r;
+    // 在锁内取时间，文件中的记录严格按时间排序
+    uint64_t now = monotonic_ns();
+    r.t_ns = now - m_mono_base;
+    if (type == CAP_OPEN)
+    {
+        m_conn_of_fd[fd] = ++m_next_conn;
+        m_secret_state[fd] = 0;
+    }
+    r.conn = m_conn_of_fd[fd];
+    r.type = type;
+    r.status = status;
+    r.len = type == CAP_DATA ? len : 0;
+    r.reserved = 0;
+    // 捕获开始前建立的连接没有编号，跳过
+    if (r.conn == 0)
+    {
+        m_mutex.unlock();
+        return;
+    }
+    if (type == CAP_CLOSE)
+        m_conn_of_fd[fd] = 0;
+
+    fwrite(&r, sizeof(r), 1, m_fp);
+    if (r.len)
+        write_masked(fd, buf, r.len);
+    m_bytes += sizeof(r) + r.len;
+    bool full = m_bytes >= m_max_bytes;
+    if (full || now - m_last_flush >= CAP_FLUSH_NS)
+    {
+        fflush(m_fp);
+        m_last_flush = now;
+    }
+    if (full)
+        m_enabled.store(false);
+    m_mutex.unlock();
+    if (full)
+        LOG_WARN("traffic capture stopped after %llu bytes", (unsigned long long)m_bytes);
+}
@@ -0,0 +1,98 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../timer/clock.h"
+
+// 流量捕获记录类型
+enum CAP_TYPE
+{
+    CAP_OPEN = 1, // 接受新连接
+    CAP_DATA,     // 从连接读到的原始字节，紧跟len字节数据
+    CAP_RESP,     // 一个响应发送完成，status为状态码
+    CAP_CLOSE     // 连接关闭
+};
+
+// 文件格式：文件头，然后按时间顺序的记录，DATA记录后紧跟数据
+#define CAP_MAGIC "TWSCAP01"
+struct cap_file_header
+{
+    char magic[8];
+    uint64_t real_base; // 开始捕获时的realtime_ns，记录中的时间都相对于这一刻
+};
+struct cap_record
+{
+    uint64_t t_ns;   // 相对开始捕获的纳秒
+    uint32_t conn;   // 连接编号，从1开始，fd复用时编号不同
+    uint16_t type;
+    uint16_t status;
+    uint32_t len;    // DATA记录的数据长度，其余为0
+    uint32_t reserved;
+};
+
+const int CAP_MAX_FD = 65536;
+
+// 流量捕获
+// 把每个连接的建立、读到的原始请求字节、响应状态和关闭按时间写进二进制文件，
+// 由test_presure/replay按原来的时间间隔和连接关系重放
+// 所有线程共用一个带缓冲的文件，写入加锁；只用于采集样本，不要长期开启
+// 登录注册表单中的口令写入前替换成等长的*，其余字节原样记录
+class traffic_capture
+{
+public:
+    static traffic_capture *get_instance()
+    {
+        static traffic_capture instance;
+        return &instance;
+    }
+
+    // 在dir下创建Capture_日期_时间.bin，文件超过max_mb后停止捕获
+    bool init(int max_mb, int close_log, const char *dir = "./");
+    void close_file();
+
+    static void open(int fd)
+    {
+        if (m_enabled.load(std::memory_order_relaxed))
+            get_instance()->write(CAP_OPEN, fd, 0, NULL, 0);
+    }
+    static void data(int fd, const char *buf, int len)
+    {
+        if (m_enabled.load(std::memory_order_relaxed))
+            get_instance()->write(CAP_DATA, fd, 0, buf, len);
+    }
+    static void resp(int fd, int status)
+    {
+        if (m_enabled.load(std::memory_order_relaxed))
+            get_instance()->write(CAP_RESP, fd, status, NULL, 0);
+    }
+    static void close(int fd)
+    {
+        if (m_enabled.load(std::memory_order_relaxed))
+            get_instance()->write(CAP_CLOSE, fd, 0, NULL, 0);
+    }
+
+private:
+    traffic_capture();
+    ~traffic_capture();
+    void write(int type, int fd, int status, const char *buf, int len);
+    void write_masked(int fd, const char *buf, int len);
+
+private:
+    static std::atomic<bool> m_enabled; // init成功后为true，写满或关闭后为false；不加锁先读一次，锁内再确认
+    locker m_mutex;
+    FILE *m_fp;
+    char *m_buf;            // 文件缓冲区
+    uint32_t *m_conn_of_fd; // fd当前对应的连接编号
+    uint8_t *m_secret_state; // fd上口令字段的匹配进度，跨两次读取的字段名和值也能替换
+    uint32_t m_next_conn;
+    uint64_t m_mono_base;
+    uint64_t m_last_flush;
+    uint64_t m_bytes;
+    uint64_t m_max_bytes;
+    int m_close_log;        // 日志开关
+};
+
+#endif
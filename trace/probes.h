@@ -0,0 +1,28 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT静态探针，provider为webserver，探针名和参数见trace/README.md
+// 有<sys/sdt.h>(systemtap-sdt-dev)时编译成一条nop并在.note.stapsdt段登记，
+// 没有挂载bpftrace/perf时不产生任何开销；没有该头文件时探针为空宏
+// 参数只放已经算好的值，不要在参数里调用函数
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>) && !defined(NO_USDT)
+#include <sys/sdt.h>
+#define WEBSERVER_USDT 1
+#endif
+#endif
+
+#ifdef WEBSERVER_USDT
+#define PROBE0(name) DTRACE_PROBE(webserver, name)
+#define PROBE1(name, a) DTRACE_PROBE1(webserver, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(webserver, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(webserver, name, a, b, c)
+#else
+// sizeof不求值参数，只是避免仅用于探针的局部变量产生未使用告警
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#endif
+
+#endif
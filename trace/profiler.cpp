@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <map>
+#include <unordered_map>
+#include "profiler.h"
+#include "../timer/clock.h"
+
+// 当前线程的栈范围，由register_thread在线程启动时写入，信号处理函数只读
+// 可执行文件中的静态TLS变量在信号处理函数里访问是安全的
+static __thread uintptr_t t_stack_lo = 0;
+static __thread uintptr_t t_stack_hi = 0;
+
+cpu_profiler::cpu_profiler()
+{
+    m_busy.store(false);
+    m_seconds = 0;
+    m_done = NULL;
+    m_arg = NULL;
+    m_samples = NULL;
+    m_next.store(0);
+}
+
+cpu_profiler::~cpu_profiler()
+{
+}
+
+void cpu_profiler::register_thread()
+{
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return;
+    void *addr = NULL;
+    size_t size = 0;
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+    {
+        t_stack_lo = (uintptr_t)addr;
+        t_stack_hi = (uintptr_t)addr + size;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// 从被打断的上下文取出pc、帧指针和栈指针，不支持的架构返回false
+static bool context_regs(void *ctx, uintptr_t &pc, uintptr_t &fp, uintptr_t &sp)
+{
+    ucontext_t *uc = (ucontext_t *)ctx;
+#if defined(__x86_64__)
+    pc = uc->uc_mcontext.gregs[REG_RIP];
+    fp = uc->uc_mcontext.gregs[REG_RBP];
+    sp = uc->uc_mcontext.gregs[REG_RSP];
+    return true;
+#elif defined(__aarch64__)
+    pc = uc->uc_mcontext.pc;
+    fp = uc->uc_mcontext.regs[29];
+    sp = uc->uc_mcontext.sp;
+    return true;
+#else
+    (void)uc;
+    pc = fp = sp = 0;
+    return false;
+#endif
+}
+
+// 沿帧指针链回溯，每帧[fp]是上一帧的fp，[fp+8]是返回地址
+// glibc的backtrace走_Unwind_Backtrace，要拿加载器的锁，在信号处理函数里可能死锁，这里只读栈内存
+// 帧指针必须落在[被打断时的sp, 栈顶)内且严格递增，没有帧指针的代码(如libc)把rbp当普通寄存器用时也不会读越界
+static int walk_frames(void *ctx, void **out, int max)
+{
+    uintptr_t pc, fp, sp;
+    if (!context_regs(ctx, pc, fp, sp))
+        return 0;
+    int depth = 0;
+    out[depth++] = (void *)pc;
+    uintptr_t lo = t_stack_lo > sp ? t_stack_lo : sp;
+    uintptr_t hi = t_stack_hi;
+    while (depth < max && fp >= lo && fp + 2 * sizeof(uintptr_t) <= hi && (fp & (sizeof(uintptr_t) - 1)) == 0)
+    {
+        uintptr_t next = ((uintptr_t *)fp)[0];
+        uintptr_t ret = ((uintptr_t *)fp)[1];
+        if (ret == 0)
+            break;
+        out[depth++] = (void *)ret;
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+    return depth;
+}
+
+void cpu_profiler::on_sigprof(int, siginfo_t *, void *ctx)
+{
+    int save_errno = errno;
+    cpu_profiler *p = get_instance();
+    prof_sample *samples = p->m_samples;
+    if (samples)
+    {
+        int i = p->m_next.fetch_add(1, std::memory_order_relaxed);
+        if (i < PROF_MAX_SAMPLES)
+            samples[i].depth = walk_frames(ctx, samples[i].pc, PROF_MAX_FRAMES);
+    }
+    errno = save_errno;
+}
+
+bool cpu_profiler::start(int seconds, prof_done_fn done, void *arg)
+{
+    bool idle = false;
+    if (!m_busy.compare_exchange_strong(idle, true))
+        return false;
+    if (seconds < 1)
+        seconds = 1;
+    if (seconds > PROF_MAX_SECONDS)
+        seconds = PROF_MAX_SECONDS;
+    m_seconds = seconds;
+    m_done = done;
+    m_arg = arg;
+
+    // 样本在这里一次申请好，信号处理函数里不分配内存
+    prof_sample *samples = new prof_sample[PROF_MAX_SAMPLES];
+    for (int i = 0; i < PROF_MAX_SAMPLES; ++i)
+        samples[i].depth = 0;
+    m_next.store(0);
+    m_samples = samples;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, profile_thread, NULL) != 0)
+    {
+        m_samples = NULL;
+        delete[] samples;
+        m_busy.store(false);
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+void cpu_profiler::run()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_sigprof;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval it;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / PROF_HZ;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_PROF, &it, NULL);
+
+    // sleep会被SIGPROF打断，按截止时间睡够
+    uint64_t deadline = monotonic_ns() + (uint64_t)m_seconds * 1000000000ull;
+    uint64_t now;
+    while ((now = monotonic_ns()) < deadline)
+        usleep((deadline - now) / 1000 > 100000 ? 100000 : (deadline - now) / 1000 + 1);
+
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, NULL);
+    // 等可能还在执行的信号处理函数写完
+    usleep(20000);
+    signal(SIGPROF, SIG_IGN);
+    int count = m_next.load();
+    if (count > PROF_MAX_SAMPLES)
+        count = PROF_MAX_SAMPLES;
+
+    string folded;
+    fold(count, folded);
+    prof_sample *samples = m_samples;
+    m_samples = NULL;
+    delete[] samples;
+
+    prof_done_fn done = m_done;
+    void *arg = m_arg;
+    m_busy.store(false);
+    done(arg, folded);
+}
+
+// 地址转成函数名，没有符号时输出模块名加偏移
+static const string &symbolize(void *pc, unordered_map<void *, string> &cache)
+{
+    unordered_map<void *, string>::iterator it = cache.find(pc);
+    if (it != cache.end())
+        return it->second;
+    string &name = cache[pc];
+    Dl_info info;
+    char buf[64];
+    if (dladdr(pc, &info) && info.dli_sname)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+        name = (status == 0 && demangled) ? demangled : info.dli_sname;
+        free(demangled);
+    }
+    else if (info.dli_fname)
+    {
+        const char *base = strrchr(info.dli_fname, '/');
+        snprintf(buf, sizeof(buf), "+0x%lx", (unsigned long)((char *)pc - (char *)info.dli_fbase));
+        name = string(base ? base + 1 : info.dli_fname) + buf;
+    }
+    else
+    {
+        snprintf(buf, sizeof(buf), "0x%lx", (unsigned long)pc);
+        name = buf;
+    }
+    // 折叠格式用分号分隔栈帧
+    for (size_t i = 0; i < name.size(); ++i)
+        if (name[i] == ';')
+            name[i] = ':';
+    return name;
+}
+
+void cpu_profiler::fold(int count, string &out)
+{
+    unordered_map<void *, string> cache;
+    map<string, int> stacks;
+    string key;
+    for (int i = 0; i < count; ++i)
+    {
+        const prof_sample &s = m_samples[i];
+        if (s.depth <= 0)
+            continue;
+        key.clear();
+        // 回溯从叶子开始，折叠格式从根开始
+        for (int f = s.depth - 1; f >= 0; --f)
+        {
+            // 第0帧是被打断的指令本身；调用者的返回地址指向call的下一条指令，减一才落在调用语句所在的函数内
+            void *pc = f > 0 ? (char *)s.pc[f] - 1 : s.pc[f];
+            if (!key.empty())
+                key += ';';
+            key += symbolize(pc, cache);
+        }
+        ++stacks[key];
+    }
+    char buf[32];
+    for (map<string, int>::iterator it = stacks.begin(); it != stacks.end(); ++it)
+    {
+        snprintf(buf, sizeof(buf), " %d\n", it->second);
+        out += it->first;
+        out += buf;
+    }
+}
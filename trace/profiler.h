@@ -0,0 +1,67 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+// 采样频率，取质数避免与定时任务同步
+const int PROF_HZ = 97;
+// 单次采样最长秒数，连接定时器是3*TIMESLOT，采样期间不能让连接超时
+const int PROF_MAX_SECONDS = 10;
+const int PROF_MAX_FRAMES = 48;
+const int PROF_MAX_SAMPLES = 16384;
+
+struct prof_sample
+{
+    int depth;
+    void *pc[PROF_MAX_FRAMES];
+};
+
+// 采样结束后的回调，在采样线程上调用，folded为折叠后的调用栈
+typedef void (*prof_done_fn)(void *arg, const string &folded);
+
+// 进程内的CPU采样分析
+// setitimer(ITIMER_PROF)按进程消耗的CPU时间发SIGPROF，信号处理函数沿帧指针回溯，把返回地址写进预分配的槽位；
+// 采样线程到时后停掉定时器，再做符号化并输出flamegraph.pl可用的折叠栈
+// 同一时间只允许一次采样
+class cpu_profiler
+{
+public:
+    static cpu_profiler *get_instance()
+    {
+        static cpu_profiler instance;
+        return &instance;
+    }
+    static void *profile_thread(void *)
+    {
+        cpu_profiler::get_instance()->run();
+        return NULL;
+    }
+
+    // 开始采样seconds秒，结束后调用done；已有采样在进行时返回false
+    bool start(int seconds, prof_done_fn done, void *arg);
+    // 线程启动时调用，记录本线程的栈范围；回溯只读这个范围内的内存，没有登记的线程只记录被打断的位置
+    static void register_thread();
+
+private:
+    cpu_profiler();
+    ~cpu_profiler();
+    static void on_sigprof(int sig, siginfo_t *info, void *ctx);
+    void run();
+    // 把样本折叠成"根;...;叶 次数"的文本
+    void fold(int count, string &out);
+
+private:
+    std::atomic<bool> m_busy;
+    int m_seconds;
+    prof_done_fn m_done;
+    void *m_arg;
+    prof_sample *m_samples;        // 采样期间有效，信号处理函数写
+    std::atomic<int> m_next;       // 下一个空闲槽位
+};
+
+#endif
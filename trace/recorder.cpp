@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include "recorder.h"
+
+// 两次自动转储的最小间隔
+static const uint64_t SLOW_DUMP_INTERVAL_NS = 10000000000ull;
+
+flight_recorder::flight_recorder()
+{
+    m_rings = NULL;
+    m_slow_us = 0;
+    strcpy(m_dir, "./");
+    m_running = false;
+    m_pending.store(-1, std::memory_order_relaxed);
+    m_last_slow.store(0, std::memory_order_relaxed);
+    m_tsc_base = tsc_now();
+    m_mono_base = monotonic_ns();
+    m_seq = 0;
+}
+
+flight_recorder::~flight_recorder()
+{
+}
+
+bool flight_recorder::init(int slow_ms, const char *dir)
+{
+    m_slow_us = slow_ms > 0 ? (uint64_t)slow_ms * 1000 : 0;
+    snprintf(m_dir, sizeof(m_dir), "%s", dir);
+    if (pthread_create(&m_tid, NULL, dump_thread, NULL) != 0)
+        return false;
+    pthread_detach(m_tid);
+    m_running = true;
+    return true;
+}
+
+fr_ring *flight_recorder::register_thread()
+{
+    fr_ring *r = new fr_ring;
+    memset(r->events, 0, sizeof(r->events));
+    r->pos.store(0, std::memory_order_relaxed);
+    r->tid = syscall(SYS_gettid);
+    snprintf(r->name, sizeof(r->name), "thread");
+    m_mutex.lock();
+    r->next = m_rings;
+    m_rings = r;
+    m_mutex.unlock();
+    return r;
+}
+
+void flight_recorder::set_thread_name(const char *name)
+{
+    snprintf(local()->name, FR_NAME_LEN, "%s", name);
+}
+
+void flight_recorder::trigger(int reason)
+{
+    if (!m_running)
+        return;
+    if (reason == FR_REASON_SLOW)
+    {
+        uint64_t now = monotonic_ns();
+        uint64_t last = m_last_slow.load(std::memory_order_relaxed);
+        if (last && now - last < SLOW_DUMP_INTERVAL_NS)
+            return;
+        // 多个线程同时超时只有一个触发
+        if (!m_last_slow.compare_exchange_strong(last, now))
+            return;
+    }
+    int none = -1;
+    if (m_pending.compare_exchange_strong(none, reason))
+        m_dump_sem.post();
+}
+
+void flight_recorder::run()
+{
+    while (true)
+    {
+        m_dump_sem.wait();
+        int reason = m_pending.load();
+        if (reason < 0)
+            continue;
+        dump(reason);
+        m_pending.store(-1);
+    }
+}
+
+bool flight_recorder::dump(int reason)
+{
+    char name[256];
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    snprintf(name, sizeof(name), "%sFlightRecorder_%d%02d%02d_%02d%02d%02d_%d.bin", m_dir,
+             my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+             my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, m_seq++);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    m_mutex.lock();
+    fr_ring *head = m_rings;
+    m_mutex.unlock();
+    uint32_t threads = 0;
+    for (fr_ring *r = head; r; r = r->next)
+        ++threads;
+
+    fr_file_header h;
+    memcpy(h.magic, FR_MAGIC, 8);
+    h.tsc_base = tsc_now();
+    h.mono_base = monotonic_ns();
+    h.real_base = realtime_ns();
+    h.tsc_per_ns = h.mono_base > m_mono_base ? (double)(h.tsc_base - m_tsc_base) / (h.mono_base - m_mono_base) : 1.0;
+    h.threads = threads;
+    h.reason = reason;
+    bool ok = ::write(fd, &h, sizeof(h)) == sizeof(h);
+
+    fr_event *copy = new fr_event[FR_RING_SIZE];
+    fr_event *ordered = new fr_event[FR_RING_SIZE];
+    for (fr_ring *r = head; r && ok; r = r->next)
+    {
+        uint64_t before = r->pos.load(std::memory_order_acquire);
+        memcpy(copy, r->events, sizeof(r->events));
+        uint64_t after = r->pos.load(std::memory_order_acquire);
+        // 拷贝期间写入的事件覆盖了最旧的一段，正在写的槽位也不可靠，都丢掉
+        uint64_t first = before > FR_RING_SIZE ? before - FR_RING_SIZE : 0;
+        if (after + 1 > first + FR_RING_SIZE)
+            first = after + 1 - FR_RING_SIZE;
+        uint32_t count = before > first ? before - first : 0;
+
+        fr_thread_header th;
+        memset(&th, 0, sizeof(th));
+        th.tid = r->tid;
+        th.count = count;
+        memcpy(th.name, r->name, FR_NAME_LEN);
+        th.name[FR_NAME_LEN - 1] = '\0';
+        ok = ::write(fd, &th, sizeof(th)) == sizeof(th);
+        // 按时间顺序排好再一次写出
+        for (uint32_t i = 0; i < count; ++i)
+            ordered[i] = copy[(first + i) & (FR_RING_SIZE - 1)];
+        if (ok && count)
+            ok = ::write(fd, ordered, count * sizeof(fr_event)) == (ssize_t)(count * sizeof(fr_event));
+    }
+    delete[] copy;
+    delete[] ordered;
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,146 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../timer/clock.h"
+
+// 飞行记录器事件类型，arg和aux的含义见注释
+enum FR_EVENT
+{
+    FR_EPOLL_WAKE = 1, // epoll_wait返回，arg为就绪事件数
+    FR_ACCEPT,         // 接受新连接，arg为fd
+    FR_DISPATCH_READ,  // 分发读事件，arg为fd
+    FR_DISPATCH_WRITE, // 分发写事件，arg为fd
+    FR_QUEUE_PUSH,     // 放入线程池队列，arg为放入后的队列长度
+    FR_QUEUE_POP,      // 工作线程取出请求，arg为取出后的队列长度
+    FR_TIMER_TICK,     // 定时器检查，arg为检查前的定时器数量
+    FR_TIMER_EXPIRE,   // 连接超时被关闭，arg为fd
+    FR_DB_ACQUIRE,     // 取得数据库连接，arg为剩余空闲连接数
+    FR_DB_RELEASE,     // 归还数据库连接，arg为归还后的空闲连接数
+    FR_SEND_DONE,      // 响应发送完成，arg为请求总耗时(微秒)，aux为fd
+    FR_EVENT_NUM
+};
+
+// 触发转储的原因
+enum FR_REASON
+{
+    FR_REASON_SIGNAL = 0, // 收到SIGUSR2
+    FR_REASON_SLOW         // 有请求超过耗时阈值
+};
+
+// 每个事件16字节，时间戳为tsc_now()
+struct fr_event
+{
+    uint64_t tsc;
+    uint32_t arg;
+    uint16_t type;
+    uint16_t aux;
+};
+
+// 每个线程的事件环大小，必须是2的幂，4096个事件占64KB
+const int FR_RING_SIZE = 4096;
+const int FR_NAME_LEN = 16;
+
+// 转储文件格式：文件头，然后每个线程一个线程头加按时间顺序的事件
+#define FR_MAGIC "TWSFR001"
+struct fr_file_header
+{
+    char magic[8];
+    uint64_t tsc_base;   // 与mono_base同一时刻
+    uint64_t mono_base;  // monotonic_ns
+    uint64_t real_base;  // realtime_ns，与mono_base同一时刻
+    double tsc_per_ns;   // 每纳秒的时间戳计数
+    uint32_t threads;
+    uint32_t reason;
+};
+struct fr_thread_header
+{
+    uint32_t tid;
+    uint32_t count;
+    char name[FR_NAME_LEN];
+};
+
+// 单写者的事件环，只有所属线程写；转储线程读取时检测被覆盖的部分并丢弃
+struct fr_ring
+{
+    fr_event events[FR_RING_SIZE];
+    std::atomic<uint64_t> pos; // 已写入的事件总数
+    uint32_t tid;
+    char name[FR_NAME_LEN];
+    fr_ring *next;
+};
+
+// 飞行记录器
+// 常开，每个线程把最近的事件写进自己的环形缓冲区，写入只有一次rdtsc和16字节的存储
+// 收到SIGUSR2或有请求超过阈值时，由独立的转储线程把所有线程的事件写成文件，用trace2json转换成Chrome trace
+class flight_recorder
+{
+public:
+    static flight_recorder *get_instance()
+    {
+        static flight_recorder instance;
+        return &instance;
+    }
+    static void *dump_thread(void *)
+    {
+        flight_recorder::get_instance()->run();
+        return NULL;
+    }
+
+    // slow_ms为自动转储的请求耗时阈值，0不自动转储；dir为转储文件目录
+    bool init(int slow_ms, const char *dir = "./");
+    static void record(int type, uint32_t arg, uint16_t aux = 0)
+    {
+        fr_ring *r = local();
+        uint64_t p = r->pos.load(std::memory_order_relaxed);
+        fr_event &e = r->events[p & (FR_RING_SIZE - 1)];
+        e.tsc = tsc_now();
+        e.arg = arg;
+        e.type = type;
+        e.aux = aux;
+        r->pos.store(p + 1, std::memory_order_release);
+    }
+    // 给当前线程的事件环命名，转储时显示为线程名
+    static void set_thread_name(const char *name);
+    // 请求完成时调用，超过阈值时触发转储
+    void check_slow(uint64_t total_us)
+    {
+        if (m_slow_us && total_us >= m_slow_us)
+            trigger(FR_REASON_SLOW);
+    }
+    // 通知转储线程写文件，不阻塞；自动转储10秒内最多一次
+    void trigger(int reason);
+
+private:
+    flight_recorder();
+    ~flight_recorder();
+    static fr_ring *local()
+    {
+        static thread_local fr_ring *r = NULL;
+        if (!r)
+            r = get_instance()->register_thread();
+        return r;
+    }
+    fr_ring *register_thread();
+    void run();
+    bool dump(int reason);
+
+private:
+    fr_ring *m_rings;  // 所有线程的事件环，只增不删
+    locker m_mutex;    // 只在登记新线程时使用
+    uint64_t m_slow_us;
+    char m_dir[128];
+    bool m_running;
+    pthread_t m_tid;
+    sem m_dump_sem;
+    std::atomic<int> m_pending;      // 待转储的原因，-1表示没有
+    std::atomic<uint64_t> m_last_slow; // 上次自动转储的单调时间
+    uint64_t m_tsc_base;
+    uint64_t m_mono_base;
+    int m_seq;
+};
+
+#endif
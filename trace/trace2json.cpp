@@ -0,0 +1,88 @@
+/*************************************************************
+ * 飞行记录器转换：把FlightRecorder_*.bin转换成Chrome trace JSON
+ * 用法: ./trace2json FlightRecorder_xxx.bin > trace.json，用chrome://tracing或Perfetto打开
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "recorder.h"
+
+using namespace std;
+
+static const char *event_names[FR_EVENT_NUM] = {
+    "?", "epoll_wake", "accept", "dispatch_read", "dispatch_write", "queue_push", "queue_pop",
+    "timer_tick", "timer_expire", "db_acquire", "db_release", "send_done"};
+static const char *arg_names[FR_EVENT_NUM] = {
+    "", "events", "fd", "fd", "fd", "depth", "depth", "timers", "fd", "free", "free", "total_us"};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s FlightRecorder_xxx.bin\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(argv[1], "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "open %s failed\n", argv[1]);
+        return 1;
+    }
+    fr_file_header h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, FR_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+    if (h.tsc_per_ns <= 0)
+        h.tsc_per_ns = 1.0;
+
+    printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"reason\":\"%s\",\"real_base_ns\":%llu},\"traceEvents\":[\n",
+           h.reason == FR_REASON_SLOW ? "slow request" : "signal", (unsigned long long)h.real_base);
+    bool first = true;
+    vector<fr_event> events;
+    for (uint32_t t = 0; t < h.threads; ++t)
+    {
+        fr_thread_header th;
+        if (fread(&th, sizeof(th), 1, fp) != 1)
+        {
+            fprintf(stderr, "%s: truncated thread header\n", argv[1]);
+            break;
+        }
+        th.name[FR_NAME_LEN - 1] = '\0';
+        events.resize(th.count);
+        if (th.count && fread(events.data(), sizeof(fr_event), th.count, fp) != th.count)
+        {
+            fprintf(stderr, "%s: truncated events of thread %u\n", argv[1], th.tid);
+            break;
+        }
+        printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+               first ? "" : ",\n", th.tid, th.name);
+        first = false;
+        for (uint32_t i = 0; i < th.count; ++i)
+        {
+            const fr_event &e = events[i];
+            if (e.type == 0 || e.type >= FR_EVENT_NUM)
+                continue;
+            // 换算成相对转储时刻的微秒，再平移到单调时钟
+            double ns = (double)h.mono_base - ((double)h.tsc_base - (double)e.tsc) / h.tsc_per_ns;
+            double us = ns / 1000.0;
+            if (e.type == FR_SEND_DONE)
+            {
+                // 请求画成一段，从读事件就绪到发送完成
+                printf(",\n{\"name\":\"request fd=%u\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%u,\"args\":{\"fd\":%u,\"total_us\":%u}}",
+                       e.aux, th.tid, us - e.arg, e.arg, e.aux, e.arg);
+                continue;
+            }
+            printf(",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"%s\":%u}}",
+                   event_names[e.type], th.tid, us, arg_names[e.type], e.arg);
+        }
+    }
+    printf("\n]}\n");
+    fclose(fp);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "webserver.h"
+#include "config.h"
 
 WebServer::WebServer()
 {
@@ -14,6 +15,7 @@ WebServer::WebServer()
     strcat(m_root, root);
     // 定时器
     users_timer = new client_data[MAX_FD];
+    m_accept_paused = false;
 }
 
 WebServer::~WebServer()
@@ -22,25 +24,39 @@ WebServer::~WebServer()
     close(m_listenfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
+    // 线程池析构时回收线程，要在释放连接数组之前
+    delete m_pool;
+    delete m_hashpool;
     delete[] users;
     delete[] users_timer;
-    delete m_pool;
 }
 
-void WebServer::init(int port, string user, string passWord, string databaseName, int log_write,
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+void WebServer::init(const Config &config, string user, string passWord, string databaseName)
 {
-    m_port = port;
+    m_port = config.PORT;
     m_user = user;
     m_passWord = passWord;
     m_databaseName = databaseName;
-    m_sql_num = sql_num;
-    m_thread_num = thread_num;
-    m_log_write = log_write;
-    m_OPT_LINGER = opt_linger;
-    m_TRIGMode = trigmode;
-    m_close_log = close_log;
-    m_actormodel = actor_model;
+    m_sql_num = config.sql_num;
+    m_thread_num = config.thread_num;
+    m_log_write = config.LOGWrite;
+    m_OPT_LINGER = config.OPT_LINGER;
+    m_TRIGMode = config.TRIGMode;
+    m_close_log = config.close_log;
+    m_actormodel = config.actor_model;
+    m_log_flush_ms = config.log_flush_ms;
+    m_log_flush_kb = config.log_flush_kb;
+    m_log_level = config.log_level;
+    m_log_max_mb = config.log_max_mb;
+    m_log_keep = config.log_keep;
+    m_log_gzip = config.log_gzip;
+    m_log_rate = config.log_rate;
+    m_log_sample = config.log_sample;
+    m_access_log = config.access_log;
+    m_flight_slow_ms = config.flight_slow_ms;
+    m_capture_mb = config.capture_mb;
+    m_admission_ms = config.admission_ms;
+    m_drain_ms = config.drain_ms;
 }
 
 void WebServer::trig_mode()
@@ -76,12 +92,25 @@ void WebServer::log_write()
     // m_close_log==1为关闭日志
     if (0 == m_close_log)
     {
-        // 初始化日志，m_log_write==1为异步
-        if (1 == m_log_write)
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+        // 初始化日志，m_log_write==1为异步，m_log_write==2为二进制格式
+        if (2 == m_log_write)
+            Log::get_instance()->init("./ServerLog.bin", m_close_log, 2000, 800000, 64 * 1024, m_log_flush_ms, m_log_flush_kb, true);
+        else if (1 == m_log_write)
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 64 * 1024, m_log_flush_ms, m_log_flush_kb);
         else
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0, m_log_flush_ms, m_log_flush_kb);
+        Log::get_instance()->set_level(m_log_level);
+        Log::get_instance()->set_rotation((long long)m_log_max_mb * 1024 * 1024, m_log_keep, 1 == m_log_gzip);
+        // 限流允许一秒的突发量
+        Log::get_instance()->set_rate_limit(m_log_rate, m_log_rate);
+        if (!Log::get_instance()->set_sampling(m_log_sample.c_str()))
+            LOG_WARN("invalid log sampling \"%s\", ignored", m_log_sample.c_str());
     }
+    // 访问日志与运行日志相互独立，不受close_log影响
+    if (m_access_log != ACCESS_OFF && !access_log::get_instance()->init("./AccessLog", m_access_log))
+        LOG_ERROR("%s", "access log init failed");
+    if (m_capture_mb > 0 && !traffic_capture::get_instance()->init(m_capture_mb, m_close_log))
+        LOG_ERROR("%s", "traffic capture init failed");
 }
 
 void WebServer::sql_pool()
@@ -96,8 +125,71 @@ void WebServer::sql_pool()
 
 void WebServer::thread_pool()
 {
-    // 线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    // 线程池，工作线程按并发模型和连接的触发模式实例化，需要先调用trig_mode
+    // proactor模式下工作线程不读写连接，触发模式无关
+    if (1 == m_actormodel && 1 == m_CONNTrigmode)
+        m_pool = new threadpool<http_conn>(ReactorPolicy(), EdgeTriggered(), m_connPool, m_thread_num);
+    else if (1 == m_actormodel)
+        m_pool = new threadpool<http_conn>(ReactorPolicy(), LevelTriggered(), m_connPool, m_thread_num);
+    else
+        m_pool = new threadpool<http_conn>(ProactorPolicy(), LevelTriggered(), m_connPool, m_thread_num);
+    // 口令哈希线程池，线程数为工作线程的四分之一，限制登录占用的CPU
+    int hash_thread_num = m_thread_num / 4 > 0 ? m_thread_num / 4 : 1;
+    m_hashpool = new hashpool<http_conn>(hash_thread_num, 64);
+    http_conn::m_hashpool = m_hashpool;
+
+    // 准入控制，过载时直接回复的503提前生成好
+    m_pool->set_admission(m_admission_ms);
+    http_conn::render_overload(1);
+}
+
+// /metrics抓取时读取的瞬时值
+static long long gauge_users(void *) { return http_conn::m_user_count.load(std::memory_order_relaxed); }
+static long long gauge_queue(void *arg) { return ((threadpool<http_conn> *)arg)->size(); }
+static long long gauge_hash_queue(void *arg) { return ((hashpool<http_conn> *)arg)->size(); }
+static long long gauge_db_free(void *arg) { return ((connection_pool *)arg)->GetFreeConn(); }
+static long long gauge_db_used(void *arg) { return ((connection_pool *)arg)->GetUsedConn(); }
+static long long gauge_timers(void *arg) { return ((sort_timer_lst *)arg)->size(); }
+static long long gauge_cache_users(void *) { return user_cache::GetInstance()->size(); }
+static long long gauge_cache_lag(void *) { return user_cache::GetInstance()->lag(); }
+static long long gauge_sessions(void *) { return session_store::get_instance()->size(); }
+static long long gauge_log_waits(void *) { return Log::get_instance()->waits(); }
+static long long gauge_access_dropped(void *) { return access_log::get_instance()->dropped(); }
+static long long gauge_overloaded(void *arg) { return ((threadpool<http_conn> *)arg)->overloaded(); }
+static long long gauge_accept_paused(void *arg) { return *(bool *)arg; }
+
+// 收到SIGUSR1时输出各阶段耗时分位数，日志关闭时输出到标准错误
+void WebServer::dump_latency()
+{
+    string text;
+    metrics::get_instance()->dump_latency(text);
+    if (0 == m_close_log)
+    {
+        // 一次写成一条多行日志，用WARN级别避免被-v和INFO采样过滤掉
+        text.erase(text.size() - 1);
+        LOG_WARN("stage latency since start:\n%s", text.c_str());
+        Log::get_instance()->flush();
+    }
+    else
+        fputs(text.c_str(), stderr);
+}
+
+void WebServer::metrics_register()
+{
+    metrics *m = metrics::get_instance();
+    m->add_gauge("webserver_connections", "Open client connections.", gauge_users, NULL);
+    m->add_gauge("webserver_threadpool_queue_depth", "Requests waiting for a worker thread.", gauge_queue, m_pool);
+    m->add_gauge("webserver_hashpool_queue_depth", "Logins waiting for a password hash thread.", gauge_hash_queue, m_hashpool);
+    m->add_gauge("webserver_db_connections{state=\"free\"}", "Database pool connections by state.", gauge_db_free, m_connPool);
+    m->add_gauge("webserver_db_connections{state=\"used\"}", "Database pool connections by state.", gauge_db_used, m_connPool);
+    m->add_gauge("webserver_timers", "Connection timers in the timer list.", gauge_timers, &utils.m_timer_lst);
+    m->add_gauge("webserver_user_cache_users", "Users held in the in-memory user cache.", gauge_cache_users, NULL);
+    m->add_gauge("webserver_user_cache_lag_seconds", "Seconds since the user cache last caught up with the database.", gauge_cache_lag, NULL);
+    m->add_gauge("webserver_sessions", "Live login sessions.", gauge_sessions, NULL);
+    m->add_counter("webserver_log_buffer_waits_total", "Times a thread waited for the async log writer to return a buffer.", gauge_log_waits, NULL);
+    m->add_counter("webserver_access_log_dropped_total", "Access log records dropped because a ring was full.", gauge_access_dropped, NULL);
+    m->add_gauge("webserver_overloaded", "1 while admission control considers the request queue overloaded.", gauge_overloaded, m_pool);
+    m->add_gauge("webserver_accept_paused", "1 while accepting new connections is paused because of overload.", gauge_accept_paused, &m_accept_paused);
 }
 
 // 创建连接基础设施
@@ -149,6 +241,12 @@ void WebServer::eventListen()
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
+
+    // 飞行记录器的转储线程，记录本身常开
+    if (!flight_recorder::get_instance()->init(m_flight_slow_ms))
+        LOG_ERROR("%s", "flight recorder init failed");
 
     alarm(TIMESLOT);
 
@@ -157,15 +255,19 @@ void WebServer::eventListen()
     Utils::u_epollfd = m_epollfd;
 }
 
+template <typename ConnTrig>
 void WebServer::timer(int connfd, struct sockaddr_in client_address)
 {
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
+    PROBE3(conn__accept, connfd, ntohl(client_address.sin_addr.s_addr), ntohs(client_address.sin_port));
+    traffic_capture::open(connfd);
+    users[connfd].init<ConnTrig>(connfd, client_address, m_root, m_close_log);
 
     // 初始化client_data数据
     // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
-    util_timer *timer = new util_timer;
+    users_timer[connfd].busy = &users[connfd].m_async;
+    util_timer *timer = utils.m_timer_lst.alloc_timer();
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
     time_t cur = time(NULL);
@@ -187,6 +289,9 @@ void WebServer::adjust_timer(util_timer *timer)
 
 void WebServer::deal_timer(util_timer *timer, int sockfd)
 {
+    // 连接已经关闭
+    if (!timer)
+        return;
     timer->cb_func(&users_timer[sockfd]);
     if (timer)
     {
@@ -196,25 +301,33 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
     LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
 
+template <typename ListenTrig, typename ConnTrig>
 bool WebServer::dealclinetdata()
 {
     struct sockaddr_in client_address;
     socklen_t client_addrlength = sizeof(client_address);
-    if (0 == m_LISTENTrigmode)
+    if (0 == ListenTrig::mode)
     {
         int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
         if (connfd < 0)
         {
-            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            // 连接在accept前被对端重置，或排空时listenfd已经取空
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                metrics::count_accept_error();
+            }
             return false;
         }
         if (http_conn::m_user_count >= MAX_FD)
         {
-            utils.show_error(connfd, "Internal server busy");
+            metrics::count_busy_reject();
+            utils.show_error(connfd, http_conn::overload_response());
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
-        timer(connfd, client_address);
+        flight_recorder::record(FR_ACCEPT, connfd);
+        timer<ConnTrig>(connfd, client_address);
     }
 
     else
@@ -224,17 +337,24 @@ bool WebServer::dealclinetdata()
             int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
             if (connfd < 0)
             {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                // ET模式下循环accept到EAGAIN才结束，不算错误
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                    metrics::count_accept_error();
+                }
                 break;
             }
             // 连接数超了
             if (http_conn::m_user_count >= MAX_FD)
             {
-                utils.show_error(connfd, "Internal server busy");
+                metrics::count_busy_reject();
+                utils.show_error(connfd, http_conn::overload_response());
                 LOG_ERROR("%s", "Internal server busy");
                 break;
             }
-            timer(connfd, client_address);
+            flight_recorder::record(FR_ACCEPT, connfd);
+            timer<ConnTrig>(connfd, client_address);
         }
         return false;
     }
@@ -271,37 +391,64 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 stop_server = true;
                 break;
             }
+            case SIGUSR1:
+            {
+                dump_latency();
+                break;
+            }
+            case SIGUSR2:
+            {
+                flight_recorder::get_instance()->trigger(FR_REASON_SIGNAL);
+                break;
+            }
             }
         }
     }
     return true;
 }
 
+template <typename Actor, typename ConnTrig>
 void WebServer::dealwithread(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+    users[sockfd].mark_ready();
 
     // reactor
-    if (1 == m_actormodel)
+    if (1 == Actor::model)
     {
         if (timer)
         {
             adjust_timer(timer);
         }
 
+        // 过载或队列满时不入队，直接回复503并关闭连接，主线程也不用等工作线程
+        if (!m_pool->admit())
+        {
+            users[sockfd].shed();
+            deal_timer(timer, sockfd);
+            return;
+        }
+
         // 若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
+        users[sockfd].mark_queued();
+        if (!m_pool->append(users + sockfd, 0))
+        {
+            users[sockfd].shed();
+            deal_timer(timer, sockfd);
+            return;
+        }
 
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            // acquire与工作线程写improv的release配对，之后读到的timer_flag是工作线程写入的值
+            if (1 == users[sockfd].improv.load(std::memory_order_acquire))
             {
-                if (1 == users[sockfd].timer_flag)
+                if (1 == users[sockfd].timer_flag.load(std::memory_order_relaxed))
                 {
                     deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    users[sockfd].timer_flag.store(0, std::memory_order_relaxed);
                 }
-                users[sockfd].improv = 0;
+                users[sockfd].improv.store(0, std::memory_order_relaxed);
                 break;
             }
         }
@@ -309,12 +456,26 @@ void WebServer::dealwithread(int sockfd)
     else
     {
         // proactor
-        if (users[sockfd].read_once())
+        if (users[sockfd].read_once<ConnTrig>())
         {
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
+            // 已经读入的请求同样不再入队，回复503后关闭
+            if (!m_pool->admit())
+            {
+                users[sockfd].shed();
+                deal_timer(timer, sockfd);
+                return;
+            }
+
             // 若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            users[sockfd].mark_queued();
+            if (!m_pool->append_p(users + sockfd))
+            {
+                users[sockfd].shed();
+                deal_timer(timer, sockfd);
+                return;
+            }
 
             if (timer)
             {
@@ -328,29 +489,37 @@ void WebServer::dealwithread(int sockfd)
     }
 }
 
+template <typename Actor, typename ConnTrig>
 void WebServer::dealwithwrite(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+    // 异步生成的响应已经注册写事件，连接回到主线程手中
+    users[sockfd].m_async.store(false, std::memory_order_relaxed);
     // reactor
-    if (1 == m_actormodel)
+    if (1 == Actor::model)
     {
         if (timer)
         {
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
+        // 响应已经生成，队列满时无法继续发送，只能关闭连接
+        if (!m_pool->append(users + sockfd, 1))
+        {
+            deal_timer(timer, sockfd);
+            return;
+        }
 
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == users[sockfd].improv.load(std::memory_order_acquire))
             {
-                if (1 == users[sockfd].timer_flag)
+                if (1 == users[sockfd].timer_flag.load(std::memory_order_relaxed))
                 {
                     deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    users[sockfd].timer_flag.store(0, std::memory_order_relaxed);
                 }
-                users[sockfd].improv = 0;
+                users[sockfd].improv.store(0, std::memory_order_relaxed);
                 break;
             }
         }
@@ -358,7 +527,7 @@ void WebServer::dealwithwrite(int sockfd)
     else
     {
         // proactor
-        if (users[sockfd].write())
+        if (users[sockfd].write<ConnTrig>())
         {
             LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
@@ -374,19 +543,135 @@ void WebServer::dealwithwrite(int sockfd)
     }
 }
 
+// 过载时暂停监听listenfd，恢复后重新监听；EPOLL_CTL_MOD会重新报告已就绪的事件，积压的连接不会漏掉
+template <typename ListenTrig>
+void WebServer::update_accept()
+{
+    // 排空阶段listenfd已经关闭
+    if (m_listenfd < 0)
+        return;
+    bool pause = !m_pool->admit();
+    if (pause == m_accept_paused)
+        return;
+    epoll_event event;
+    event.data.fd = m_listenfd;
+    event.events = pause ? 0 : (EPOLLIN | EPOLLRDHUP | ListenTrig::epoll_flag);
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, m_listenfd, &event);
+    m_accept_paused = pause;
+    if (pause)
+        LOG_WARN("%s", "overloaded, accept paused");
+    else
+        LOG_WARN("%s", "accept resumed");
+}
+
+// 收到SIGTERM后进入排空：先取走accept队列中已经完成握手的连接，再关闭listenfd
+// 这些连接的客户端认为连接已经建立，和其他在途连接一样处理完请求再关闭
+template <typename ConnTrig>
+void WebServer::begin_drain()
+{
+    dealclinetdata<EdgeTriggered, ConnTrig>();
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    close(m_listenfd);
+    m_listenfd = -1;
+    // 之后生成的响应都带Connection:close，已经发出keep-alive的响应发完也关闭
+    http_conn::m_draining.store(true, std::memory_order_relaxed);
+    LOG_WARN("draining %d connections, at most %dms", utils.m_timer_lst.size(), m_drain_ms);
+}
+
+// 关闭没有请求在处理的连接，剩下的在响应发完后关闭
+void WebServer::close_idle()
+{
+    for (int fd = 0; fd < MAX_FD; ++fd)
+    {
+        if (users_timer[fd].timer && users[fd].idle())
+            deal_timer(users_timer[fd].timer, fd);
+    }
+}
+
+// 回收工作线程和哈希线程，强制关闭超时仍未完成的连接，写出日志
+void WebServer::end_drain()
+{
+    // 超时退出时队列中可能还有请求，线程处理完才退出
+    m_pool->stop();
+    m_hashpool->stop();
+    user_cache::GetInstance()->stop();
+    int left = utils.m_timer_lst.size();
+    for (int fd = 0; fd < MAX_FD; ++fd)
+    {
+        if (users_timer[fd].timer)
+            deal_timer(users_timer[fd].timer, fd);
+    }
+    if (left > 0)
+        LOG_WARN("drain timed out, %d connections closed", left);
+    else
+        LOG_INFO("%s", "drain finished");
+    // 其他线程都已退出，写出缓冲中的流量捕获和日志
+    if (m_capture_mb > 0)
+        traffic_capture::get_instance()->close_file();
+    if (0 == m_close_log)
+        Log::get_instance()->flush();
+}
+
+// 按配置选定一组模板实例，事件循环内部不再判断并发模型和触发模式
 void WebServer::eventLoop()
+{
+    if (1 == m_actormodel)
+        event_loop_actor<ReactorPolicy>();
+    else
+        event_loop_actor<ProactorPolicy>();
+}
+
+template <typename Actor>
+void WebServer::event_loop_actor()
+{
+    if (0 == m_LISTENTrigmode && 0 == m_CONNTrigmode)
+        event_loop<Actor, LevelTriggered, LevelTriggered>();
+    else if (0 == m_LISTENTrigmode)
+        event_loop<Actor, LevelTriggered, EdgeTriggered>();
+    else if (0 == m_CONNTrigmode)
+        event_loop<Actor, EdgeTriggered, LevelTriggered>();
+    else
+        event_loop<Actor, EdgeTriggered, EdgeTriggered>();
+}
+
+template <typename Actor, typename ListenTrig, typename ConnTrig>
+void WebServer::event_loop()
 {
     bool timeout = false;
     bool stop_server = false;
+    uint64_t drain_start = 0; // 开始排空的时间，0表示还没有收到SIGTERM
+    uint64_t deadline = 0;
+    flight_recorder::set_thread_name("main");
+    cpu_profiler::register_thread();
 
-    while (!stop_server)
+    while (true)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        if (stop_server && !drain_start)
+        {
+            begin_drain<ConnTrig>();
+            drain_start = monotonic_ns();
+            deadline = drain_start + (uint64_t)(m_drain_ms > 0 ? m_drain_ms : 0) * 1000000;
+        }
+        if (drain_start)
+        {
+            // 空闲的长连接先留一秒，客户端紧接着发来的请求照常处理并带Connection:close，
+            // 避免关闭时正好有请求在路上被重置；一秒后仍然空闲的直接关闭
+            uint64_t now = monotonic_ns();
+            if (now >= drain_start + 1000000000ull)
+                close_idle();
+            // 每个打开的连接在定时器链表中恰好有一个定时器，关闭时随之删除
+            if ((0 == utils.m_timer_lst.size() && m_pool->idle() && m_hashpool->idle()) || now >= deadline)
+                break;
+        }
+        // 暂停accept或排空期间没有事件也要定期检查
+        int wait_ms = drain_start ? 50 : (m_accept_paused ? 10 : -1);
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, wait_ms);
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
             break;
         }
+        flight_recorder::record(FR_EPOLL_WAKE, number > 0 ? number : 0);
 
         for (int i = 0; i < number; i++)
         {
@@ -395,7 +680,7 @@ void WebServer::eventLoop()
             // 处理新到的客户连接
             if (sockfd == m_listenfd)
             {
-                bool flag = dealclinetdata();
+                bool flag = dealclinetdata<ListenTrig, ConnTrig>();
                 if (false == flag)
                     continue;
             }
@@ -415,20 +700,27 @@ void WebServer::eventLoop()
             // 处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
-                dealwithread(sockfd);
+                flight_recorder::record(FR_DISPATCH_READ, sockfd);
+                dealwithread<Actor, ConnTrig>(sockfd);
             }
             else if (events[i].events & EPOLLOUT)
             {
-                dealwithwrite(sockfd);
+                flight_recorder::record(FR_DISPATCH_WRITE, sockfd);
+                dealwithwrite<Actor, ConnTrig>(sockfd);
             }
         }
         if (timeout)
         {
             utils.timer_handler();
+            // 会话过期清理与连接定时器共用同一个时钟
+            session_store::get_instance()->tick();
 
             LOG_INFO("%s", "timer tick");
 
             timeout = false;
         }
+        update_accept<ListenTrig>();
     }
+    if (drain_start)
+        end_drain();
 }
\ No newline at end of file
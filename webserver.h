@@ -14,34 +14,54 @@
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./trace/probes.h"
 
 const int MAX_FD = 65536;           // 最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; // 最大事件数
 const int TIMESLOT = 1000;          // 最小超时单位
 
+class Config;
+
 class WebServer
 {
 public:
     WebServer();
     ~WebServer();
 
-    void init(int port, string user, string passWord, string databaseName,
-              int log_write, int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+    // 命令行参数来自config，数据库账号由调用方给出
+    void init(const Config &config, string user, string passWord, string databaseName);
 
     void thread_pool();
+    void metrics_register();
+    void dump_latency();
     void sql_pool();
     void log_write();
     void trig_mode();
     void eventListen();
     void eventLoop();
+    // 以下模板按并发模型(Actor)、监听和连接的触发模式(ListenTrig、ConnTrig)实例化，见http/io_policy.h
+    // eventLoop按配置选定一组，之后每个事件不再判断模式
+    template <typename Actor>
+    void event_loop_actor();
+    template <typename Actor, typename ListenTrig, typename ConnTrig>
+    void event_loop();
+    template <typename ConnTrig>
     void timer(int connfd, struct sockaddr_in client_address);
     void adjust_timer(util_timer *timer);
     void deal_timer(util_timer *timer, int sockfd);
+    template <typename ListenTrig, typename ConnTrig>
     bool dealclinetdata();
     bool dealwithsignal(bool &timeout, bool &stop_server);
+    template <typename Actor, typename ConnTrig>
     void dealwithread(int sockfd);
+    template <typename Actor, typename ConnTrig>
     void dealwithwrite(int sockfd);
+    template <typename ListenTrig>
+    void update_accept();
+    template <typename ConnTrig>
+    void begin_drain();
+    void close_idle();
+    void end_drain();
 
 public:
     // 基础
@@ -50,6 +70,19 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
+    int m_log_flush_ms;
+    int m_log_flush_kb;
+    int m_log_level;
+    int m_log_max_mb;
+    int m_log_keep;
+    int m_log_gzip;
+    int m_log_rate;
+    string m_log_sample;
+    int m_access_log;
+    int m_flight_slow_ms;
+    int m_capture_mb;
+    int m_admission_ms;
+    int m_drain_ms;
 
     int m_pipefd[2];
     int m_epollfd;
@@ -65,6 +98,7 @@ public:
     // 线程池相关
     threadpool<http_conn> *m_pool; // 线程池
     int m_thread_num;              // 线程数
+    hashpool<http_conn> *m_hashpool; // 口令哈希线程池
 
     // epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
@@ -74,6 +108,7 @@ public:
     int m_TRIGMode;
     int m_LISTENTrigmode;
     int m_CONNTrigmode;
+    bool m_accept_paused; // 过载时暂停监听listenfd，新连接留在内核的accept队列中
 
     // 定时器相关
     client_data *users_timer; // 定时器客户端信息